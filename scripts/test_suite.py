@@ -1,4 +1,7 @@
+import json
 import os
+import subprocess
+import tempfile
 import colorama
 from colorama import Fore
 from colorama import Style
@@ -19,21 +22,39 @@ categories = ["rv32ui", "rv32uc", "rv32si", "rv32mi"]
 
 binary = "./obj_dir/VTop"
 
+tests = [test for category in categories for test in arr if test.find(category) != -1]
+
+# All tests run in a pool of simulator processes, failures are re-run individually
+# with debug output enabled. VTop exits with an error if any test failed, so only a
+# missing summary means the run itself failed.
+with tempfile.TemporaryDirectory() as tmp:
+    list_file = os.path.join(tmp, "test_suite.list")
+    out_file = os.path.join(tmp, "test_suite.json")
+    with open(list_file, "w") as f:
+        f.write("\n".join(tests) + "\n")
+
+    proc = subprocess.run([binary, "-t", "--batch", list_file, "--batch-out", out_file])
+    if not os.path.exists(out_file):
+        print(f"{Fore.RED}batch run failed with exit code {proc.returncode}, no results{Style.RESET_ALL}")
+        exit(-1)
+    with open(out_file) as f:
+        results = json.load(f)["results"]
+
 any_failed = False
 
-for category in categories:
-    tests = [test for test in arr if test.find(category) != -1]
-    for test in tests:
-        print(f"running {test}:", end='')
-        result = os.popen(f"{binary} -t {test}").read()
-
-        if result.startswith("PASSED"):
-            print(f" {Fore.GREEN}passed{Style.RESET_ALL}")
-        else:
-            print(f" {Fore.RED}failed{Style.RESET_ALL}:")
-            print(os.popen(f"{binary} -x 0 -t {test} 2>&1 | tail -n32").read())
-            print("\n")
-            any_failed = True
+for result in results:
+    test = result["name"]
+    if result["status"] == "passed":
+        print(f"{test}: {Fore.GREEN}passed{Style.RESET_ALL}")
+    else:
+        print(f"{test}: {Fore.RED}{result['status']}{Style.RESET_ALL}:")
+        print(os.popen(f"{binary} -x 0 -t {test} 2>&1 | tail -n32").read())
+        print("\n")
+        any_failed = True
+
+if proc.returncode != 0 and not any_failed:
+    print(f"{Fore.RED}batch run failed with exit code {proc.returncode}{Style.RESET_ALL}")
+    any_failed = True
 
 if any_failed:
     exit(-1)
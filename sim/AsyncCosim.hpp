@@ -0,0 +1,160 @@
+#pragma once
+#include "SPSCQueue.hpp"
+#include "Simif.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Runs Spike on its own thread, so that the RTL and the ISS step in parallel. The
+// simulation thread pushes commit records and only waits when the ring is full. The
+// worker stops at the first failed check; the simulation thread notices with some delay,
+// but all state needed for the report is in the failing record (and Spike stops there).
+//
+// While records are in flight, Spike (including its memory and the models) belongs to the
+// worker. Call drain() before touching it from the simulation thread.
+class AsyncCosim
+{
+  public:
+    struct Failure
+    {
+        int err;
+        CosimRecord rec;
+        uint32_t startPC;
+    };
+
+    AsyncCosim(SpikeSimif& simif) : simif(simif), thread([this] { run(); })
+    {
+    }
+
+    ~AsyncCosim()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+    AsyncCosim(const AsyncCosim&) = delete;
+    AsyncCosim& operator=(const AsyncCosim&) = delete;
+
+    void push(const CosimRecord& rec)
+    {
+        int spins = 0;
+        while (!ring.try_push(rec))
+        {
+            if (failed())
+                return;
+            backoff(spins);
+        }
+        if (sleeping.load(std::memory_order_acquire))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wake.notify_one();
+        }
+    }
+
+    // Wait until all records are checked, or a check failed.
+    void drain()
+    {
+        int spins = 0;
+        while (!ring.empty() && !failed())
+            backoff(spins);
+        // The worker may still be inside the last check
+        while (busy.load(std::memory_order_acquire))
+            backoff(spins);
+    }
+
+    bool failed() const
+    {
+        return hasFailure.load(std::memory_order_acquire);
+    }
+
+    const Failure& failure() const
+    {
+        return fail;
+    }
+
+    // Drop unchecked records and any failure, e.g. before restarting from a snapshot.
+    void reset()
+    {
+        drain();
+        // The worker does not touch the ring while a failure is pending
+        if (failed())
+        {
+            ring.clear();
+            hasFailure.store(false, std::memory_order_release);
+        }
+    }
+
+  private:
+    // Spin this often on an empty (or full) ring before going to sleep
+    static constexpr int SPIN_COUNT = 4096;
+
+    SpikeSimif& simif;
+    SPSCQueue<CosimRecord, 1024> ring;
+    Failure fail;
+    std::atomic<bool> hasFailure{false};
+    std::atomic<bool> busy{false};
+    std::atomic<bool> sleeping{false};
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+
+    // Spin first, then sleep, so that waiting does not starve the other thread if both
+    // share a core.
+    static void backoff(int& spins)
+    {
+        if (++spins < SPIN_COUNT)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+
+    void run()
+    {
+        int idle = 0;
+        while (true)
+        {
+            CosimRecord* rec = failed() ? nullptr : ring.front();
+            if (!rec)
+            {
+                if (++idle < SPIN_COUNT)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                // Sleep until the producer pushes again. The timeout covers the race
+                // between checking the ring and setting sleeping.
+                std::unique_lock<std::mutex> lock(mutex);
+                if (stop)
+                    return;
+                sleeping.store(true, std::memory_order_release);
+                wake.wait_for(lock, std::chrono::milliseconds(1));
+                sleeping.store(false, std::memory_order_release);
+                idle = 0;
+                continue;
+            }
+            idle = 0;
+
+            busy.store(true, std::memory_order_release);
+            if (rec->inst.interrupt == Inst::IR_SQUASH)
+                simif.take_trap(true, rec->inst.interruptCause, rec->inst.pc, rec->inst.interruptDelegate);
+            else
+            {
+                uint32_t startPC = simif.get_pc();
+                if (int err = simif.cosim_instr(*rec))
+                {
+                    fail = Failure{err, *rec, startPC};
+                    hasFailure.store(true, std::memory_order_release);
+                }
+            }
+            ring.pop();
+            busy.store(false, std::memory_order_release);
+        }
+    }
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "BitView assumes little-endian model data");
+
+// Zero-copy view of a packed struct in raw Verilator model data. Fields are read straight
+// out of the signal's storage with compile-time shifts and masks, using the offsets
+// (<field>_s) and widths (<field>_w) that slang-reflect emits for every struct. Unlike
+// constructing the struct from an sc_bv, nothing is copied or unpacked that isn't used.
+//
+//   auto uop = VIEW(R_UOp, core->RN_uop[i].data());
+//   uint32_t sqn = FIELD(uop, sqN);
+template <typename T> class BitView
+{
+  public:
+    using Struct = T;
+
+    // Bytes Verilator stores a signal of this width in (CData, SData, IData, QData or VlWide)
+    static constexpr size_t STORAGE_BYTES = T::_size <= 8    ? 1
+                                            : T::_size <= 16 ? 2
+                                            : T::_size <= 32 ? 4
+                                            : T::_size <= 64 ? 8
+                                                             : (T::_size + 31) / 32 * 4;
+
+    explicit BitView(const void* raw) : raw((const uint8_t*)raw)
+    {
+    }
+
+    template <size_t S, size_t W> uint64_t get() const
+    {
+        static_assert(W >= 1 && W <= 64, "field must fit into 64 bits");
+        static_assert(S + W <= T::_size, "field out of range");
+
+        uint64_t v = 0;
+        if constexpr (STORAGE_BYTES < 8)
+        {
+            memcpy(&v, raw, STORAGE_BYTES);
+            v >>= S;
+        }
+        else
+        {
+            // Always load 8 bytes (a single unaligned load), but stay within the signal's storage
+            constexpr size_t first = S / 8 + 8 <= STORAGE_BYTES ? S / 8 : STORAGE_BYTES - 8;
+            constexpr size_t shift = S - first * 8;
+            memcpy(&v, raw + first, 8);
+            v >>= shift;
+            // Unaligned 64-bit field
+            if constexpr (shift + W > 64)
+                v |= (uint64_t)raw[first + 8] << (64 - shift);
+        }
+        if constexpr (W == 64)
+            return v;
+        else
+            return v & ((1ULL << W) - 1);
+    }
+
+  private:
+    const uint8_t* raw;
+};
+
+#define VIEW(type, raw) BitView<type>(raw)
+#define FIELD(view, field)                                                                                             \
+    (view).get<decltype(view)::Struct::field##_s, decltype(view)::Struct::field##_w>()
@@ -0,0 +1,386 @@
+#pragma once
+#include "SparseMemory.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Incremental checkpoints. A checkpoint file consists of tagged sections, either
+// opaque blobs (model state) or memory pages. Pages are only stored if they were
+// modified since the parent checkpoint, so restoring requires walking the chain
+// of parents up to the last full checkpoint. All data is compressed with a simple
+// PackBits-style RLE, which works well for the mostly zero-filled memory pages and
+// cache arrays.
+//
+// File layout:
+//   "SOOMCKPT" u32 version, u32 seq, u32 parentLen, char parent[parentLen]
+//   Sections: u32 tag, u32 kind
+//     CKPT_BLOB:  u64 rawLen, u64 compLen, u8 data[compLen]
+//     CKPT_PAGES: u64 n, n * { u32 pageIdx, u32 compLen, u8 data[compLen] }
+//                 compLen == 0 marks a page that was freed.
+//   u32 0 (end)
+
+enum CheckpointTag : uint32_t
+{
+    CKPT_END = 0,
+    CKPT_MODEL = 1,     // Verilator model state
+    CKPT_MEM = 2,       // RTL memory pages
+    CKPT_COSIM_MEM = 3, // Spike memory pages (if separate)
+    CKPT_COSIM = 4,     // Cosim state and models
+    CKPT_ARCH = 5,      // Architectural state only (functional checkpoint, memory in CKPT_MEM)
+    CKPT_INTERVAL = 6,  // Measurement interval of a ladder checkpoint
+};
+
+enum CheckpointKind : uint32_t
+{
+    CKPT_BLOB = 0,
+    CKPT_PAGES = 1,
+};
+
+static const char CKPT_MAGIC[8] = {'S', 'O', 'O', 'M', 'C', 'K', 'P', 'T'};
+static const uint32_t CKPT_VERSION = 2;
+
+// Header byte h < 128: h+1 literal bytes follow. h >= 128: the next byte is repeated h-125 times.
+static void RLECompress(const uint8_t* src, size_t len, std::vector<uint8_t>& dst)
+{
+    const size_t MIN_RUN = 3;
+    const size_t MAX_RUN = 130;
+    const size_t MAX_LIT = 128;
+
+    size_t i = 0;
+    size_t litStart = 0;
+    auto flushLiterals = [&](size_t end) {
+        while (litStart < end)
+        {
+            size_t n = std::min(end - litStart, MAX_LIT);
+            dst.push_back(n - 1);
+            dst.insert(dst.end(), src + litStart, src + litStart + n);
+            litStart += n;
+        }
+    };
+
+    while (i < len)
+    {
+        size_t run = 1;
+        while (i + run < len && run < MAX_RUN && src[i + run] == src[i])
+            run++;
+
+        if (run >= MIN_RUN)
+        {
+            flushLiterals(i);
+            dst.push_back(run + 125);
+            dst.push_back(src[i]);
+            i += run;
+            litStart = i;
+        }
+        else
+            i += run;
+    }
+    flushLiterals(len);
+}
+
+static bool RLEDecompress(const uint8_t* src, size_t len, uint8_t* dst, size_t dstLen)
+{
+    size_t i = 0;
+    size_t j = 0;
+    while (i < len)
+    {
+        uint8_t h = src[i++];
+        if (h < 128)
+        {
+            size_t n = h + 1;
+            if (i + n > len || j + n > dstLen)
+                return false;
+            memcpy(dst + j, src + i, n);
+            i += n;
+            j += n;
+        }
+        else
+        {
+            size_t n = h - 125;
+            if (i >= len || j + n > dstLen)
+                return false;
+            memset(dst + j, src[i++], n);
+            j += n;
+        }
+    }
+    return j == dstLen;
+}
+
+class CheckpointWriter
+{
+  public:
+    CheckpointWriter(std::string path, uint32_t seq, std::string parent)
+    {
+        f = fopen(path.c_str(), "wb");
+        if (!f)
+            abort();
+        uint32_t parentLen = parent.size();
+        write(CKPT_MAGIC, sizeof(CKPT_MAGIC));
+        write(&CKPT_VERSION, sizeof(CKPT_VERSION));
+        write(&seq, sizeof(seq));
+        write(&parentLen, sizeof(parentLen));
+        write(parent.data(), parentLen);
+    }
+
+    ~CheckpointWriter()
+    {
+        close();
+    }
+
+    void add_blob(uint32_t tag, const uint8_t* data, size_t len)
+    {
+        comp.clear();
+        RLECompress(data, len, comp);
+
+        uint32_t kind = CKPT_BLOB;
+        uint64_t rawLen = len;
+        uint64_t compLen = comp.size();
+        write(&tag, sizeof(tag));
+        write(&kind, sizeof(kind));
+        write(&rawLen, sizeof(rawLen));
+        write(&compLen, sizeof(compLen));
+        write(comp.data(), comp.size());
+    }
+
+    void add_blob(uint32_t tag, const std::vector<uint8_t>& data)
+    {
+        add_blob(tag, data.data(), data.size());
+    }
+
+    // Store all dirty pages (or all allocated pages if full), then reset the dirty bits.
+    void add_pages(uint32_t tag, SparseMemory& mem, bool full)
+    {
+        uint64_t n = 0;
+        for (size_t i = 0; i < mem.page_slots(); i++)
+            n += full ? (mem.page_at(i) != nullptr) : mem.is_dirty(i);
+
+        begin_pages(tag, n);
+        for (uint32_t i = 0; i < mem.page_slots(); i++)
+        {
+            const uint8_t* page = mem.page_at(i);
+            if (full ? (page != nullptr) : mem.is_dirty(i))
+                add_page(i, page);
+        }
+        mem.clear_dirty();
+    }
+
+    // Low-level interface, begin_pages must be followed by exactly n add_page calls.
+    void begin_pages(uint32_t tag, uint64_t n)
+    {
+        uint32_t kind = CKPT_PAGES;
+        write(&tag, sizeof(tag));
+        write(&kind, sizeof(kind));
+        write(&n, sizeof(n));
+    }
+
+    // page is nullptr for freed pages
+    void add_page(uint32_t idx, const uint8_t* page)
+    {
+        comp.clear();
+        if (page)
+            RLECompress(page, SparseMemory::PAGE_SIZE, comp);
+        uint32_t compLen = comp.size();
+        write(&idx, sizeof(idx));
+        write(&compLen, sizeof(compLen));
+        write(comp.data(), comp.size());
+    }
+
+    void close()
+    {
+        if (!f)
+            return;
+        uint32_t end = CKPT_END;
+        write(&end, sizeof(end));
+        if (fclose(f) != 0)
+            abort();
+        f = nullptr;
+    }
+
+  private:
+    FILE* f;
+    std::vector<uint8_t> comp;
+
+    void write(const void* data, size_t len)
+    {
+        if (len != 0 && fwrite(data, len, 1, f) != 1)
+            abort();
+    }
+};
+
+// Decompressed contents of a checkpoint, or of a whole chain merged together.
+struct Checkpoint
+{
+    using PageMap = std::map<uint32_t, std::vector<uint8_t>>;
+
+    uint32_t seq = 0;
+    std::string parent;
+    std::map<uint32_t, std::vector<uint8_t>> blobs;
+    // Empty vector for freed pages
+    std::map<uint32_t, PageMap> pages;
+
+    // Load a single checkpoint file, without resolving its parents.
+    static Checkpoint load(std::string path)
+    {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f)
+        {
+            fprintf(stderr, "could not open checkpoint %s\n", path.c_str());
+            abort();
+        }
+
+        Checkpoint ckpt;
+        char magic[sizeof(CKPT_MAGIC)];
+        uint32_t version;
+        uint32_t parentLen;
+        read(f, magic, sizeof(magic));
+        read(f, &version, sizeof(version));
+        if (memcmp(magic, CKPT_MAGIC, sizeof(magic)) != 0 || version != CKPT_VERSION)
+        {
+            fprintf(stderr, "%s is not a compatible checkpoint\n", path.c_str());
+            abort();
+        }
+        read(f, &ckpt.seq, sizeof(ckpt.seq));
+        read(f, &parentLen, sizeof(parentLen));
+        ckpt.parent.resize(parentLen);
+        read(f, ckpt.parent.data(), parentLen);
+
+        std::vector<uint8_t> comp;
+        while (true)
+        {
+            uint32_t tag;
+            uint32_t kind;
+            read(f, &tag, sizeof(tag));
+            if (tag == CKPT_END)
+                break;
+            read(f, &kind, sizeof(kind));
+
+            if (kind == CKPT_BLOB)
+            {
+                uint64_t rawLen;
+                uint64_t compLen;
+                read(f, &rawLen, sizeof(rawLen));
+                read(f, &compLen, sizeof(compLen));
+                comp.resize(compLen);
+                read(f, comp.data(), compLen);
+                auto& blob = ckpt.blobs[tag];
+                blob.resize(rawLen);
+                if (!RLEDecompress(comp.data(), compLen, blob.data(), rawLen))
+                    abort();
+            }
+            else if (kind == CKPT_PAGES)
+            {
+                uint64_t n;
+                read(f, &n, sizeof(n));
+                auto& pageMap = ckpt.pages[tag];
+                for (uint64_t j = 0; j < n; j++)
+                {
+                    uint32_t idx;
+                    uint32_t compLen;
+                    read(f, &idx, sizeof(idx));
+                    read(f, &compLen, sizeof(compLen));
+                    auto& page = pageMap[idx];
+                    page.clear();
+                    if (compLen == 0)
+                        continue;
+                    comp.resize(compLen);
+                    read(f, comp.data(), compLen);
+                    page.resize(SparseMemory::PAGE_SIZE);
+                    if (!RLEDecompress(comp.data(), compLen, page.data(), page.size()))
+                        abort();
+                }
+            }
+            else
+                abort();
+        }
+        fclose(f);
+        return ckpt;
+    }
+
+    // Load a checkpoint and all its parents, merged into a single full checkpoint.
+    // Parents are referenced relative to the directory of the child.
+    static Checkpoint load_chain(std::string path)
+    {
+        Checkpoint ckpt = load(path);
+        if (ckpt.parent.empty())
+            return ckpt;
+
+        std::string dir;
+        size_t slash = path.rfind('/');
+        if (slash != std::string::npos)
+            dir = path.substr(0, slash + 1);
+
+        Checkpoint merged = load_chain(dir + ckpt.parent);
+        merged.apply(ckpt);
+        return merged;
+    }
+
+    // Overlay a newer checkpoint onto this one.
+    void apply(const Checkpoint& newer)
+    {
+        seq = newer.seq;
+        for (auto& [tag, blob] : newer.blobs)
+            blobs[tag] = blob;
+        for (auto& [tag, pageMap] : newer.pages)
+            for (auto& [idx, page] : pageMap)
+            {
+                if (page.empty())
+                    pages[tag].erase(idx);
+                else
+                    pages[tag][idx] = page;
+            }
+        parent.clear();
+    }
+
+    void write(std::string path) const
+    {
+        CheckpointWriter writer(path, seq, parent);
+        for (auto& [tag, blob] : blobs)
+            writer.add_blob(tag, blob);
+        for (auto& [tag, pageMap] : pages)
+        {
+            writer.begin_pages(tag, pageMap.size());
+            for (auto& [idx, page] : pageMap)
+                writer.add_page(idx, page.empty() ? nullptr : page.data());
+        }
+        writer.close();
+    }
+
+    const std::vector<uint8_t>& blob(uint32_t tag) const
+    {
+        auto it = blobs.find(tag);
+        if (it == blobs.end())
+        {
+            fprintf(stderr, "checkpoint is missing section %u\n", tag);
+            abort();
+        }
+        return it->second;
+    }
+
+    // Replace mem's contents with the pages stored under tag. Dirty bits are reset,
+    // so the next checkpoint only stores changes relative to this one.
+    void restore_pages(uint32_t tag, SparseMemory& mem) const
+    {
+        mem.clear();
+        auto it = pages.find(tag);
+        if (it != pages.end())
+            for (auto& [idx, page] : it->second)
+                if (!page.empty())
+                    mem.write(mem.base + idx * SparseMemory::PAGE_SIZE, page.data(), page.size());
+        mem.clear_dirty();
+    }
+
+  private:
+    static void read(FILE* f, void* data, size_t len)
+    {
+        if (len != 0 && fread(data, len, 1, f) != 1)
+        {
+            fprintf(stderr, "truncated checkpoint\n");
+            abort();
+        }
+    }
+};
@@ -0,0 +1,79 @@
+// Inspect and flatten incremental checkpoint chains written by --backup-file.
+// Build with `make checkpoint-tool`.
+#include "Checkpoint.hpp"
+#include <cstdio>
+#include <string>
+
+static const char* TagName(uint32_t tag)
+{
+    switch (tag)
+    {
+        case CKPT_MODEL: return "model";
+        case CKPT_MEM: return "mem";
+        case CKPT_COSIM_MEM: return "cosim_mem";
+        case CKPT_COSIM: return "cosim";
+        case CKPT_ARCH: return "arch";
+        case CKPT_INTERVAL: return "interval";
+        default: return "unknown";
+    }
+}
+
+static void PrintCheckpoint(const Checkpoint& ckpt, std::string path)
+{
+    printf("%s: seq=%u parent=%s\n", path.c_str(), ckpt.seq, ckpt.parent.empty() ? "(none)" : ckpt.parent.c_str());
+    for (auto& [tag, blob] : ckpt.blobs)
+        printf("\t%-10s %zu bytes\n", TagName(tag), blob.size());
+    for (auto& [tag, pageMap] : ckpt.pages)
+    {
+        size_t freed = 0;
+        for (auto& [idx, page] : pageMap)
+            freed += page.empty();
+        printf("\t%-10s %zu pages (%zu freed)\n", TagName(tag), pageMap.size() - freed, freed);
+    }
+}
+
+// Print the checkpoint and all its parents, newest first.
+static void Info(std::string path)
+{
+    std::string dir;
+    size_t slash = path.rfind('/');
+    if (slash != std::string::npos)
+        dir = path.substr(0, slash + 1);
+
+    while (true)
+    {
+        Checkpoint ckpt = Checkpoint::load(path);
+        PrintCheckpoint(ckpt, path);
+        if (ckpt.parent.empty())
+            break;
+        path = dir + ckpt.parent;
+    }
+}
+
+// Merge a checkpoint with all its parents into a single full checkpoint.
+static void Merge(std::string path, std::string outPath)
+{
+    Checkpoint ckpt = Checkpoint::load_chain(path);
+    ckpt.write(outPath);
+    PrintCheckpoint(ckpt, outPath);
+}
+
+int main(int argc, char** argv)
+{
+    std::string cmd = (argc > 1) ? argv[1] : "";
+    if (cmd == "info" && argc == 3)
+        Info(argv[2]);
+    else if (cmd == "merge" && argc == 4)
+        Merge(argv[2], argv[3]);
+    else
+    {
+        fprintf(stderr,
+                "usage: %s info <CHECKPOINT>.backup\n"
+                "       %s merge <CHECKPOINT>.backup <OUTPUT>.backup\n"
+                "info:  List a checkpoint and its chain of parents.\n"
+                "merge: Flatten a checkpoint and its parents into a standalone checkpoint.\n",
+                argv[0], argv[0]);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,351 @@
+#pragma once
+#include "ElfLoader.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Per-PC cycle accounting on the commit path (--profile, --profile-folded). Every cycle is
+// charged to one instruction: cycles that commit to the first instruction committed, all
+// others (stall cycles) to the instruction at the ROB head. While the ROB is empty, cycles
+// are held back until the next instruction reaches the head. Stall cycles with a load at
+// the head that the LSU nacked (cache miss or conflict) also count as D-cache stalls.
+// Mispredicts are charged to the branch, memory ordering flushes to the conflicting store.
+//
+// Call stacks for the folded output are tracked from committed calls and returns (by the
+// RISC-V link register conventions), so traps and longjmp can leave them off.
+class CommitProfile
+{
+  public:
+    struct PCStats
+    {
+        uint64_t cycles = 0;
+        uint64_t stall = 0;
+        uint64_t dcache = 0;
+        uint64_t commits = 0;
+        uint64_t mispredicts = 0;
+        uint64_t memOrder = 0;
+
+        void add(const PCStats& o)
+        {
+            cycles += o.cycles;
+            stall += o.stall;
+            dcache += o.dcache;
+            commits += o.commits;
+            mispredicts += o.mispredicts;
+            memOrder += o.memOrder;
+        }
+    };
+
+    // numSqN is the number of ROB (and load) sequence numbers
+    void open(const std::string& reportPath, const std::string& foldedPath, size_t numSqN)
+    {
+        this->reportPath = reportPath;
+        this->foldedPath = foldedPath;
+        enabled = true;
+        pcs.clear();
+        stacks.clear();
+        nodes.assign(1, Node{});
+        stack.clear();
+        node = 0;
+        pendingCall = false;
+        pendingCycles = 0;
+        loads.assign(numSqN, -1);
+        nacked.assign(numSqN, false);
+    }
+
+    bool is_open() const
+    {
+        return enabled;
+    }
+
+    // loadSqN is -1 for anything but loads
+    void rename(uint32_t sqn, int loadSqN)
+    {
+        nacked[sqn] = false;
+        if (loadSqN >= 0)
+            loads[loadSqN] = sqn;
+    }
+
+    void nack(uint32_t loadSqN)
+    {
+        if (loads[loadSqN] >= 0)
+            nacked[loads[loadSqN]] = true;
+    }
+
+    void cycle()
+    {
+        committed = false;
+    }
+
+    void commit(uint32_t pc, uint32_t inst)
+    {
+        if (nodes[0].addr == 0)
+            nodes[0].addr = pc;
+        if (pendingCall)
+            call(pc);
+        pendingCall = false;
+
+        PCStats& s = pcs[pc];
+        s.commits++;
+        if (!committed)
+        {
+            charge(pc, s, 1 + pendingCycles, pendingCycles, 0);
+            pendingCycles = 0;
+            committed = true;
+        }
+
+        switch (ClassifyJump(inst))
+        {
+            case JUMP_CALL: pendingCall = true; break;
+            case JUMP_RETURN: ret(); break;
+            default: break;
+        }
+    }
+
+    // After all commits of the cycle, with the instruction at the ROB head (if there is one)
+    void stall(bool headValid, uint32_t headPC, uint32_t headSqN)
+    {
+        if (committed)
+            return;
+        if (!headValid)
+        {
+            pendingCycles++;
+            return;
+        }
+        charge(headPC, pcs[headPC], 1 + pendingCycles, 1 + pendingCycles, nacked[headSqN] ? 1 : 0);
+        pendingCycles = 0;
+    }
+
+    void mispredict(uint32_t pc)
+    {
+        pcs[pc].mispredicts++;
+    }
+
+    void mem_order(uint32_t pc)
+    {
+        pcs[pc].memOrder++;
+    }
+
+    // Write the outputs and stop profiling
+    void close(SymbolTable& symbols)
+    {
+        if (!enabled)
+            return;
+        enabled = false;
+        if (!reportPath.empty())
+            write_report(symbols);
+        if (!foldedPath.empty())
+            write_folded(symbols);
+    }
+
+  private:
+    enum Jump
+    {
+        JUMP_NONE,
+        JUMP_CALL,
+        JUMP_RETURN,
+    };
+
+    // Calls push the target, returns pop. Deeper stacks (runaway recursion, unmatched
+    // calls) stop growing.
+    static constexpr size_t MAX_DEPTH = 256;
+
+    struct Node
+    {
+        uint32_t addr = 0;
+        uint32_t parent = 0;
+        std::unordered_map<uint32_t, uint32_t> children;
+    };
+
+    std::string reportPath;
+    std::string foldedPath;
+    bool enabled = false;
+
+    std::unordered_map<uint32_t, PCStats> pcs;
+    // Cycles by call stack node and PC
+    std::unordered_map<uint64_t, uint64_t> stacks;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> stack;
+    uint32_t node = 0;
+    bool pendingCall = false;
+    bool committed = false;
+    uint64_t pendingCycles = 0;
+
+    std::vector<int> loads;
+    std::vector<bool> nacked;
+
+    static bool IsLink(uint32_t reg)
+    {
+        return reg == 1 || reg == 5;
+    }
+
+    static Jump ClassifyJump(uint32_t inst)
+    {
+        if ((inst & 3) != 3)
+        {
+            uint32_t rs1 = (inst >> 7) & 31;
+            uint32_t rs2 = (inst >> 2) & 31;
+            // c.jal (RV32 only)
+            if ((inst & 0xe003) == 0x2001)
+                return JUMP_CALL;
+            // c.jr
+            if ((inst & 0xf003) == 0x8002 && rs2 == 0 && rs1 != 0)
+                return IsLink(rs1) ? JUMP_RETURN : JUMP_NONE;
+            // c.jalr
+            if ((inst & 0xf003) == 0x9002 && rs2 == 0 && rs1 != 0)
+                return JUMP_CALL;
+            return JUMP_NONE;
+        }
+
+        uint32_t rd = (inst >> 7) & 31;
+        uint32_t rs1 = (inst >> 15) & 31;
+        // jal
+        if ((inst & 0x7f) == 0x6f)
+            return IsLink(rd) ? JUMP_CALL : JUMP_NONE;
+        // jalr
+        if ((inst & 0x707f) == 0x67)
+        {
+            if (IsLink(rd))
+                return JUMP_CALL;
+            if (rd == 0 && IsLink(rs1))
+                return JUMP_RETURN;
+        }
+        return JUMP_NONE;
+    }
+
+    void call(uint32_t target)
+    {
+        if (stack.size() >= MAX_DEPTH)
+            return;
+        stack.push_back(node);
+        auto it = nodes[node].children.find(target);
+        if (it != nodes[node].children.end())
+        {
+            node = it->second;
+            return;
+        }
+        uint32_t child = nodes.size();
+        nodes[node].children.emplace(target, child);
+        nodes.push_back(Node{target, node, {}});
+        node = child;
+    }
+
+    void ret()
+    {
+        if (stack.empty())
+            return;
+        node = stack.back();
+        stack.pop_back();
+    }
+
+    void charge(uint32_t pc, PCStats& s, uint64_t cycles, uint64_t stall, uint64_t dcache)
+    {
+        s.cycles += cycles;
+        s.stall += stall;
+        s.dcache += dcache;
+        stacks[(uint64_t)node << 32 | pc] += cycles;
+    }
+
+    static std::string Name(SymbolTable& symbols, uint32_t addr)
+    {
+        const ElfSymbol* sym = symbols.find(addr);
+        if (sym)
+            return sym->name;
+        char buf[16];
+        snprintf(buf, sizeof(buf), "0x%08x", addr);
+        return buf;
+    }
+
+    static void PrintStats(FILE* f, const PCStats& s, uint64_t total)
+    {
+        fprintf(f, "%7.2f%% %12lu %12lu %12lu %12lu %9lu %9lu  ", 100.0 * s.cycles / total, s.cycles, s.stall, s.dcache,
+                s.commits, s.mispredicts, s.memOrder);
+    }
+
+    void write_report(SymbolTable& symbols)
+    {
+        FILE* f = fopen(reportPath.c_str(), "w");
+        if (!f)
+            abort();
+
+        PCStats total;
+        std::unordered_map<std::string, PCStats> byFunc;
+        for (auto& [pc, s] : pcs)
+        {
+            total.add(s);
+            const ElfSymbol* sym = symbols.find(pc);
+            byFunc[sym ? sym->name : "[unknown]"].add(s);
+        }
+        uint64_t cycles = std::max<uint64_t>(total.cycles, 1);
+
+        fprintf(f, "# %lu cycles, %lu commits, %lu mispredicts, %lu memory ordering flushes\n", total.cycles,
+                total.commits, total.mispredicts, total.memOrder);
+        fprintf(f, "# stall: cycles without commit at the ROB head, dcache: of which waiting for a nacked load\n");
+        fprintf(f, "#\n# %6s %12s %12s %12s %12s %9s %9s  %s\n", "share", "cycles", "stall", "dcache", "commits",
+                "mispred", "memorder", "function");
+
+        std::vector<std::pair<std::string, PCStats>> funcs(byFunc.begin(), byFunc.end());
+        std::sort(funcs.begin(), funcs.end(), [](auto& a, auto& b) { return a.second.cycles > b.second.cycles; });
+        for (auto& [name, s] : funcs)
+        {
+            PrintStats(f, s, cycles);
+            fprintf(f, "%s\n", name.c_str());
+        }
+
+        // Hottest instructions, with the symbol offset for finding them in the disassembly
+        static constexpr size_t NUM_HOT_PCS = 64;
+        std::vector<std::pair<uint32_t, PCStats>> hot(pcs.begin(), pcs.end());
+        size_t n = std::min(hot.size(), NUM_HOT_PCS);
+        std::partial_sort(hot.begin(), hot.begin() + n, hot.end(),
+                          [](auto& a, auto& b) { return a.second.cycles > b.second.cycles; });
+        fprintf(f, "\n# %6s %12s %12s %12s %12s %9s %9s  %s\n", "share", "cycles", "stall", "dcache", "commits",
+                "mispred", "memorder", "pc");
+        for (size_t i = 0; i < n; i++)
+        {
+            auto& [pc, s] = hot[i];
+            PrintStats(f, s, cycles);
+            const ElfSymbol* sym = symbols.find(pc);
+            if (sym)
+                fprintf(f, "%08x %s+0x%x\n", pc, sym->name.c_str(), pc - sym->addr);
+            else
+                fprintf(f, "%08x\n", pc);
+        }
+        fclose(f);
+    }
+
+    // One line per call stack, "outer;...;inner cycles", as read by flamegraph.pl
+    void write_folded(SymbolTable& symbols)
+    {
+        std::map<std::string, uint64_t> folded;
+        std::vector<std::string> names(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+            names[i] = Name(symbols, nodes[i].addr);
+
+        for (auto& [key, cycles] : stacks)
+        {
+            uint32_t n = key >> 32;
+            std::string leaf = Name(symbols, (uint32_t)key);
+            std::string line = (leaf == names[n]) ? "" : ";" + leaf;
+            for (;; n = nodes[n].parent)
+            {
+                line = names[n] + line;
+                if (n == 0)
+                    break;
+                line = ";" + line;
+            }
+            folded[line] += cycles;
+        }
+
+        FILE* f = fopen(foldedPath.c_str(), "w");
+        if (!f)
+            abort();
+        for (auto& [line, cycles] : folded)
+            fprintf(f, "%s %lu\n", line.c_str(), cycles);
+        fclose(f);
+    }
+};
@@ -2,3 +2,5 @@
 #include <cstdint>
 
 extern uint64_t DEBUG_TIME;
+// Inside a trace window, see TraceWindows.hpp
+extern bool TRACING;
@@ -0,0 +1,213 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+struct ElfSymbol
+{
+    std::string name;
+    uint32_t addr;
+    uint32_t size;
+};
+
+// Symbols of the simulated program, by name and by address.
+class SymbolTable
+{
+  public:
+    void add(ElfSymbol sym)
+    {
+        byName.emplace(sym.name, byAddr.size());
+        byAddr.push_back(std::move(sym));
+        sorted = false;
+    }
+
+    // Returns 0 if the symbol does not exist.
+    uint32_t lookup(const std::string& name) const
+    {
+        auto it = byName.find(name);
+        return (it == byName.end()) ? 0 : byAddr[it->second].addr;
+    }
+
+    // Find the symbol containing addr (or the closest one before it, for symbols without size).
+    const ElfSymbol* find(uint32_t addr)
+    {
+        sort();
+        auto it = std::upper_bound(byAddr.begin(), byAddr.end(), addr,
+                                   [](uint32_t addr, const ElfSymbol& sym) { return addr < sym.addr; });
+        if (it == byAddr.begin())
+            return nullptr;
+        --it;
+        if (it->size != 0 && addr >= it->addr + it->size)
+            return nullptr;
+        return &*it;
+    }
+
+    bool empty() const
+    {
+        return byAddr.empty();
+    }
+
+  private:
+    std::vector<ElfSymbol> byAddr;
+    std::unordered_map<std::string, size_t> byName;
+    bool sorted = true;
+
+    void sort()
+    {
+        if (sorted)
+            return;
+        std::stable_sort(byAddr.begin(), byAddr.end(), [](auto& a, auto& b) { return a.addr < b.addr; });
+        byName.clear();
+        for (size_t i = 0; i < byAddr.size(); i++)
+            byName.emplace(byAddr[i].name, i);
+        sorted = true;
+    }
+};
+
+// Thrown for files that cannot be read, with "<path>: <reason>" as message
+struct ElfError : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+// Minimal ELF32 (RISC-V) reader. The file is mmapped, segments are handed out as
+// pointers into the mapping, so an ElfFile must outlive the use of its segments.
+class ElfFile
+{
+  public:
+    struct Segment
+    {
+        uint32_t addr;
+        const uint8_t* data;
+        uint32_t fileSize;
+        uint32_t memSize;
+    };
+
+    ElfFile(std::string path) : path(path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            error("could not open file");
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            close(fd);
+            error("could not stat file");
+        }
+        size = st.st_size;
+        data = (const uint8_t*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            error("could not map file");
+
+        // The destructor does not run if the constructor throws
+        const char* err = check_headers();
+        if (err)
+        {
+            munmap((void*)data, size);
+            error(err);
+        }
+    }
+
+    ~ElfFile()
+    {
+        munmap((void*)data, size);
+    }
+
+    ElfFile(const ElfFile&) = delete;
+    ElfFile& operator=(const ElfFile&) = delete;
+
+    uint32_t entry() const
+    {
+        return ehdr->e_entry;
+    }
+
+    // PT_LOAD segments at their physical (load) address
+    std::vector<Segment> segments() const
+    {
+        std::vector<Segment> segs;
+        auto phdrs = (const Elf32_Phdr*)(data + ehdr->e_phoff);
+        for (size_t i = 0; i < ehdr->e_phnum; i++)
+        {
+            auto& ph = phdrs[i];
+            if (ph.p_type != PT_LOAD || ph.p_memsz == 0)
+                continue;
+            if (!in_bounds(ph.p_offset, ph.p_filesz))
+                error("segment out of bounds");
+            segs.push_back(Segment{ph.p_paddr, data + ph.p_offset, ph.p_filesz, ph.p_memsz});
+        }
+        return segs;
+    }
+
+    // Read all named function, object and untyped symbols from .symtab
+    SymbolTable symbols() const
+    {
+        SymbolTable table;
+        auto shdrs = (const Elf32_Shdr*)(data + ehdr->e_shoff);
+        for (size_t i = 0; i < ehdr->e_shnum; i++)
+        {
+            auto& sh = shdrs[i];
+            if (sh.sh_type != SHT_SYMTAB || sh.sh_link >= ehdr->e_shnum)
+                continue;
+            auto& strtab = shdrs[sh.sh_link];
+            if (!in_bounds(sh.sh_offset, sh.sh_size) || !in_bounds(strtab.sh_offset, strtab.sh_size))
+                error("symbol table out of bounds");
+
+            auto syms = (const Elf32_Sym*)(data + sh.sh_offset);
+            auto strs = (const char*)(data + strtab.sh_offset);
+            for (size_t j = 0; j < sh.sh_size / sizeof(Elf32_Sym); j++)
+            {
+                auto& sym = syms[j];
+                int type = ELF32_ST_TYPE(sym.st_info);
+                if (sym.st_name == 0 || sym.st_name >= strtab.sh_size || sym.st_shndx == SHN_UNDEF ||
+                    (type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE))
+                    continue;
+                const char* name = strs + sym.st_name;
+                table.add(ElfSymbol{std::string(name, strnlen(name, strtab.sh_size - sym.st_name)), sym.st_value,
+                                    sym.st_size});
+            }
+        }
+        return table;
+    }
+
+  private:
+    std::string path;
+    const uint8_t* data;
+    size_t size;
+    const Elf32_Ehdr* ehdr;
+
+    bool in_bounds(size_t offset, size_t len) const
+    {
+        return offset <= size && len <= size - offset;
+    }
+
+    const char* check_headers()
+    {
+        if (size < sizeof(Elf32_Ehdr) || memcmp(data, ELFMAG, SELFMAG) != 0)
+            return "not an ELF file";
+        ehdr = (const Elf32_Ehdr*)data;
+        if (ehdr->e_ident[EI_CLASS] != ELFCLASS32 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB ||
+            ehdr->e_machine != EM_RISCV)
+            return "not a 32-bit little-endian RISC-V ELF";
+        if (!in_bounds(ehdr->e_phoff, (size_t)ehdr->e_phnum * sizeof(Elf32_Phdr)) ||
+            !in_bounds(ehdr->e_shoff, (size_t)ehdr->e_shnum * sizeof(Elf32_Shdr)))
+            return "truncated headers";
+        return nullptr;
+    }
+
+    [[noreturn]] void error(const char* msg) const
+    {
+        throw ElfError(path + ": " + msg);
+    }
+};
@@ -0,0 +1,151 @@
+#pragma once
+#include "KonataTrace.hpp"
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+// Keeps the pipeline events of the last cycles in memory, so that a failing run can be
+// looked at without re-running it with tracing. Events are the same as for Konata traces
+// (minus operands), recording one is a store into a ring. dump() writes the last cycles
+// as a binary Konata trace, see KonataTool.
+class FlightRecorder
+{
+  public:
+    // Record (at least) the given number of cycles, 0 disables
+    void enable(uint64_t numCycles)
+    {
+        cycles = numCycles;
+        size_t size = 1;
+        while (size < numCycles * EVENTS_PER_CYCLE)
+            size *= 2;
+        ring.reset(numCycles ? new Event[size] : nullptr);
+        mask = numCycles ? size - 1 : 0;
+        clear();
+    }
+
+    bool enabled() const
+    {
+        return cycles != 0;
+    }
+
+    // Forget everything, e.g. after time jumped back
+    void clear()
+    {
+        head = 0;
+        errorID = -1;
+    }
+
+    void cycle(uint64_t time)
+    {
+        now = time;
+    }
+
+    void insert(uint32_t id, uint32_t fetchID)
+    {
+        record(KEV_INSERT, id, fetchID);
+    }
+
+    void inst(uint32_t id, uint32_t pc, uint32_t instr)
+    {
+        record(KEV_INST, id, pc, instr);
+    }
+
+    void stage(uint32_t id, KonataStage s)
+    {
+        record(KEV_STAGE, id, s);
+    }
+
+    void retire(uint32_t id, uint32_t sqn)
+    {
+        record(KEV_RETIRE, id, sqn);
+    }
+
+    void flush_inst(uint32_t id)
+    {
+        record(KEV_FLUSH, id);
+    }
+
+    void result(uint32_t id, uint32_t value)
+    {
+        record(KEV_RESULT, id, value);
+    }
+
+    // Labelled in the dump
+    void mark_error(uint32_t id)
+    {
+        errorID = id;
+    }
+
+    // Write the recorded cycles as a binary Konata trace. Returns false if nothing was recorded.
+    bool dump(const std::string& path)
+    {
+        if (!enabled() || head == 0)
+            return false;
+
+        // Oldest event still in the ring, and not older than the requested number of cycles
+        uint64_t i = head > mask + 1 ? head - (mask + 1) : 0;
+        uint64_t first = now > 2 * cycles ? now - 2 * cycles : 0;
+        while (i < head && ring[i & mask].time < first)
+            i++;
+
+        KonataWriter writer;
+        writer.open(path, false);
+        uint64_t time = ring[i & mask].time;
+        bool labelled = false;
+        for (; i < head; i++)
+        {
+            const Event& e = ring[i & mask];
+            if (e.time > time)
+            {
+                writer.cycle((e.time - time) / 2);
+                time = e.time;
+            }
+            if (e.type == KEV_RETIRE && e.id == errorID)
+            {
+                writer.label(e.id, 0, " COSIM ERROR ");
+                labelled = true;
+            }
+            switch (e.type)
+            {
+                case KEV_INSERT: writer.insert(e.id, e.a); break;
+                case KEV_INST: writer.inst(e.id, e.time, e.a, e.b); break;
+                case KEV_STAGE: writer.stage(e.id, (KonataStage)e.a); break;
+                case KEV_RETIRE: writer.retire(e.id, e.a); break;
+                case KEV_FLUSH: writer.flush_inst(e.id); break;
+                case KEV_RESULT: writer.result(e.id, e.a); break;
+                default: break;
+            }
+        }
+        if (errorID != -1 && !labelled)
+            writer.label(errorID, 0, " COSIM ERROR ");
+        writer.close();
+        return true;
+    }
+
+  private:
+    // Ring size per recorded cycle. Busy cycles have more events, idle ones fewer.
+    static constexpr uint64_t EVENTS_PER_CYCLE = 16;
+
+    struct Event
+    {
+        uint64_t time;
+        uint32_t id;
+        uint32_t a;
+        uint32_t b;
+        KonataEvent type;
+    };
+
+    std::unique_ptr<Event[]> ring;
+    uint64_t mask = 0;
+    uint64_t head = 0;
+    uint64_t cycles = 0;
+    uint64_t now = 0;
+    int64_t errorID = -1;
+
+    void record(KonataEvent type, uint32_t id, uint32_t a = 0, uint32_t b = 0)
+    {
+        if (!enabled())
+            return;
+        ring[head++ & mask] = Event{now, id, a, b, type};
+    }
+};
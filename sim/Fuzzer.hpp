@@ -1,4 +1,6 @@
 #pragma once
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <memory>
 #include <stddef.h>
@@ -59,11 +61,160 @@ struct TestCase
         }
         return true;
     }
+
+    size_t byte_size() const
+    {
+        size_t size = 0;
+        for (auto& instr : prog)
+            size += instr.get_size() / 8;
+        return size;
+    }
+
+    // Test cases are stored as raw program images (inspect with objdump -b binary -m riscv).
+    bool load_file(const char* path)
+    {
+        FILE* f = fopen(path, "rb");
+        if (!f)
+            return false;
+        std::vector<uint8_t> buf;
+        uint8_t chunk[4096];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) != 0)
+            buf.insert(buf.end(), chunk, chunk + n);
+        fclose(f);
+        return buf.size() >= 2 && load(buf.data(), buf.size());
+    }
+
+    void save_file(const char* path) const
+    {
+        std::vector<uint8_t> buf(byte_size());
+        unpack(buf.data(), buf.size());
+        FILE* f = fopen(path, "wb");
+        if (!f)
+            abort();
+        if (!buf.empty() && fwrite(buf.data(), buf.size(), 1, f) != 1)
+            abort();
+        fclose(f);
+    }
 };
 
+// Generator for random but mostly valid RV32IMA instructions. Registers are drawn from
+// a small pool so that generated instructions depend on each other (and on the base
+// program), and memory offsets are small so that accesses alias within a few cache lines.
+namespace InstrGen
+{
+static const uint32_t REGS[] = {1, 2, 5, 6, 7, 8, 9, 10, 11, 12};
+
+static uint32_t reg()
+{
+    return REGS[rand() % (sizeof(REGS) / sizeof(REGS[0]))];
+}
+
+static uint32_t R(uint32_t f7, uint32_t rs2, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t opc)
+{
+    return (f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | opc;
+}
+
+static uint32_t I(int32_t imm, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t opc)
+{
+    return (((uint32_t)imm & 0xfff) << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | opc;
+}
+
+static uint32_t S(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t f3, uint32_t opc)
+{
+    uint32_t u = imm;
+    return (((u >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | ((u & 0x1f) << 7) | opc;
+}
+
+static uint32_t B(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t f3)
+{
+    uint32_t u = imm;
+    return (((u >> 12) & 1) << 31) | (((u >> 5) & 0x3f) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) |
+           (((u >> 1) & 0xf) << 8) | (((u >> 11) & 1) << 7) | 0x63;
+}
+
+static uint32_t J(int32_t imm, uint32_t rd)
+{
+    uint32_t u = imm;
+    return (((u >> 20) & 1) << 31) | (((u >> 1) & 0x3ff) << 21) | (((u >> 11) & 1) << 20) |
+           (((u >> 12) & 0xff) << 12) | (rd << 7) | 0x6f;
+}
+
+// Small offsets around zero, mostly aligned to the access size
+static int32_t mem_offset(uint32_t size)
+{
+    return ((rand() % 33) - 16) * (rand() % 4 ? size : 1);
+}
+
+static uint32_t random_instr()
+{
+    switch (rand() % 10)
+    {
+        case 0:
+        {
+            // OP-IMM; shifts need a valid funct7
+            uint32_t f3 = rand() % 8;
+            int32_t imm = (f3 == 1 || f3 == 5) ? ((rand() % 32) | (f3 == 5 && rand() % 2 ? 0x400 : 0))
+                                               : (rand() % 64) - 32;
+            return I(imm, reg(), f3, reg(), 0x13);
+        }
+        case 1:
+        {
+            // OP and M extension
+            uint32_t f3 = rand() % 8;
+            uint32_t f7 = (rand() % 2) ? 1 : ((f3 == 0 || f3 == 5) && rand() % 2 ? 0x20 : 0);
+            return R(f7, reg(), reg(), f3, reg(), 0x33);
+        }
+        case 2:
+        case 3:
+        {
+            static const uint32_t f3s[] = {0, 1, 2, 4, 5};
+            uint32_t f3 = f3s[rand() % 5];
+            return I(mem_offset(1 << (f3 & 3)), reg(), f3, reg(), 0x03);
+        }
+        case 4:
+        case 5:
+        {
+            uint32_t f3 = rand() % 3;
+            return S(mem_offset(1 << f3), reg(), reg(), f3, 0x23);
+        }
+        case 6:
+        {
+            static const uint32_t f3s[] = {0, 1, 4, 5, 6, 7};
+            return B(((rand() % 17) - 8) * 4, reg(), reg(), f3s[rand() % 6]);
+        }
+        case 7:
+        {
+            // lr/sc and AMOs
+            static const uint32_t f5s[] = {0x02, 0x03, 0x01, 0x00, 0x04, 0x0c, 0x08, 0x10, 0x14, 0x18, 0x1c};
+            uint32_t f5 = f5s[rand() % (sizeof(f5s) / sizeof(f5s[0]))];
+            return R((f5 << 2) | (rand() % 4), f5 == 0x02 ? 0 : reg(), reg(), 2, reg(), 0x2f);
+        }
+        case 8:
+        {
+            switch (rand() % 5)
+            {
+                case 0: return 0x0ff0000f;                       // fence
+                case 1: return 0x0000100f;                       // fence.i
+                case 2: return I(rand() % 3, reg(), 2, 0, 0x0f); // cbo.inval/clean/flush
+                case 3: return ((uint32_t)rand() << 12) | (reg() << 7) | 0x37;
+                default: return ((uint32_t)rand() % 4 << 12) | (reg() << 7) | 0x17;
+            }
+        }
+        default: return J(((rand() % 17) - 8) * 4, rand() % 2 ? 0 : 1);
+    }
+}
+
+static uint32_t nop(int size)
+{
+    return size == 32 ? 0x00000013 : 0x0001;
+}
+} // namespace InstrGen
+
 class Tactic
 {
   public:
+    virtual ~Tactic() = default;
     virtual bool mutate(TestCase& test_case) = 0;
 };
 
@@ -80,33 +231,197 @@ class RandomBitflipTactic : public Tactic
     }
 };
 
+// Replace an instruction by a newly generated one (of any size, so the code after it may shift).
+class ReplaceInstrTactic : public Tactic
+{
+  public:
+    virtual bool mutate(TestCase& test_case)
+    {
+        test_case.prog[rand() % test_case.prog.size()].data = InstrGen::random_instr();
+        return true;
+    }
+};
+
+class InsertInstrTactic : public Tactic
+{
+  public:
+    virtual bool mutate(TestCase& test_case)
+    {
+        size_t idx = rand() % (test_case.prog.size() + 1);
+        test_case.prog.insert(test_case.prog.begin() + idx, Instr{InstrGen::random_instr()});
+        return true;
+    }
+};
+
+class DeleteInstrTactic : public Tactic
+{
+  public:
+    virtual bool mutate(TestCase& test_case)
+    {
+        if (test_case.prog.size() < 2)
+            return false;
+        test_case.prog.erase(test_case.prog.begin() + rand() % test_case.prog.size());
+        return true;
+    }
+};
+
+// Change one register operand of a 32-bit instruction, to create or break dependencies.
+class RegisterTactic : public Tactic
+{
+  public:
+    virtual bool mutate(TestCase& test_case)
+    {
+        auto& instr = test_case.prog[rand() % test_case.prog.size()];
+        if (instr.get_size() != 32)
+            return false;
+        static const int shifts[] = {7, 15, 20};
+        int shift = shifts[rand() % 3];
+        instr.data = (instr.data & ~(0x1fu << shift)) | (InstrGen::reg() << shift);
+        return true;
+    }
+};
+
+// Set the I-type immediate (or load/store offset) of a 32-bit instruction to an interesting value.
+class ImmediateTactic : public Tactic
+{
+  public:
+    virtual bool mutate(TestCase& test_case)
+    {
+        auto& instr = test_case.prog[rand() % test_case.prog.size()];
+        if (instr.get_size() != 32)
+            return false;
+        static const int32_t values[] = {0, 1, 2, 4, -1, -2, -4, 8, 16, 32, 63, 64, -64, 2047, -2048};
+        uint32_t imm = values[rand() % (sizeof(values) / sizeof(values[0]))];
+        if ((instr.data & 0x7f) == 0x23)
+            instr.data = (instr.data & 0x01fff07f) | ((imm >> 5 & 0x7f) << 25) | ((imm & 0x1f) << 7);
+        else
+            instr.data = (instr.data & 0x000fffff) | ((imm & 0xfff) << 20);
+        return true;
+    }
+};
+
+// Copy a short run of instructions to another position, e.g. to repeat a load/store pair.
+class DuplicateTactic : public Tactic
+{
+  public:
+    virtual bool mutate(TestCase& test_case)
+    {
+        size_t len = 1 + rand() % std::min<size_t>(8, test_case.prog.size());
+        size_t src = rand() % (test_case.prog.size() - len + 1);
+        size_t dst = rand() % (test_case.prog.size() + 1);
+        std::vector<Instr> block(test_case.prog.begin() + src, test_case.prog.begin() + src + len);
+        test_case.prog.insert(test_case.prog.begin() + dst, block.begin(), block.end());
+        return true;
+    }
+};
+
+class SwapTactic : public Tactic
+{
+  public:
+    virtual bool mutate(TestCase& test_case)
+    {
+        size_t a = rand() % test_case.prog.size();
+        size_t b = rand() % test_case.prog.size();
+        std::swap(test_case.prog[a], test_case.prog[b]);
+        return a != b;
+    }
+};
+
 // strategy is a collection of tactics, selects tactic(s) to execute
 class Strategy
 {
     struct CaseState
     {
         TestCase testCase;
+        size_t picks = 0;
     };
 
   public:
     std::vector<std::unique_ptr<Tactic>> tactics;
+    // Corpus of interesting test cases, the first one is the base case
     std::vector<CaseState> testCaseStack;
     Strategy(std::vector<std::unique_ptr<Tactic>> tactics) : tactics(std::move(tactics))
     {
     }
+    virtual ~Strategy() = default;
     virtual void base_case(TestCase test_case)
     {
         testCaseStack.push_back(CaseState{test_case});
     }
     virtual std::unique_ptr<TestCase> get_case()
     {
-        auto testCase = std::make_unique<TestCase>(testCaseStack[0].testCase);
-        auto& tactic = *tactics[rand() % tactics.size()];
-        tactic.mutate(*testCase);
+        // Of two random corpus entries, mutate the one picked less often so far
+        auto& a = testCaseStack[rand() % testCaseStack.size()];
+        auto& b = testCaseStack[rand() % testCaseStack.size()];
+        auto& entry = (a.picks <= b.picks) ? a : b;
+        entry.picks++;
+        auto testCase = std::make_unique<TestCase>(entry.testCase);
+
+        // Splice with another entry
+        auto& other = testCaseStack[rand() % testCaseStack.size()].testCase;
+        if (rand() % 8 == 0 && &other != &entry.testCase && !other.prog.empty() && !testCase->prog.empty())
+        {
+            size_t cut = rand() % std::min(testCase->prog.size(), other.prog.size());
+            testCase->prog.resize(cut);
+            testCase->prog.insert(testCase->prog.end(), other.prog.begin() + cut, other.prog.end());
+        }
+
+        // Stack a few mutations
+        size_t n = 1 + rand() % 4;
+        for (size_t i = 0; i < n && !testCase->prog.empty(); i++)
+            tactics[rand() % tactics.size()]->mutate(*testCase);
         return testCase;
     }
 };
 
+// Coverage feedback as bucketed hit counts per coverage point (as in AFL), so that a
+// point being hit a different number of times also counts as new behaviour.
+class CoverageMap
+{
+  public:
+    static uint8_t bucket(uint32_t count)
+    {
+        if (count == 0)
+            return 0;
+        if (count < 4)
+            return 1 << (count - 1);
+        if (count < 8)
+            return 8;
+        if (count < 16)
+            return 16;
+        if (count < 32)
+            return 32;
+        if (count < 128)
+            return 64;
+        return 128;
+    }
+
+    // Add the counts of a run, returns the number of newly seen (point, bucket) pairs.
+    size_t merge(const uint32_t* counts, size_t n)
+    {
+        if (seen.size() < n)
+            seen.resize(n);
+        size_t fresh = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            uint8_t b = bucket(counts[i]);
+            if (b & ~seen[i])
+            {
+                fresh += __builtin_popcount(b & ~seen[i]);
+                covered += (seen[i] == 0);
+                seen[i] |= b;
+            }
+        }
+        return fresh;
+    }
+
+    // Number of points hit at least once
+    size_t covered = 0;
+
+  private:
+    std::vector<uint8_t> seen;
+};
+
 enum class RunResultFlags
 {
     FINISHED,
@@ -116,34 +431,144 @@ enum class RunResultFlags
 
 struct RunResults
 {
-    float coverage;
     RunResultFlags flags;
+    // Coverage counters of the run, owned by the runner
+    const uint32_t* counts = nullptr;
+    size_t numCounts = 0;
+    // Filled in by the fuzzer: number of new coverage buckets
+    size_t coverage = 0;
+    // For errors, what failed where. Minimization keeps test cases failing the same way.
+    int errorCode = 0;
+    uint32_t errorPC = 0;
+
+    bool same_error(const RunResults& o) const
+    {
+        return flags == RunResultFlags::ERROR && o.flags == RunResultFlags::ERROR && errorCode == o.errorCode &&
+               errorPC == o.errorPC;
+    }
+};
+
+struct FuzzStats
+{
+    size_t execs = 0;
+    size_t timeouts = 0;
+    size_t errors = 0;
+    size_t crashes = 0;
 };
 
 class Fuzzer
 {
   public:
     std::unique_ptr<Strategy> strategy;
+    CoverageMap coverage;
+    // Only errors with coverage not seen in earlier errors are reported
+    CoverageMap errorCoverage;
+    FuzzStats stats;
+    // Maximum number of runs spent on minimizing a single error
+    size_t minimizeRuns = 256;
 
+    virtual ~Fuzzer() = default;
     virtual RunResults run(TestCase const& test_case) = 0;
+    // Called with the minimized test case of a new error
     virtual void report(TestCase const& test_case, RunResults const& results) = 0;
+    // Called for test cases that produced new coverage
+    virtual void new_case(TestCase const& test_case)
+    {
+    }
+    // Called periodically, e.g. to import cases found by other processes
+    virtual void sync()
+    {
+    }
+
+    // Run a test case, add it to the corpus if it increases coverage.
+    RunResults evaluate(TestCase const& test_case, bool notify)
+    {
+        auto results = run(test_case);
+        stats.execs++;
+        if (results.flags == RunResultFlags::TIMEOUT)
+            stats.timeouts++;
+        if (results.flags == RunResultFlags::ERROR)
+        {
+            stats.errors++;
+            results.coverage = errorCoverage.merge(results.counts, results.numCounts);
+            return results;
+        }
+
+        results.coverage = coverage.merge(results.counts, results.numCounts);
+        if (results.coverage != 0)
+        {
+            strategy->base_case(test_case);
+            if (notify)
+                new_case(test_case);
+        }
+        return results;
+    }
 
+    // Minimize a test case that failed with error, accepting only changes that keep the
+    // same error. First cut off ever smaller parts of the end, then replace ever smaller
+    // runs of instructions by NOPs of the same size (keeping all addresses intact).
+    TestCase minimize(TestCase test_case, RunResults const& error)
+    {
+        size_t runs = 0;
+        for (size_t cut = test_case.prog.size() / 2; cut != 0; cut /= 2)
+        {
+            while (cut < test_case.prog.size() && runs < minimizeRuns)
+            {
+                TestCase candidate = test_case;
+                candidate.prog.resize(candidate.prog.size() - cut);
+                runs++;
+                if (!run(candidate).same_error(error))
+                    break;
+                test_case = candidate;
+            }
+        }
+
+        for (size_t chunk = std::max<size_t>(test_case.prog.size() / 2, 1); chunk != 0; chunk /= 2)
+        {
+            for (size_t start = 0; start < test_case.prog.size() && runs < minimizeRuns; start += chunk)
+            {
+                TestCase candidate = test_case;
+                bool changed = false;
+                for (size_t i = start; i < std::min(start + chunk, candidate.prog.size()); i++)
+                {
+                    auto& instr = candidate.prog[i];
+                    uint32_t nop = InstrGen::nop(instr.get_size());
+                    changed |= instr.data != nop;
+                    instr.data = nop;
+                }
+                if (!changed)
+                    continue;
+                runs++;
+                if (run(candidate).same_error(error))
+                    test_case = candidate;
+            }
+        }
+        return test_case;
+    }
+
+    // Fuzz for iters test cases (0 for no limit), starting from test_case.
     void fuzz(size_t iters, uint seed, TestCase test_case)
     {
+        const size_t SYNC_INTERVAL = 1024;
+
         srand(seed);
-        strategy->base_case(test_case);
+        evaluate(test_case, false);
+        if (strategy->testCaseStack.empty())
+            strategy->base_case(test_case);
+        sync();
 
-        for (size_t i = 0; i < iters; i++)
+        for (size_t i = 0; iters == 0 || i < iters; i++)
         {
             auto cur_case = strategy->get_case();
-            auto results = run(test_case);
-            switch (results.flags)
+            auto results = evaluate(*cur_case, true);
+            if (results.flags == RunResultFlags::ERROR && results.coverage != 0)
             {
-                case RunResultFlags::ERROR: report(*cur_case, results);
-                case RunResultFlags::TIMEOUT:
-                case RunResultFlags::FINISHED: break;
+                stats.crashes++;
+                report(minimize(*cur_case, results), results);
             }
 
+            if ((i + 1) % SYNC_INTERVAL == 0)
+                sync();
         }
     }
 };
@@ -0,0 +1,403 @@
+#pragma once
+#include "Inst.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_set>
+
+// Golden commit log: Spike's retire stream, recorded once with --golden-record and then
+// used to check RTL runs instead of stepping Spike live (--golden).
+//
+// File layout: "SOOMGOLD" u32 version, then one entry per Spike step:
+//   u8 flags
+//   u32 pc                                  if GOLD_PC (else pc follows the previous entry)
+//   u16/u32 instruction                     unless GOLD_INTERRUPT (u16 if GOLD_RVC)
+//   u8 rd, u32 value                        if GOLD_RD
+//   u32 cause                               if GOLD_TRAP
+//   u8 n, n * {u32 addr, u8 size}           if GOLD_LOADS
+//   u8 n, n * {u32 addr, u32 data, u8 size} if GOLD_STORES
+// A flags byte of GOLD_END terminates the log.
+
+enum GoldenFlags : uint8_t
+{
+    GOLD_PC = 1,
+    GOLD_RVC = 2,
+    GOLD_RD = 4,
+    // Result depends on timing or devices (counter CSRs, MMIO), not compared
+    GOLD_NONDET = 8,
+    // Instruction did not retire (exception), or interrupt taken instead of an instruction
+    GOLD_TRAP = 16,
+    GOLD_INTERRUPT = 32,
+    GOLD_LOADS = 64,
+    GOLD_STORES = 128,
+    GOLD_END = 0xff,
+};
+
+static const char GOLD_MAGIC[8] = {'S', 'O', 'O', 'M', 'G', 'O', 'L', 'D'};
+static const uint32_t GOLD_VERSION = 1;
+
+struct GoldenEntry
+{
+    static constexpr size_t MAX_ACCESSES = 4;
+    struct Access
+    {
+        uint32_t addr;
+        uint32_t data;
+        uint8_t size;
+    };
+
+    uint8_t flags;
+    uint32_t pc;
+    uint32_t inst;
+    uint8_t rd;
+    uint32_t value;
+    uint32_t cause;
+    uint8_t numLoads;
+    uint8_t numStores;
+    Access loads[MAX_ACCESSES];
+    Access stores[MAX_ACCESSES];
+
+    uint32_t next_pc() const
+    {
+        return pc + ((flags & GOLD_RVC) ? 2 : 4);
+    }
+};
+
+class GoldenLogWriter
+{
+  public:
+    GoldenLogWriter(std::string path)
+    {
+        f = fopen(path.c_str(), "wb");
+        if (!f)
+            abort();
+        write(GOLD_MAGIC, sizeof(GOLD_MAGIC));
+        write(&GOLD_VERSION, sizeof(GOLD_VERSION));
+    }
+
+    ~GoldenLogWriter()
+    {
+        close();
+    }
+
+    void add(GoldenEntry e)
+    {
+        if (e.pc != nextPC || (e.flags & GOLD_INTERRUPT))
+            e.flags |= GOLD_PC;
+        if (e.numLoads)
+            e.flags |= GOLD_LOADS;
+        if (e.numStores)
+            e.flags |= GOLD_STORES;
+
+        write(&e.flags, 1);
+        if (e.flags & GOLD_PC)
+            write(&e.pc, 4);
+        if (!(e.flags & GOLD_INTERRUPT))
+            write(&e.inst, (e.flags & GOLD_RVC) ? 2 : 4);
+        if (e.flags & GOLD_RD)
+        {
+            write(&e.rd, 1);
+            write(&e.value, 4);
+        }
+        if (e.flags & GOLD_TRAP)
+            write(&e.cause, 4);
+        if (e.flags & GOLD_LOADS)
+        {
+            write(&e.numLoads, 1);
+            for (size_t i = 0; i < e.numLoads; i++)
+            {
+                write(&e.loads[i].addr, 4);
+                write(&e.loads[i].size, 1);
+            }
+        }
+        if (e.flags & GOLD_STORES)
+        {
+            write(&e.numStores, 1);
+            for (size_t i = 0; i < e.numStores; i++)
+            {
+                write(&e.stores[i].addr, 4);
+                write(&e.stores[i].data, 4);
+                write(&e.stores[i].size, 1);
+            }
+        }
+        // After an interrupt, execution continues at the trap vector, which is not known here
+        nextPC = (e.flags & (GOLD_TRAP | GOLD_INTERRUPT)) ? 0 : e.next_pc();
+        count++;
+    }
+
+    void close()
+    {
+        if (!f)
+            return;
+        uint8_t end = GOLD_END;
+        write(&end, 1);
+        if (fclose(f) != 0)
+            abort();
+        f = nullptr;
+    }
+
+    uint64_t count = 0;
+
+  private:
+    FILE* f;
+    uint32_t nextPC = 0;
+
+    void write(const void* data, size_t len)
+    {
+        if (fwrite(data, len, 1, f) != 1)
+            abort();
+    }
+};
+
+class GoldenLogReader
+{
+  public:
+    GoldenLogReader(std::string path)
+    {
+        f = fopen(path.c_str(), "rb");
+        if (!f)
+        {
+            fprintf(stderr, "could not open golden log %s\n", path.c_str());
+            exit(-1);
+        }
+        setvbuf(f, nullptr, _IOFBF, 1 << 20);
+        char magic[sizeof(GOLD_MAGIC)];
+        uint32_t version;
+        if (fread(magic, sizeof(magic), 1, f) != 1 || fread(&version, sizeof(version), 1, f) != 1 ||
+            memcmp(magic, GOLD_MAGIC, sizeof(magic)) != 0 || version != GOLD_VERSION)
+        {
+            fprintf(stderr, "%s is not a compatible golden log\n", path.c_str());
+            exit(-1);
+        }
+    }
+
+    ~GoldenLogReader()
+    {
+        fclose(f);
+    }
+
+    // Returns false at the end of the log
+    bool next(GoldenEntry& e)
+    {
+        if (fread(&e.flags, 1, 1, f) != 1 || e.flags == GOLD_END)
+            return false;
+        e.pc = nextPC;
+        e.inst = 0;
+        e.numLoads = 0;
+        e.numStores = 0;
+        if (e.flags & GOLD_PC)
+            read(&e.pc, 4);
+        if (!(e.flags & GOLD_INTERRUPT))
+            read(&e.inst, (e.flags & GOLD_RVC) ? 2 : 4);
+        if (e.flags & GOLD_RD)
+        {
+            read(&e.rd, 1);
+            read(&e.value, 4);
+        }
+        if (e.flags & GOLD_TRAP)
+            read(&e.cause, 4);
+        if (e.flags & GOLD_LOADS)
+        {
+            read(&e.numLoads, 1);
+            if (e.numLoads > GoldenEntry::MAX_ACCESSES)
+                corrupt();
+            for (size_t i = 0; i < e.numLoads; i++)
+            {
+                read(&e.loads[i].addr, 4);
+                read(&e.loads[i].size, 1);
+            }
+        }
+        if (e.flags & GOLD_STORES)
+        {
+            read(&e.numStores, 1);
+            if (e.numStores > GoldenEntry::MAX_ACCESSES)
+                corrupt();
+            for (size_t i = 0; i < e.numStores; i++)
+            {
+                read(&e.stores[i].addr, 4);
+                read(&e.stores[i].data, 4);
+                read(&e.stores[i].size, 1);
+            }
+        }
+        nextPC = (e.flags & (GOLD_TRAP | GOLD_INTERRUPT)) ? 0 : e.next_pc();
+        return true;
+    }
+
+  private:
+    FILE* f;
+    uint32_t nextPC = 0;
+
+    void read(void* data, size_t len)
+    {
+        if (fread(data, len, 1, f) != 1)
+            corrupt();
+    }
+
+    [[noreturn]] void corrupt()
+    {
+        fprintf(stderr, "truncated or corrupt golden log\n");
+        exit(-1);
+    }
+};
+
+// Riscv-tests report their result through stores to tohost. Returns true once the test is done.
+static bool GoldenTestStore(uint32_t addr, uint32_t data, int& testReturn)
+{
+    if (addr == 0x80001000 || addr == 0x80003000)
+        testReturn = data;
+    else if ((addr == 0x80001004 || addr == 0x80003004) && data == 0)
+        return true;
+    return false;
+}
+
+// Checks RTL commits against a golden log. Error codes are the same as those of
+// SpikeSimif::cosim_instr, plus -7 for running past the end of the log and -8 for
+// interrupts that do not match.
+//
+// Values read from counters or devices differ between runs, so they are not compared,
+// and neither is anything computed from them: registers and memory words are tainted by
+// such values and only untainted once overwritten by a deterministic result. Source
+// registers are decoded conservatively (any field that may be a source counts).
+class GoldenReplay
+{
+  public:
+    GoldenLogReader log;
+    GoldenEntry cur = {};
+    uint64_t instret = 0;
+    bool riscvTestMode = false;
+    int riscvTestReturn = 0;
+
+    GoldenReplay(std::string path) : log(path)
+    {
+    }
+
+    // RTL took an interrupt before inst
+    int check_interrupt(const Inst& inst)
+    {
+        if (!log.next(cur))
+            return -7;
+        if (!(cur.flags & GOLD_INTERRUPT) || cur.pc != inst.pc)
+            return -8;
+        return 0;
+    }
+
+    int check(const Inst& inst, uint32_t rdValue)
+    {
+        if (!log.next(cur))
+            return -7;
+        if (cur.flags & GOLD_INTERRUPT)
+            return -8;
+        if (inst.pc != cur.pc)
+            return -1;
+        bool instrEqual = (cur.flags & GOLD_RVC) ? (inst.inst & 0xFFFF) == cur.inst : inst.inst == cur.inst;
+        // Instruction fetch faults are recorded without instruction
+        bool fetchFault = (cur.flags & GOLD_TRAP) && cur.inst == 0;
+        if (!instrEqual && !fetchFault)
+            return -2;
+
+        bool tainted = (cur.flags & GOLD_NONDET) || (sources(cur.inst) & taintedRegs);
+        for (size_t i = 0; i < cur.numLoads; i++)
+            tainted |= is_tainted(cur.loads[i]);
+        for (size_t i = 0; i < cur.numStores; i++)
+            set_tainted(cur.stores[i], tainted);
+
+        bool rtlWrites = inst.rd != 0 && inst.flags < 6;
+        if (cur.flags & GOLD_RD)
+        {
+            if (cur.rd != inst.rd || (!tainted && rdValue != cur.value))
+                return -4;
+            taintedRegs = (taintedRegs & ~(1u << cur.rd)) | ((uint32_t)tainted << cur.rd);
+        }
+        else if (rtlWrites)
+            return -4;
+
+        if (!(cur.flags & GOLD_TRAP))
+            instret++;
+        if (inst.minstret != instret)
+            return -6;
+
+        // An interrupt is taken right after this instruction
+        if (inst.interrupt == Inst::IR_KEEP)
+        {
+            GoldenEntry irq;
+            if (!log.next(irq))
+                return -7;
+            if (!(irq.flags & GOLD_INTERRUPT))
+                return -8;
+        }
+
+        if (riscvTestMode)
+            for (size_t i = 0; i < cur.numStores; i++)
+                if (GoldenTestStore(cur.stores[i].addr, cur.stores[i].data, riscvTestReturn))
+                    return 1;
+        return 0;
+    }
+
+    void dump_expected(FILE* stream) const
+    {
+        fprintf(stream, "ir=%.8lx pc=%.8x inst=%.8x flags=%.2x", instret, cur.pc, cur.inst, cur.flags);
+        if (cur.flags & GOLD_RD)
+            fprintf(stream, " x%u=%.8x%s", cur.rd, cur.value, (taintedRegs >> cur.rd) & 1 ? " (not compared)" : "");
+        if (cur.flags & GOLD_TRAP)
+            fprintf(stream, " cause=%.8x", cur.cause);
+        fprintf(stream, "\n");
+    }
+
+  private:
+    uint32_t taintedRegs = 0;
+    std::unordered_set<uint32_t> taintedWords;
+
+    static uint32_t sources(uint32_t inst)
+    {
+        auto bit = [](uint32_t reg) { return reg == 0 ? 0 : (1u << reg); };
+        uint32_t funct3 = (inst >> 13) & 7;
+        switch (inst & 3)
+        {
+            case 0:
+                if (funct3 == 0) // c.addi4spn
+                    return bit(2);
+                return bit(((inst >> 7) & 7) + 8) | bit(((inst >> 2) & 7) + 8);
+            case 1:
+                if (funct3 == 1 || funct3 == 2 || funct3 == 5) // c.jal, c.li, c.j
+                    return 0;
+                if (funct3 == 3) // c.lui, c.addi16sp
+                    return ((inst >> 7) & 31) == 2 ? bit(2) : 0;
+                return bit((inst >> 7) & 31) | bit(((inst >> 7) & 7) + 8) | bit(((inst >> 2) & 7) + 8);
+            case 2:
+                if (funct3 == 2) // c.lwsp
+                    return bit(2);
+                return bit((inst >> 7) & 31) | bit((inst >> 2) & 31) | bit(2);
+            default:
+            {
+                uint32_t opcode = inst & 0x7f;
+                if (opcode == 0x37 || opcode == 0x17 || opcode == 0x6f)
+                    return 0;
+                return bit((inst >> 15) & 31) | bit((inst >> 20) & 31);
+            }
+        }
+    }
+
+    bool is_tainted(const GoldenEntry::Access& a) const
+    {
+        if (taintedWords.empty())
+            return false;
+        for (uint32_t w = a.addr & ~3; w < a.addr + a.size; w += 4)
+            if (taintedWords.count(w))
+                return true;
+        return false;
+    }
+
+    void set_tainted(const GoldenEntry::Access& a, bool tainted)
+    {
+        for (uint32_t w = a.addr & ~3; w < a.addr + a.size; w += 4)
+        {
+            if (tainted)
+                taintedWords.insert(w);
+            else if (!taintedWords.empty())
+                taintedWords.erase(w);
+        }
+    }
+};
@@ -23,6 +23,8 @@ struct Inst
     uint8_t interruptCause;
     uint8_t retIdx;
     uint64_t minstret;
+    // RTL branch history at commit, sampled for the BranchHistory model
+    uint64_t brHistory;
     bool incMinstret;
     bool interruptDelegate;
     enum InterruptType
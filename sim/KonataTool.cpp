@@ -0,0 +1,169 @@
+// Convert binary pipeline traces written by KONATA builds.
+// Build with `make konata-tool`.
+#include "KonataTrace.hpp"
+#include "riscv/disasm.h"
+#include "riscv/isa_parser.h"
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Same ISA as the cosim Spike, for disassembly
+static const char* const ISA = "rv32imac_zicsr_zba_zbb_zbs_zicbom_zifencei_zcb_zihpm_zicntr";
+
+static void Text(std::string path, std::string outPath)
+{
+    KonataReader reader(path);
+    FILE* f = outPath.empty() ? stdout : fopen(outPath.c_str(), "w");
+    if (!f)
+    {
+        fprintf(stderr, "could not open %s\n", outPath.c_str());
+        exit(-1);
+    }
+
+    isa_parser_t isa(ISA, "MSU");
+    disassembler_t disasm(&isa);
+    std::unordered_map<uint32_t, std::string> disasmCache;
+    // Instructions fetched before a trace window opened are left out
+    std::unordered_set<uint32_t> live;
+
+    fprintf(f, "Kanata\t0004\n");
+    KonataReader::Event e;
+    while (reader.next(e))
+    {
+        auto* a = e.args;
+        if (e.type == KEV_INSERT)
+            live.insert(e.id);
+        else if (e.type != KEV_CYCLE && !live.count(e.id))
+            continue;
+        if (e.type == KEV_RETIRE || e.type == KEV_FLUSH)
+            live.erase(e.id);
+
+        switch (e.type)
+        {
+            case KEV_CYCLE: fprintf(f, "C\t%lu\n", a[0]); break;
+            case KEV_INSERT: fprintf(f, "I\t%u\t%lu\t0\n", e.id, a[0]); break;
+            case KEV_INST:
+            {
+                auto it = disasmCache.find(a[2]);
+                if (it == disasmCache.end())
+                    it = disasmCache.emplace(a[2], disasm.disassemble(a[2])).first;
+                fprintf(f, "L\t%u\t0\t[%.5lu]%.8lx (%.8lx): %s\n", e.id, a[0], a[1], a[2], it->second.c_str());
+                break;
+            }
+            case KEV_STAGE: fprintf(f, "S\t%u\t0\t%s\n", e.id, KONATA_STAGE_NAMES[a[0] % NUM_KST]); break;
+            case KEV_RETIRE: fprintf(f, "R\t%u\t%lu\t0\n", e.id, a[0]); break;
+            case KEV_FLUSH: fprintf(f, "R\t%u\t0\t1\n", e.id); break;
+            case KEV_RESULT: fprintf(f, "L\t%u\t1\tres=%.8lx\n", e.id, a[0]); break;
+            case KEV_OPERANDS:
+                fprintf(f, "L\t%u\t1\topA=%.8lx \n", e.id, a[0]);
+                fprintf(f, "L\t%u\t1\topB=%.8lx \n", e.id, a[1]);
+                fprintf(f, "L\t%u\t1\timm=%.8lx \n", e.id, a[2]);
+                break;
+            case KEV_LABEL: fprintf(f, "L\t%u\t%lu\t%s\n", e.id, a[0], e.text.c_str()); break;
+        }
+    }
+    if (f != stdout)
+        fclose(f);
+}
+
+// Average and maximum number of cycles committed instructions spend in each stage
+static void Summary(std::string path)
+{
+    struct InFlight
+    {
+        uint64_t inserted;
+        uint64_t entered;
+        int stage = -1;
+        uint32_t cycles[NUM_KST] = {};
+    };
+    struct StageStats
+    {
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        uint64_t count = 0;
+
+        void add(uint64_t cycles)
+        {
+            sum += cycles;
+            max = std::max(max, cycles);
+            count++;
+        }
+    };
+
+    KonataReader reader(path);
+    std::unordered_map<uint32_t, InFlight> inFlight;
+    StageStats stages[NUM_KST];
+    StageStats total;
+    uint64_t cycle = 0;
+    uint64_t flushed = 0;
+
+    KonataReader::Event e;
+    while (reader.next(e))
+    {
+        switch (e.type)
+        {
+            case KEV_CYCLE: cycle += e.args[0]; break;
+            case KEV_INSERT: inFlight[e.id] = InFlight{cycle, cycle}; break;
+            case KEV_STAGE:
+            {
+                auto it = inFlight.find(e.id);
+                if (it == inFlight.end())
+                    break;
+                InFlight& i = it->second;
+                if (i.stage >= 0)
+                    i.cycles[i.stage] += cycle - i.entered;
+                i.stage = e.args[0] % NUM_KST;
+                i.entered = cycle;
+                break;
+            }
+            case KEV_RETIRE:
+            {
+                auto it = inFlight.find(e.id);
+                if (it == inFlight.end())
+                    break;
+                InFlight& i = it->second;
+                if (i.stage >= 0)
+                    i.cycles[i.stage] += cycle - i.entered;
+                for (size_t s = 0; s < NUM_KST; s++)
+                    stages[s].add(i.cycles[s]);
+                total.add(cycle - i.inserted);
+                inFlight.erase(it);
+                break;
+            }
+            case KEV_FLUSH:
+                flushed += inFlight.erase(e.id);
+                break;
+            default: break;
+        }
+    }
+
+    printf("%lu cycles, %lu committed, %lu flushed\n", cycle, total.count, flushed);
+    if (total.count == 0)
+        return;
+    printf("stage  avg cycles  max cycles\n");
+    for (size_t s = 0; s < NUM_KST; s++)
+        printf("%-5s  %10.2f  %10lu\n", KONATA_STAGE_NAMES[s], (double)stages[s].sum / stages[s].count,
+               stages[s].max);
+    printf("%-5s  %10.2f  %10lu\n", "total", (double)total.sum / total.count, total.max);
+}
+
+int main(int argc, char** argv)
+{
+    std::string cmd = (argc > 1) ? argv[1] : "";
+    if (cmd == "text" && (argc == 3 || argc == 4))
+        Text(argv[2], argc == 4 ? argv[3] : "");
+    else if (cmd == "summary" && argc == 3)
+        Summary(argv[2]);
+    else
+    {
+        fprintf(stderr,
+                "usage: %s text <TRACE> [<OUTPUT>.txt]\n"
+                "       %s summary <TRACE>\n"
+                "text:    Convert a binary pipeline trace (trace_konata.bin[.gz]) to Konata text.\n"
+                "summary: Print per-stage latencies of committed instructions.\n",
+                argv[0], argv[0]);
+        return -1;
+    }
+    return 0;
+}
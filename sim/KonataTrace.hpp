@@ -0,0 +1,405 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+// Binary pipeline trace. Instead of Konata text, the simulator writes compact events:
+// an event byte, the instruction ID as a zigzag varint delta to the previous event's ID,
+// then the event's fields as varints. Runs of cycles are merged into a single event, and
+// disassembly is left to the converter (make konata-tool), which turns a trace back into
+// Konata text or summarizes per-stage latencies.
+//
+// The file is written through zlib, compressed with --konata-gzip and transparent otherwise.
+// gzopen reads either.
+
+static constexpr char KONATA_MAGIC[8] = {'S', 'O', 'O', 'M', 'K', 'N', 'T', 'A'};
+static constexpr uint32_t KONATA_VERSION = 1;
+
+enum KonataEvent : uint8_t
+{
+    // cycles
+    KEV_CYCLE,
+    // id, fetchID
+    KEV_INSERT,
+    // id, time, pc, inst
+    KEV_INST,
+    // id, stage
+    KEV_STAGE,
+    // id, sqn
+    KEV_RETIRE,
+    // id
+    KEV_FLUSH,
+    // id, result
+    KEV_RESULT,
+    // id, srcA, srcB, imm
+    KEV_OPERANDS,
+    // id, lane, length, text
+    KEV_LABEL,
+};
+
+enum KonataStage : uint8_t
+{
+    KST_DEC,
+    KST_RN,
+    KST_IS,
+    KST_WFC,
+    KST_EX,
+    KST_LD,
+    KST_COM,
+    NUM_KST,
+};
+
+static const char* const KONATA_STAGE_NAMES[NUM_KST] = {"DEC", "RN", "IS", "WFC", "EX", "LD", "COM"};
+
+// Events are encoded into chunks on the simulation thread, a background thread compresses
+// and writes full chunks. The simulation thread only waits if all chunks are in flight.
+class KonataWriter
+{
+  public:
+    ~KonataWriter()
+    {
+        close();
+    }
+
+    void open(const std::string& path, bool compress)
+    {
+        file = gzopen(path.c_str(), compress ? "wb1" : "wbT");
+        if (!file)
+            abort();
+        gzbuffer(file, 1 << 20);
+
+        if (freeChunks.empty())
+            for (size_t i = 0; i < NUM_CHUNKS; i++)
+                freeChunks.push_back(std::make_unique<Chunk>());
+        next_chunk();
+        lastID = 0;
+        pendingCycles = 0;
+        stop = false;
+
+        uint8_t header[12];
+        memcpy(header, KONATA_MAGIC, 8);
+        memcpy(header + 8, &KONATA_VERSION, 4);
+        memcpy(cur->data + cur->size, header, sizeof(header));
+        cur->size += sizeof(header);
+
+        thread = std::thread([this] { run(); });
+    }
+
+    bool is_open() const
+    {
+        return file != nullptr;
+    }
+
+    void cycle(uint64_t n = 1)
+    {
+        pendingCycles += n;
+    }
+
+    void insert(uint32_t id, uint32_t fetchID)
+    {
+        begin(KEV_INSERT, id);
+        put(fetchID);
+    }
+
+    void inst(uint32_t id, uint64_t time, uint32_t pc, uint32_t instr)
+    {
+        begin(KEV_INST, id);
+        put(time);
+        put(pc);
+        put(instr);
+    }
+
+    void stage(uint32_t id, KonataStage s)
+    {
+        begin(KEV_STAGE, id);
+        put(s);
+    }
+
+    void retire(uint32_t id, uint32_t sqn)
+    {
+        begin(KEV_RETIRE, id);
+        put(sqn);
+    }
+
+    void flush_inst(uint32_t id)
+    {
+        begin(KEV_FLUSH, id);
+    }
+
+    void result(uint32_t id, uint32_t value)
+    {
+        begin(KEV_RESULT, id);
+        put(value);
+    }
+
+    void operands(uint32_t id, uint32_t srcA, uint32_t srcB, uint32_t imm)
+    {
+        begin(KEV_OPERANDS, id);
+        put(srcA);
+        put(srcB);
+        put(imm);
+    }
+
+    void label(uint32_t id, uint32_t lane, const char* text)
+    {
+        size_t len = std::min(strlen(text), MAX_LABEL);
+        begin(KEV_LABEL, id);
+        put(lane);
+        put(len);
+        memcpy(cur->data + cur->size, text, len);
+        cur->size += len;
+    }
+
+    // Block until everything logged so far is in the file
+    void flush()
+    {
+        if (!file)
+            return;
+        flush_cycles();
+        submit();
+        next_chunk();
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return fullChunks.empty() && !writing; });
+        gzflush(file, Z_SYNC_FLUSH);
+    }
+
+    void close()
+    {
+        if (!file)
+            return;
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_one();
+        thread.join();
+        freeChunks.push_back(std::move(cur));
+        gzclose(file);
+        file = nullptr;
+    }
+
+  private:
+    static constexpr size_t CHUNK_BYTES = 1 << 16;
+    static constexpr size_t NUM_CHUNKS = 256;
+    // Longest event: byte, 5 byte ID, 10 byte time, up to 3 * 5 byte fields
+    static constexpr size_t MAX_EVENT = 32;
+    static constexpr size_t MAX_LABEL = 256;
+
+    struct Chunk
+    {
+        size_t size = 0;
+        uint8_t data[CHUNK_BYTES];
+    };
+
+    gzFile file = nullptr;
+    std::unique_ptr<Chunk> cur;
+    uint32_t lastID = 0;
+    uint64_t pendingCycles = 0;
+
+    std::deque<std::unique_ptr<Chunk>> freeChunks;
+    std::deque<std::unique_ptr<Chunk>> fullChunks;
+    bool writing = false;
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::thread thread;
+
+    void put(uint64_t v)
+    {
+        uint8_t* p = cur->data + cur->size;
+        while (v >= 0x80)
+        {
+            *p++ = v | 0x80;
+            v >>= 7;
+        }
+        *p++ = v;
+        cur->size = p - cur->data;
+    }
+
+    void flush_cycles()
+    {
+        if (pendingCycles == 0)
+            return;
+        reserve(MAX_EVENT);
+        cur->data[cur->size++] = KEV_CYCLE;
+        put(pendingCycles);
+        pendingCycles = 0;
+    }
+
+    void begin(KonataEvent ev, uint32_t id)
+    {
+        flush_cycles();
+        reserve(MAX_EVENT + MAX_LABEL);
+        cur->data[cur->size++] = ev;
+        int32_t delta = id - lastID;
+        put((uint32_t)(delta << 1) ^ (uint32_t)(delta >> 31));
+        lastID = id;
+    }
+
+    void reserve(size_t bytes)
+    {
+        if (cur->size + bytes > CHUNK_BYTES)
+        {
+            submit();
+            next_chunk();
+        }
+    }
+
+    void submit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fullChunks.push_back(std::move(cur));
+        }
+        wake.notify_one();
+    }
+
+    void next_chunk()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return !freeChunks.empty(); });
+        cur = std::move(freeChunks.front());
+        freeChunks.pop_front();
+        cur->size = 0;
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [this] { return stop || !fullChunks.empty(); });
+            if (fullChunks.empty())
+                return;
+
+            auto chunk = std::move(fullChunks.front());
+            fullChunks.pop_front();
+            writing = true;
+            lock.unlock();
+
+            if (chunk->size != 0 && gzwrite(file, chunk->data, chunk->size) != (int)chunk->size)
+                abort();
+
+            lock.lock();
+            freeChunks.push_back(std::move(chunk));
+            writing = false;
+            idle.notify_all();
+        }
+    }
+};
+
+// Reads events back, for the converter
+class KonataReader
+{
+  public:
+    struct Event
+    {
+        KonataEvent type;
+        uint32_t id;
+        uint64_t args[4];
+        std::string text;
+    };
+
+    KonataReader(const std::string& path)
+    {
+        file = gzopen(path.c_str(), "rb");
+        if (!file)
+        {
+            fprintf(stderr, "could not open %s\n", path.c_str());
+            exit(-1);
+        }
+        gzbuffer(file, 1 << 20);
+
+        uint8_t header[12];
+        uint32_t version;
+        if (gzread(file, header, sizeof(header)) != sizeof(header) || memcmp(header, KONATA_MAGIC, 8) != 0 ||
+            (memcpy(&version, header + 8, 4), version != KONATA_VERSION))
+        {
+            fprintf(stderr, "%s is not a binary Konata trace\n", path.c_str());
+            exit(-1);
+        }
+    }
+
+    ~KonataReader()
+    {
+        gzclose(file);
+    }
+
+    // Returns false at the end of the trace
+    bool next(Event& e)
+    {
+        int c = gzgetc(file);
+        if (c < 0)
+            return false;
+        e.type = (KonataEvent)c;
+        if (e.type == KEV_CYCLE)
+        {
+            e.args[0] = get();
+            return true;
+        }
+
+        uint32_t zz = get();
+        lastID += (int32_t)((zz >> 1) ^ -(zz & 1));
+        e.id = lastID;
+
+        size_t numArgs;
+        switch (e.type)
+        {
+            case KEV_INSERT: numArgs = 1; break;
+            case KEV_INST: numArgs = 3; break;
+            case KEV_STAGE: numArgs = 1; break;
+            case KEV_RETIRE: numArgs = 1; break;
+            case KEV_FLUSH: numArgs = 0; break;
+            case KEV_RESULT: numArgs = 1; break;
+            case KEV_OPERANDS: numArgs = 3; break;
+            case KEV_LABEL: numArgs = 2; break;
+            default: fprintf(stderr, "corrupt trace (event %d)\n", c); exit(-1);
+        }
+        for (size_t i = 0; i < numArgs; i++)
+            e.args[i] = get();
+
+        if (e.type == KEV_LABEL)
+        {
+            e.text.resize(e.args[1]);
+            if (gzread(file, e.text.data(), e.text.size()) != (int)e.text.size())
+                truncated();
+        }
+        return true;
+    }
+
+  private:
+    gzFile file;
+    uint32_t lastID = 0;
+
+    uint64_t get()
+    {
+        uint64_t v = 0;
+        for (int shift = 0;; shift += 7)
+        {
+            int c = gzgetc(file);
+            if (c < 0)
+                truncated();
+            v |= (uint64_t)(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return v;
+        }
+    }
+
+    [[noreturn]] static void truncated()
+    {
+        fprintf(stderr, "trace is truncated\n");
+        exit(-1);
+    }
+};
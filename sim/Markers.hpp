@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+
+// Guest-visible markers are HINTs (slti x0, x0, <code>), which execute as no-ops everywhere.
+// Programs place them with e.g. asm volatile("slti x0, x0, 3").
+enum Marker : uint32_t
+{
+    MARKER_TRACE_START = 1,
+    MARKER_TRACE_STOP = 2,
+    MARKER_ROI_START = 3,
+    MARKER_ROI_STOP = 4,
+};
+
+// Returns the marker code, or -1 if inst is not a marker
+static inline int DecodeMarker(uint32_t inst)
+{
+    return (inst & 0xfffff) == 0x02013 ? (int)(inst >> 20) : -1;
+}
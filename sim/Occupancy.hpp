@@ -0,0 +1,131 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Occupancy histograms of the core's queues and buffers (--occupancy). Every interval
+// cycles, the number of entries in use of each structure is sampled. At the end, the mean,
+// percentiles and the share of samples in which the structure was full are written, along
+// with the histograms.
+class OccupancySampler
+{
+  public:
+    void open(const std::string& path, uint64_t interval)
+    {
+        this->path = path;
+        this->interval = interval;
+        countdown = interval;
+        samples = 0;
+        structs.clear();
+    }
+
+    bool is_open() const
+    {
+        return !path.empty();
+    }
+
+    // Once per cycle, true if this cycle is sampled
+    bool due()
+    {
+        if (--countdown != 0)
+            return false;
+        countdown = interval;
+        samples++;
+        return true;
+    }
+
+    // Structures are identified by their index, in the order they are sampled in. instance
+    // is -1 for structures that only exist once.
+    void sample(size_t idx, const char* name, int instance, uint32_t count, uint32_t size)
+    {
+        if (idx == structs.size())
+        {
+            std::string n = name;
+            if (instance >= 0)
+                n += std::to_string(instance);
+            structs.push_back(Struct{n, size, std::vector<uint64_t>(size + 1)});
+        }
+        Struct& s = structs[idx];
+        s.hist[std::min(count, s.size)]++;
+    }
+
+    // Write the report and stop sampling
+    void close()
+    {
+        if (!is_open())
+            return;
+        write();
+        path.clear();
+    }
+
+  private:
+    struct Struct
+    {
+        std::string name;
+        uint32_t size;
+        std::vector<uint64_t> hist;
+    };
+
+    std::string path;
+    uint64_t interval = 1;
+    uint64_t countdown = 1;
+    uint64_t samples = 0;
+    std::vector<Struct> structs;
+
+    static uint32_t Percentile(const Struct& s, double p)
+    {
+        uint64_t target = p * Sum(s);
+        uint64_t acc = 0;
+        for (uint32_t i = 0; i <= s.size; i++)
+        {
+            acc += s.hist[i];
+            if (acc > target)
+                return i;
+        }
+        return s.size;
+    }
+
+    static uint64_t Sum(const Struct& s)
+    {
+        uint64_t sum = 0;
+        for (uint64_t n : s.hist)
+            sum += n;
+        return sum;
+    }
+
+    void write()
+    {
+        FILE* f = fopen(path.c_str(), "w");
+        if (!f)
+            abort();
+
+        fprintf(f, "# %lu samples, every %lu cycles\n#\n", samples, interval);
+        fprintf(f, "# %-16s %6s %8s %6s %6s %6s %8s\n", "structure", "size", "mean", "p50", "p90", "max", "full");
+        for (auto& s : structs)
+        {
+            uint64_t n = std::max<uint64_t>(Sum(s), 1);
+            uint64_t total = 0;
+            uint32_t max = 0;
+            for (uint32_t i = 0; i <= s.size; i++)
+            {
+                total += i * s.hist[i];
+                if (s.hist[i] != 0)
+                    max = i;
+            }
+            fprintf(f, "  %-16s %6u %8.2f %6u %6u %6u %7.2f%%\n", s.name.c_str(), s.size, (double)total / n,
+                    Percentile(s, 0.5), Percentile(s, 0.9), max, 100.0 * s.hist[s.size] / n);
+        }
+
+        for (auto& s : structs)
+        {
+            uint64_t n = std::max<uint64_t>(Sum(s), 1);
+            fprintf(f, "\n# %s\n# %7s %12s %8s\n", s.name.c_str(), "entries", "samples", "share");
+            for (uint32_t i = 0; i <= s.size; i++)
+                fprintf(f, "  %7u %12lu %7.2f%%\n", i, s.hist[i], 100.0 * s.hist[i] / n);
+        }
+        fclose(f);
+    }
+};
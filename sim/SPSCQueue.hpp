@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+
+// Lock-free ring buffer for exactly one producer and one consumer thread. N must be a
+// power of two. Each side caches the other side's index, so the shared indices are only
+// re-read when the ring looks full (producer) or empty (consumer).
+template <typename T, size_t N> class SPSCQueue
+{
+    static_assert((N & (N - 1)) == 0, "size must be a power of two");
+
+  public:
+    // Producer
+    bool try_push(const T& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - headCache == N)
+        {
+            headCache = head.load(std::memory_order_acquire);
+            if (t - headCache == N)
+                return false;
+        }
+        buf[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer, returns nullptr if empty. The item stays valid until pop().
+    T* front()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tailCache)
+        {
+            tailCache = tail.load(std::memory_order_acquire);
+            if (h == tailCache)
+                return nullptr;
+        }
+        return &buf[h & (N - 1)];
+    }
+
+    void pop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Either side
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    // Drop all items. Only call from the producer, while the consumer does not access the queue.
+    void clear()
+    {
+        head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+        tailCache = headCache = head.load(std::memory_order_relaxed);
+    }
+
+  private:
+    alignas(64) std::atomic<size_t> head{0};
+    size_t tailCache = 0;
+    alignas(64) std::atomic<size_t> tail{0};
+    size_t headCache = 0;
+    alignas(64) std::unique_ptr<T[]> buf{new T[N]};
+};
@@ -0,0 +1,229 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// SimPoint-style sampled simulation. Basic block vectors (BBVs) are collected from
+// the functional (Spike) commit stream, one per fixed-size instruction interval.
+// The intervals are clustered using k-means, and one representative interval per
+// cluster is then simulated in detail.
+
+struct BBVProfile
+{
+    // BBVs are randomly projected into a low-dimensional space by hashing block start addresses.
+    static constexpr size_t DIM = 32;
+    using Vector = std::array<double, DIM>;
+
+    std::vector<Vector> intervals;
+    uint64_t totalInstret = 0;
+};
+
+class BBVProfiler
+{
+  public:
+    BBVProfile profile;
+    uint64_t intervalLen;
+
+    BBVProfiler(uint64_t intervalLen) : intervalLen(intervalLen)
+    {
+    }
+
+    void commit(uint32_t pc)
+    {
+        // Any non-sequential PC starts a new basic block.
+        uint32_t delta = pc - lastPC;
+        if (delta != 2 && delta != 4)
+        {
+            end_block();
+            blockStart = pc;
+        }
+        lastPC = pc;
+        blockLen++;
+
+        if (++profile.totalInstret % intervalLen == 0)
+        {
+            end_block();
+            for (auto& v : cur)
+                v /= intervalLen;
+            profile.intervals.push_back(cur);
+            cur = {};
+        }
+    }
+
+  private:
+    BBVProfile::Vector cur = {};
+    uint32_t lastPC = 0;
+    uint32_t blockStart = 0;
+    uint64_t blockLen = 0;
+
+    void end_block()
+    {
+        if (blockLen == 0)
+            return;
+        uint64_t h = (uint64_t)blockStart * 0x9E3779B97F4A7C15UL;
+        cur[(h >> 32) % BBVProfile::DIM] += blockLen;
+        blockLen = 0;
+    }
+};
+
+struct SimPoint
+{
+    size_t interval;
+    double weight;
+    // CPI of each detailed sub-window
+    std::vector<double> cpi;
+};
+
+static double BBVDistance(const BBVProfile::Vector& a, const BBVProfile::Vector& b)
+{
+    double acc = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        acc += (a[i] - b[i]) * (a[i] - b[i]);
+    return acc;
+}
+
+// Cluster intervals with k-means (k-means++ seeding), return one representative
+// interval per cluster (closest to the centroid) sorted by position in the program.
+static std::vector<SimPoint> SelectSimPoints(const std::vector<BBVProfile::Vector>& intervals, size_t k,
+                                             uint seed = 42)
+{
+    const size_t ITERS = 100;
+    size_t n = intervals.size();
+    k = std::min(k, n);
+    if (k == 0)
+        return {};
+
+    std::mt19937 rng(seed);
+    std::vector<BBVProfile::Vector> centroids;
+    centroids.push_back(intervals[rng() % n]);
+    std::vector<double> dist(n);
+    while (centroids.size() < k)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            dist[i] = std::numeric_limits<double>::max();
+            for (auto& c : centroids)
+                dist[i] = std::min(dist[i], BBVDistance(intervals[i], c));
+            sum += dist[i];
+        }
+        double r = std::uniform_real_distribution<double>(0, sum)(rng);
+        size_t next = 0;
+        while (next < n - 1 && (r -= dist[next]) > 0)
+            next++;
+        centroids.push_back(intervals[next]);
+    }
+
+    std::vector<size_t> assign(n, 0);
+    for (size_t iter = 0; iter < ITERS; iter++)
+    {
+        bool changed = false;
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t best = 0;
+            for (size_t c = 1; c < k; c++)
+                if (BBVDistance(intervals[i], centroids[c]) < BBVDistance(intervals[i], centroids[best]))
+                    best = c;
+            changed |= (assign[i] != best);
+            assign[i] = best;
+        }
+        if (!changed && iter != 0)
+            break;
+
+        std::vector<size_t> counts(k, 0);
+        for (auto& c : centroids)
+            c = {};
+        for (size_t i = 0; i < n; i++)
+        {
+            counts[assign[i]]++;
+            for (size_t d = 0; d < BBVProfile::DIM; d++)
+                centroids[assign[i]][d] += intervals[i][d];
+        }
+        for (size_t c = 0; c < k; c++)
+            for (auto& v : centroids[c])
+                v = counts[c] ? v / counts[c] : 0;
+    }
+
+    std::vector<SimPoint> points;
+    for (size_t c = 0; c < k; c++)
+    {
+        size_t count = 0;
+        size_t best = n;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (assign[i] != c)
+                continue;
+            count++;
+            if (best == n || BBVDistance(intervals[i], centroids[c]) < BBVDistance(intervals[best], centroids[c]))
+                best = i;
+        }
+        if (count != 0)
+            points.push_back(SimPoint{best, (double)count / n, {}});
+    }
+
+    std::sort(points.begin(), points.end(), [](auto& a, auto& b) { return a.interval < b.interval; });
+    return points;
+}
+
+// Combine per-SimPoint CPI samples into a weighted estimate. The reported ranges (1.96
+// standard errors) only come from the variance between the sub-windows of each simulated
+// window. That is not a confidence interval for the whole program: it leaves out how well
+// a representative matches the rest of its cluster, which usually dominates the error.
+// Weights are renormalized over the points that produced samples (e.g. a point near the
+// end of the program may not have a full window).
+static void ReportSimPoints(FILE* stream, const std::vector<SimPoint>& points, uint64_t totalInstret,
+                            uint64_t iterations)
+{
+    double cpi = 0;
+    double var = 0;
+    double totalWeight = 0;
+    for (auto& p : points)
+        if (!p.cpi.empty())
+            totalWeight += p.weight;
+    if (totalWeight == 0)
+    {
+        fprintf(stream, "no simulation point produced CPI samples\n");
+        return;
+    }
+
+    fprintf(stream, "interval  weight   CPI\n");
+    for (auto& p : points)
+    {
+        if (p.cpi.empty())
+            continue;
+        double mean = 0;
+        for (double s : p.cpi)
+            mean += s;
+        mean /= p.cpi.size();
+
+        double sVar = 0;
+        for (double s : p.cpi)
+            sVar += (s - mean) * (s - mean);
+        if (p.cpi.size() > 1)
+            sVar /= (p.cpi.size() - 1);
+
+        double w = p.weight / totalWeight;
+        cpi += w * mean;
+        var += w * w * sVar / p.cpi.size();
+        fprintf(stream, "%8zu  %.4f  %.4f\n", p.interval, w, mean);
+    }
+
+    double spread = 1.96 * std::sqrt(var);
+    double cycles = cpi * totalInstret;
+    fprintf(stream, "# ranges: variation within the simulated windows only, not a confidence interval\n");
+    fprintf(stream, "weighted IPC:       %f # range [%f, %f]\n", 1.0 / cpi, 1.0 / (cpi + spread),
+            (cpi > spread) ? 1.0 / (cpi - spread) : INFINITY);
+    fprintf(stream, "instret:            %lu\n", totalInstret);
+    fprintf(stream, "estimated cycles:   %.0f # range [%.0f, %.0f]\n", cycles, (cpi - spread) * totalInstret,
+            (cpi + spread) * totalInstret);
+    if (iterations != 0)
+        fprintf(stream, "iterations/MHz:     %f # range [%f, %f]\n", iterations * 1e6 / cycles,
+                iterations * 1e6 / ((cpi + spread) * totalInstret),
+                (cpi > spread) ? iterations * 1e6 / ((cpi - spread) * totalInstret) : INFINITY);
+}
@@ -0,0 +1,425 @@
+// Round-trip checks of the simulator's binary formats and bit-level accessors, which are
+// not exercised end to end by the test programs. Build and run with `make self-test`.
+#include "sc_stub.hpp"
+#include "slang/slang.hpp"
+#include "BitView.hpp"
+#include "Checkpoint.hpp"
+#include "GoldenLog.hpp"
+#include "KonataTrace.hpp"
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Scratch directory for files written by the tests, removed on destruction.
+struct TempDir
+{
+    std::string path;
+
+    TempDir()
+    {
+        char tmpl[] = "/tmp/soomrv-selftest-XXXXXX";
+        if (!mkdtemp(tmpl))
+            abort();
+        path = tmpl;
+    }
+
+    ~TempDir()
+    {
+        for (auto& f : files)
+            unlink(f.c_str());
+        rmdir(path.c_str());
+    }
+
+    std::string file(std::string name)
+    {
+        files.push_back(path + "/" + name);
+        return files.back();
+    }
+
+  private:
+    std::vector<std::string> files;
+};
+
+// Every field of the struct read through a BitView must match the struct unpacked from
+// an sc_bv, for random signal values. Values with invalid enum fields cannot be unpacked
+// into the struct and are skipped.
+template <typename T, typename F> static bool CheckView(const char* name, F same)
+{
+    std::mt19937_64 rng(1);
+    size_t checked = 0;
+    for (int i = 0; i < 100000 && checked < 10000; i++)
+    {
+        std::vector<uint8_t> raw(BitView<T>::STORAGE_BYTES);
+        for (auto& b : raw)
+            b = rng();
+        // Bits above the signal's width are always zero in Verilator's storage
+        for (size_t bit = T::_size; bit < raw.size() * 8; bit++)
+            raw[bit / 8] &= ~(1 << (bit % 8));
+
+        T s;
+        try
+        {
+            s = T{sc_bv<T::_size>{(char*)raw.data()}};
+        }
+        catch (std::runtime_error&)
+        {
+            continue;
+        }
+        checked++;
+        if (!same(s, VIEW(T, raw.data())))
+        {
+            fprintf(stderr, "BitView: %s differs from sc_bv\n", name);
+            return false;
+        }
+    }
+    if (checked < 1000)
+    {
+        fprintf(stderr, "BitView: only %zu valid random values of %s\n", checked, name);
+        return false;
+    }
+    return true;
+}
+
+#define SAME(field) (static_cast<uint64_t>(s.field) == FIELD(v, field))
+#define CHECK_VIEW(T, fields) ok &= CheckView<T>(#T, [](const T& s, BitView<T> v) { return fields; })
+
+static bool TestBitView()
+{
+    bool ok = true;
+    CHECK_VIEW(BPBackup, SAME(pred) && SAME(predOffs) && SAME(predTaken) && SAME(isRegularBranch) && SAME(rIdx) &&
+                             SAME(history) && SAME(altPred) && SAME(tageID));
+    CHECK_VIEW(BranchProv, SAME(taken) && SAME(fetchID) && SAME(flush) && SAME(loadSqN) && SAME(storeSqN) &&
+                               SAME(sqN) && SAME(dstPC) && SAME(fetchOffs) && SAME(isSCFail) && SAME(cause));
+    CHECK_VIEW(CommitUOp, SAME(valid) && SAME(compressed) && SAME(branchTaken) && SAME(isBranch) && SAME(sqN) &&
+                              SAME(tagDst) && SAME(rd));
+    CHECK_VIEW(D_UOp, SAME(valid) && SAME(compressed) && SAME(fetchOffs) && SAME(fetchID) && SAME(fu) &&
+                          SAME(opcode) && SAME(rd) && SAME(immB) && SAME(imm));
+    CHECK_VIEW(EX_UOp, SAME(valid) && SAME(compressed) && SAME(fu) && SAME(loadSqN) && SAME(storeSqN) &&
+                           SAME(fetchID) && SAME(sqN) && SAME(tagDst) && SAME(opcode) && SAME(imm) &&
+                           SAME(fetchPredOffs) && SAME(fetchStartOffs) && SAME(fetchOffs) && SAME(pc) && SAME(srcB) &&
+                           SAME(srcA));
+    CHECK_VIEW(FlagsUOp, SAME(valid) && SAME(doNotCommit) && SAME(flags) && SAME(sqN) && SAME(tagDst));
+    CHECK_VIEW(IS_UOp, SAME(valid) && SAME(compressed) && SAME(fu) && SAME(loadSqN) && SAME(storeSqN) &&
+                           SAME(fetchOffs) && SAME(fetchID) && SAME(opcode) && SAME(tagDst) && SAME(sqN) &&
+                           SAME(immB) && SAME(tagB) && SAME(availB) && SAME(tagA) && SAME(availA) && SAME(imm));
+    CHECK_VIEW(LD_Ack, SAME(valid) && SAME(external) && SAME(doNotReIssue) && SAME(fail) && SAME(loadSqN) &&
+                           SAME(addr));
+    CHECK_VIEW(PD_Instr, SAME(valid) && SAME(fetchFault) && SAME(fetchID) && SAME(predTaken) && SAME(predTarget) &&
+                             SAME(fetchPredOffs) && SAME(fetchStartOffs) && SAME(pc) && SAME(instr));
+    CHECK_VIEW(R_UOp, SAME(valid) && SAME(validIQ) && SAME(compressed) && SAME(fu) && SAME(loadSqN) &&
+                          SAME(storeSqN) && SAME(fetchOffs) && SAME(fetchID) && SAME(opcode) && SAME(rd) &&
+                          SAME(tagDst) && SAME(sqN) && SAME(tagC) && SAME(availC) && SAME(immB) && SAME(tagB) &&
+                          SAME(availB) && SAME(tagA) && SAME(availA) && SAME(imm));
+    CHECK_VIEW(ResultUOp, SAME(valid) && SAME(doNotCommit) && SAME(tagDst) && SAME(result));
+    CHECK_VIEW(Trap_UOp, SAME(valid) && SAME(compressed) && SAME(fetchID) && SAME(fetchOffs) && SAME(rd) &&
+                             SAME(storeSqN) && SAME(loadSqN) && SAME(sqN) && SAME(tag) && SAME(flags) &&
+                             SAME(timeout));
+    CHECK_VIEW(Occupancy, SAME(count) && SAME(size));
+    return ok;
+}
+
+// Random data with runs of all lengths around the RLE limits, mixed with literals.
+static std::vector<uint8_t> RandomRuns(std::mt19937_64& rng, size_t len)
+{
+    std::vector<uint8_t> data;
+    while (data.size() < len)
+    {
+        size_t run = rng() % 300;
+        uint8_t val = (rng() % 4) ? 0 : rng();
+        if (rng() % 2)
+            data.insert(data.end(), run, val);
+        else
+            for (size_t i = 0; i < run % 8; i++)
+                data.push_back(rng());
+    }
+    data.resize(len);
+    return data;
+}
+
+static bool TestRLE()
+{
+    std::mt19937_64 rng(2);
+    for (int i = 0; i < 2000; i++)
+    {
+        auto data = RandomRuns(rng, rng() % 5000);
+        std::vector<uint8_t> comp;
+        RLECompress(data.data(), data.size(), comp);
+
+        std::vector<uint8_t> out(data.size());
+        if (!RLEDecompress(comp.data(), comp.size(), out.data(), out.size()) || out != data)
+        {
+            fprintf(stderr, "RLE: round trip of %zu bytes failed\n", data.size());
+            return false;
+        }
+        // Output of the wrong size must be rejected
+        out.resize(data.size() + 1);
+        if (RLEDecompress(comp.data(), comp.size(), out.data(), out.size()))
+        {
+            fprintf(stderr, "RLE: accepted output buffer of wrong size\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Write a full checkpoint followed by incremental ones while randomly modifying memory and
+// blobs, and check that loading each chain reproduces the state at the time it was written.
+static bool TestCheckpointChain()
+{
+    TempDir dir;
+    std::mt19937_64 rng(3);
+    SparseMemory mem(0x80000000, 1 << 20);
+    std::map<uint32_t, std::vector<uint8_t>> blobs;
+    const size_t pageCount = mem.size / SparseMemory::PAGE_SIZE;
+
+    std::string parent;
+    for (uint32_t seq = 0; seq < 16; seq++)
+    {
+        // Occasionally free all pages, so the next checkpoint has to record freed pages
+        if (seq % 5 == 4)
+            mem.clear();
+        for (int i = rng() % 16; i >= 0; i--)
+        {
+            uint32_t addr = mem.base + (rng() % pageCount) * SparseMemory::PAGE_SIZE + rng() % SparseMemory::PAGE_SIZE;
+            auto data = RandomRuns(rng, rng() % 6000);
+            if (mem.contains(addr, data.size()))
+                mem.write(addr, data.data(), data.size());
+        }
+        if (seq == 0 || rng() % 2)
+            blobs[CKPT_MODEL] = RandomRuns(rng, rng() % 20000);
+        if (seq == 0 || rng() % 4 == 0)
+            blobs[CKPT_COSIM] = RandomRuns(rng, rng() % 100);
+
+        std::string name = "chain-" + std::to_string(seq) + ".backup";
+        {
+            CheckpointWriter writer(dir.file(name), seq, parent);
+            for (auto& [tag, blob] : blobs)
+                writer.add_blob(tag, blob);
+            writer.add_pages(CKPT_MEM, mem, seq == 0);
+        }
+        parent = name;
+
+        Checkpoint ckpt = Checkpoint::load_chain(dir.path + "/" + name);
+        SparseMemory restored(mem.base, mem.size);
+        ckpt.restore_pages(CKPT_MEM, restored);
+        if (ckpt.seq != seq || ckpt.blobs != blobs)
+        {
+            fprintf(stderr, "Checkpoint: blobs of %s differ\n", name.c_str());
+            return false;
+        }
+        for (size_t i = 0; i < pageCount; i++)
+        {
+            const uint8_t* expected = mem.page_at(i);
+            const uint8_t* actual = restored.page_at(i);
+            if ((expected == nullptr) != (actual == nullptr) ||
+                (expected && memcmp(expected, actual, SparseMemory::PAGE_SIZE) != 0))
+            {
+                fprintf(stderr, "Checkpoint: page %zu of %s differs\n", i, name.c_str());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static GoldenEntry RandomGoldenEntry(std::mt19937_64& rng, uint32_t nextPC)
+{
+    GoldenEntry e = {};
+    e.flags = rng() & (GOLD_RVC | GOLD_RD | GOLD_NONDET | GOLD_TRAP);
+    if (rng() % 20 == 0)
+        e.flags = GOLD_INTERRUPT;
+    // Mostly sequential, so the implicit PC is exercised
+    e.pc = (nextPC != 0 && rng() % 8) ? nextPC : (rng() & ~1);
+    if (!(e.flags & GOLD_INTERRUPT))
+        e.inst = (e.flags & GOLD_RVC) ? (rng() & 0xFFFF) : rng();
+    e.rd = rng() % 32;
+    e.value = rng();
+    e.cause = rng();
+    e.numLoads = rng() % (GoldenEntry::MAX_ACCESSES + 1);
+    e.numStores = rng() % (GoldenEntry::MAX_ACCESSES + 1);
+    for (size_t i = 0; i < GoldenEntry::MAX_ACCESSES; i++)
+    {
+        e.loads[i] = {(uint32_t)rng(), 0, (uint8_t)(1 << (rng() % 3))};
+        e.stores[i] = {(uint32_t)rng(), (uint32_t)rng(), (uint8_t)(1 << (rng() % 3))};
+    }
+    return e;
+}
+
+static bool SameGoldenEntry(const GoldenEntry& a, const GoldenEntry& b)
+{
+    // The writer adds these flags as needed
+    const uint8_t implicit = GOLD_PC | GOLD_LOADS | GOLD_STORES;
+    if ((a.flags & ~implicit) != (b.flags & ~implicit) || a.pc != b.pc || a.inst != b.inst ||
+        a.numLoads != b.numLoads || a.numStores != b.numStores)
+        return false;
+    if ((a.flags & GOLD_RD) && (a.rd != b.rd || a.value != b.value))
+        return false;
+    if ((a.flags & GOLD_TRAP) && a.cause != b.cause)
+        return false;
+    for (size_t i = 0; i < a.numLoads; i++)
+        if (a.loads[i].addr != b.loads[i].addr || a.loads[i].size != b.loads[i].size)
+            return false;
+    for (size_t i = 0; i < a.numStores; i++)
+        if (a.stores[i].addr != b.stores[i].addr || a.stores[i].data != b.stores[i].data ||
+            a.stores[i].size != b.stores[i].size)
+            return false;
+    return true;
+}
+
+static bool TestGoldenLog()
+{
+    TempDir dir;
+    std::string path = dir.file("golden.log");
+    std::mt19937_64 rng(4);
+    std::vector<GoldenEntry> entries;
+    {
+        GoldenLogWriter writer(path);
+        uint32_t nextPC = 0;
+        for (int i = 0; i < 100000; i++)
+        {
+            entries.push_back(RandomGoldenEntry(rng, nextPC));
+            writer.add(entries.back());
+            const GoldenEntry& e = entries.back();
+            nextPC = (e.flags & (GOLD_TRAP | GOLD_INTERRUPT)) ? 0 : e.next_pc();
+        }
+    }
+
+    GoldenLogReader reader(path);
+    GoldenEntry e;
+    for (size_t i = 0; i < entries.size(); i++)
+        if (!reader.next(e) || !SameGoldenEntry(entries[i], e))
+        {
+            fprintf(stderr, "GoldenLog: entry %zu differs\n", i);
+            return false;
+        }
+    if (reader.next(e))
+    {
+        fprintf(stderr, "GoldenLog: entries past the end\n");
+        return false;
+    }
+    return true;
+}
+
+// Log random events, including IDs going backwards, merged cycles and over-long labels,
+// across many chunks, and check that the reader returns them unchanged.
+static bool CheckKonataTrace(KonataWriter& writer, std::string path, bool compress, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<KonataReader::Event> events;
+    writer.open(path, compress);
+    uint32_t id = 0;
+    for (int i = 0; i < 200000; i++)
+    {
+        KonataReader::Event e = {};
+        e.type = (KonataEvent)(rng() % (KEV_LABEL + 1));
+        if (e.type == KEV_CYCLE)
+        {
+            uint64_t n = (rng() % 8) ? 1 : rng();
+            writer.cycle(n);
+            if (!events.empty() && events.back().type == KEV_CYCLE)
+                events.back().args[0] += n;
+            else
+            {
+                e.args[0] = n;
+                events.push_back(e);
+            }
+            continue;
+        }
+
+        id += (rng() % 4) ? rng() % 8 : rng();
+        e.id = id;
+        for (auto& arg : e.args)
+            arg = (uint32_t)rng();
+        switch (e.type)
+        {
+            case KEV_INSERT: writer.insert(id, e.args[0]); break;
+            case KEV_INST:
+                e.args[0] = rng();
+                writer.inst(id, e.args[0], e.args[1], e.args[2]);
+                break;
+            case KEV_STAGE:
+                e.args[0] %= NUM_KST;
+                writer.stage(id, (KonataStage)e.args[0]);
+                break;
+            case KEV_RETIRE: writer.retire(id, e.args[0]); break;
+            case KEV_FLUSH: writer.flush_inst(id); break;
+            case KEV_RESULT: writer.result(id, e.args[0]); break;
+            case KEV_OPERANDS: writer.operands(id, e.args[0], e.args[1], e.args[2]); break;
+            case KEV_LABEL:
+            {
+                std::string text(rng() % 300, ' ');
+                for (auto& c : text)
+                    c = 'a' + rng() % 26;
+                writer.label(id, e.args[0], text.c_str());
+                e.text = text.substr(0, 256);
+                e.args[1] = e.text.size();
+                break;
+            }
+            default: abort();
+        }
+        events.push_back(e);
+        if (i % 50000 == 0)
+            writer.flush();
+    }
+    writer.close();
+
+    static const size_t NUM_ARGS[] = {1, 1, 3, 1, 1, 0, 1, 3, 2};
+    KonataReader reader(path);
+    KonataReader::Event e;
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const auto& expected = events[i];
+        bool same = reader.next(e) && e.type == expected.type &&
+                    (e.type == KEV_CYCLE || e.id == expected.id) &&
+                    std::equal(expected.args, expected.args + NUM_ARGS[e.type], e.args) &&
+                    (e.type != KEV_LABEL || e.text == expected.text);
+        if (!same)
+        {
+            fprintf(stderr, "Konata: event %zu differs (%s)\n", i, compress ? "compressed" : "uncompressed");
+            return false;
+        }
+    }
+    if (reader.next(e))
+    {
+        fprintf(stderr, "Konata: events past the end\n");
+        return false;
+    }
+    return true;
+}
+
+static bool TestKonataTrace()
+{
+    TempDir dir;
+    // Reopening a closed writer reuses its chunk pool
+    KonataWriter writer;
+    return CheckKonataTrace(writer, dir.file("trace.bin"), false, 5) &&
+           CheckKonataTrace(writer, dir.file("trace.bin.gz"), true, 6);
+}
+
+int main()
+{
+    struct Test
+    {
+        const char* name;
+        bool (*run)();
+    };
+    const Test tests[] = {
+        {"bitview", TestBitView},
+        {"rle", TestRLE},
+        {"checkpoint", TestCheckpointChain},
+        {"goldenlog", TestGoldenLog},
+        {"konata", TestKonataTrace},
+    };
+
+    bool ok = true;
+    for (auto& t : tests)
+    {
+        bool passed = t.run();
+        printf("%-12s %s\n", t.name, passed ? "passed" : "FAILED");
+        ok &= passed;
+    }
+    return ok ? 0 : -1;
+}
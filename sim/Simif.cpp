@@ -2,15 +2,35 @@
 #include "TopWrapper.hpp"
 #include "Debug.hpp"
 
-bool SpikeSimif::compare_state()
+bool SpikeSimif::compare_state(const CosimRecord& rec)
 {
-    for (size_t i = 0; i < 32; i++)
-        if ((uint32_t)processor->get_state()->XPR[i] != registers.ReadRegister(i))
+    auto& XPR = processor->get_state()->XPR;
+    if (rec.check == CHECK_FULL)
+    {
+        for (size_t i = 0; i < 32; i++)
+            if ((uint32_t)XPR[i] != rec.regs[i])
+            {
+                printf("mismatch x%zu\n", i);
+                return false;
+            }
+        return true;
+    }
+
+    // Spike must not have written a GPR other than the RTL's destination
+    for (auto& write : processor->get_state()->log_reg_write)
+    {
+        size_t reg = write.first >> 4;
+        if ((write.first & 0xf) == 0 && reg != 0 && reg != rec.inst.rd)
         {
-            printf("mismatch x%zu\n", i);
+            printf("mismatch x%zu (not written)\n", reg);
             return false;
         }
-
+    }
+    if ((uint32_t)XPR[rec.inst.rd] != rec.regs[rec.inst.rd])
+    {
+        printf("mismatch x%u\n", rec.inst.rd);
+        return false;
+    }
     return true;
 }
 bool SpikeSimif::is_pass_thru_inst(const Inst& i)
@@ -65,8 +85,8 @@ bool SpikeSimif::is_pass_thru_inst(const Inst& i)
 
     return false;
 }
-SpikeSimif::SpikeSimif(std::vector<uint32_t>& pram, Registers& registers, uint64_t& main_time)
-    : pram(pram), main_time(main_time), registers(registers)
+SpikeSimif::SpikeSimif(SparseMemory& pmem, Registers& registers, uint64_t& main_time)
+    : pmem(pmem), main_time(main_time), registers(registers)
 {
     cfg = new cfg_t(std::make_pair(0, 0), "", "rv32i", "M", DEFAULT_VARCH, false, endianness_little, 0,
                     {mem_cfg_t(0x80000000, 1 << 26)}, {0}, false, 0);
@@ -100,15 +120,19 @@ SpikeSimif::SpikeSimif(std::vector<uint32_t>& pram, Registers& registers, uint64
 }
 char* SpikeSimif::addr_to_mem(reg_t addr)
 {
-    if (addr >= 0x80000000 && addr < (0x80000000 + pram.size() * sizeof(uint32_t)))
-        return (char*)pram.data() + (addr - 0x80000000);
+    // Spike's MMU caches host pointers per page, so handing out pointers into a single page is fine.
+    if (pmem.contains(addr))
+        return (char*)pmem.get_ptr(addr);
     return nullptr;
 }
 bool SpikeSimif::mmio_load(reg_t addr, size_t len, uint8_t* bytes)
 {
     if (addr >= 0x10000000 && addr < 0x12000000)
     {
+        mmioLoad = true;
         memset(bytes, 0, len);
+        if (functional)
+            functional_mmio_load(addr, len, bytes);
         return true;
     }
     return false;
@@ -117,10 +141,56 @@ bool SpikeSimif::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
 {
     if (addr >= 0x10000000 && addr < 0x12000000)
     {
+        if (functional)
+            functional_mmio_store(addr, len, bytes);
         return true;
     }
     return false;
 }
+
+// Addresses as in src/Config.sv and src/ExternalAXISim.sv
+static const reg_t SERIAL_ADDR = 0x10000000;
+static const reg_t SYSCON_ADDR = 0x11100000;
+static const reg_t MTIME_ADDR = 0x1100bff8;
+static const reg_t MTIMECMP_ADDR = 0x11004000;
+
+void SpikeSimif::functional_mmio_load(reg_t addr, size_t len, uint8_t* bytes)
+{
+    auto read = [&](uint64_t reg, reg_t base) {
+        if (addr >= base && addr + len <= base + sizeof(reg))
+            memcpy(bytes, (uint8_t*)&reg + (addr - base), len);
+    };
+    read(mtime, MTIME_ADDR);
+    read(mtimecmp, MTIMECMP_ADDR);
+
+    // No console input while fast-forwarding, only report the transmitter as empty.
+    if (addr == SERIAL_ADDR + 5)
+        bytes[0] = 0x60;
+}
+void SpikeSimif::functional_mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
+{
+    auto write = [&](uint64_t& reg, reg_t base) {
+        if (addr >= base && addr + len <= base + sizeof(reg))
+            memcpy((uint8_t*)&reg + (addr - base), bytes, len);
+    };
+    write(mtime, MTIME_ADDR);
+    write(mtimecmp, MTIMECMP_ADDR);
+
+    if (addr == SERIAL_ADDR)
+    {
+        putchar(bytes[0]);
+        fflush(stdout);
+    }
+    if (addr == SYSCON_ADDR && (bytes[0] == 0x55 || bytes[0] == 0x77))
+        functionalHalt = true;
+}
+void SpikeSimif::functional_tick(uint64_t cycles)
+{
+    mtime += cycles;
+    timeCSR->write(mtime & 0xFFFFFFFF);
+    timehCSR->write(mtime >> 32);
+    processor->get_state()->mip->backdoor_write_with_mask(MIP_MTIP, mtime >= mtimecmp ? MIP_MTIP : 0);
+}
 uint32_t SpikeSimif::get_phy_addr(uint32_t addr, access_type type)
 {
     try
@@ -138,82 +208,72 @@ void SpikeSimif::write_reg(int i, uint32_t data)
     // this NEEDS to be sign-extended!
     processor->get_state()->XPR.write(i, (int32_t)data);
 }
-int SpikeSimif::cosim_instr(const Inst& inst)
+int SpikeSimif::cosim_instr(const CosimRecord& rec)
 {
-    if (main_time > DEBUG_TIME)
+    const Inst& inst = rec.inst;
+    if (rec.time > DEBUG_TIME)
         processor->set_debug(true);
     uint32_t initialSpikePC = get_pc();
-    uint32_t instSIM;
+    uint32_t instSIM = 0;
     bool fetchFault = 0;
-    try
-    {
-        instSIM = processor->get_mmu()->load_insn(initialSpikePC).insn.bits();
-    }
-    catch (mem_trap_t)
+    if (rec.check >= CHECK_PC)
     {
-        instSIM = 0;
-        fetchFault = 1;
+        try
+        {
+            instSIM = processor->get_mmu()->load_insn(initialSpikePC).insn.bits();
+        }
+        catch (mem_trap_t)
+        {
+            fetchFault = 1;
+        }
     }
 
     // failed sc.w
-    if (((instSIM & 0b11111'00'00000'00000'111'00000'1111111) == 0b00011'00'00000'00000'010'00000'0101111) &&
-        registers.ReadRegister(inst.rd) != 0)
+    if (is_store_conditional(inst.inst) && rec.regs[inst.rd] != 0)
     {
         processor->get_mmu()->yield_load_reservation();
     }
 
     bool modelsPass = 1;
-    for (auto& model : models)
-        modelsPass &= model->PreInst(inst);
+    if (checkModels)
+        for (auto& model : models)
+            modelsPass &= model->PreInst(inst);
 
+    mmioLoad = false;
     processor->step(1);
 
-    for (auto& model : models)
-        modelsPass &= model->PostInst(inst);
+    if (checkModels)
+        for (auto& model : models)
+            modelsPass &= model->PostInst(inst);
 
     // interrupts are handled by SoomRV
     processor->clear_waiting_for_interrupt();
 
-    // TODO: Use this for adjusting WARL behavior
-    auto writes = processor->get_state()->log_reg_write;
-    bool gprWritten = false;
-    for (auto write : writes) {}
+    // MMIO loads are passed through (detected by mmio_load, without translating addresses here)
+    if (processor->debug)
+        for (auto read : processor->get_state()->log_mem_read)
+            fprintf(stderr, "%.8x -> %.8x\n", (uint32_t)std::get<0>(read), get_phy_addr(std::get<0>(read), LOAD));
 
-    bool mem_pass_thru = false;
-    auto mem_reads = processor->get_state()->log_mem_read;
-    for (auto read : mem_reads)
-    {
-        uint32_t phy = get_phy_addr(std::get<0>(read), LOAD);
-        if (processor->debug)
-            fprintf(stderr, "%.8x -> %.8x\n", (uint32_t)std::get<0>(read), phy);
-
-
-        phy &= ~3;
-        // MMIO is passed through
-        if (phy >= 0x10000000 && phy < 0x12000000)
-            mem_pass_thru = true;
-    }
-
-    bool writeValid = true;
-    for (auto write : processor->get_state()->log_mem_write)
-    {
-        uint32_t phy = get_phy_addr(std::get<0>(write), STORE);
-        if (processor->debug)
-            fprintf(stderr, "%.8x -> %.8x\n", (uint32_t)std::get<0>(write), phy);
-
-        if (riscvTestMode)
+    if (riscvTestMode || processor->debug)
+        for (auto write : processor->get_state()->log_mem_write)
         {
-            if (phy == 0x80001000 || phy == 0x80003000)
-                riscvTestReturn = std::get<1>(write);
-            else if ((phy == 0x80001004 || phy == 0x80003004) && (int)std::get<1>(write) == 0)
-                return 1;
+            uint32_t phy = get_phy_addr(std::get<0>(write), STORE);
+            if (processor->debug)
+                fprintf(stderr, "%.8x -> %.8x\n", (uint32_t)std::get<0>(write), phy);
+
+            if (riscvTestMode)
+            {
+                if (phy == 0x80001000 || phy == 0x80003000)
+                    riscvTestReturn = std::get<1>(write);
+                else if ((phy == 0x80001004 || phy == 0x80003004) && (int)std::get<1>(write) == 0)
+                    return 1;
+            }
+            // if (phy >= 0x80000000)
+            //     inFlightStores.push_back((Store){
+            //         .addr = phy, .data = (uint32_t)std::get<1>(write), .size = std::get<2>(write), .time = main_time});
         }
-        // if (phy >= 0x80000000)
-        //     inFlightStores.push_back((Store){
-        //         .addr = phy, .data = (uint32_t)std::get<1>(write), .size = std::get<2>(write), .time = main_time});
-    }
 
-    if ((mem_pass_thru || is_pass_thru_inst(inst)) && inst.rd != 0 && inst.flags < 6)
+    if ((mmioLoad || is_pass_thru_inst(inst)) && inst.rd != 0 && inst.flags < 6)
     {
         write_reg(inst.rd, inst.result);
     }
@@ -223,14 +283,16 @@ int SpikeSimif::cosim_instr(const Inst& inst)
         take_trap(true, inst.interruptCause, processor->get_state()->pc, inst.interruptDelegate);
     }
 
+    if (rec.check == CHECK_NONE)
+        return 0;
     bool instrEqual = ((instSIM & 3) == 3) ? instSIM == inst.inst : (instSIM & 0xFFFF) == (inst.inst & 0xFFFF);
     if (inst.pc != initialSpikePC)
         return -1;
     if (!instrEqual && !fetchFault)
         return -2;
-    if (!writeValid)
-        return -3;
-    if (!compare_state())
+    if (rec.check == CHECK_PC)
+        return 0;
+    if (!compare_state(rec))
         return -4;
     if (!modelsPass)
         return -5;
@@ -317,3 +379,128 @@ void SpikeSimif::restore_from_top(TopWrapper& wrap, Inst& inst)
 
     processor->set_privilege(csr->__PVT__priv, false);
 }
+uint64_t SpikeSimif::fast_forward(uint64_t instret, uint32_t stopPC, std::function<void(uint32_t)> onCommit)
+{
+    // Step in batches if we don't need to check the PC after every instruction.
+    const uint64_t BATCH_SIZE = 256;
+
+    auto state = processor->get_state();
+    uint64_t startInstret = state->minstret->read();
+
+    functional = true;
+    functional_tick(0);
+    while (!functionalHalt)
+    {
+        uint64_t curInstret = state->minstret->read();
+        if (curInstret >= instret)
+            break;
+        if (stopPC != 0 && (uint32_t)state->pc == stopPC)
+            break;
+
+        // Nothing will happen until the next timer interrupt, skip ahead.
+        if (processor->is_waiting_for_interrupt())
+        {
+            if (mtimecmp > mtime)
+                functional_tick(mtimecmp - mtime);
+            processor->clear_waiting_for_interrupt();
+        }
+
+        uint64_t n = (stopPC != 0 || onCommit) ? 1 : std::min(instret - curInstret, BATCH_SIZE);
+        if (onCommit)
+            onCommit(state->pc);
+        processor->step(n);
+        functional_tick(n);
+    }
+    functional = false;
+
+    // From here on, interrupts are handled by SoomRV again.
+    state->mip->backdoor_write_with_mask(MIP_MTIP, 0);
+
+    return state->minstret->read() - startInstret;
+}
+void SpikeSimif::restore_to_top(TopWrapper& wrap)
+{
+    // Inverse of restore_from_top. Only call this right after reset,
+    // the RTL must not have any instructions in flight.
+    auto state = processor->get_state();
+
+    for (size_t i = 1; i < 32; i++)
+        registers.WriteRegister(i, state->XPR[i]);
+
+    auto csr = wrap.csr;
+    csr->minstret = state->minstret->read();
+    csr->mcycle = state->mcycle->read();
+
+    csr->__PVT__mstatus = processor->get_csr(CSR_MSTATUS);
+    csr->__PVT__mcounteren = processor->get_csr(CSR_MCOUNTEREN);
+    csr->__PVT__mcountinhibit = processor->get_csr(CSR_MCOUNTINHIBIT);
+    csr->__PVT__mtvec = processor->get_csr(CSR_MTVEC);
+    csr->__PVT__medeleg = processor->get_csr(CSR_MEDELEG);
+    csr->__PVT__mideleg = processor->get_csr(CSR_MIDELEG);
+
+    csr->__PVT__mip = processor->get_csr(CSR_MIP) & ~MIP_MTIP;
+    csr->__PVT__mie = processor->get_csr(CSR_MIE);
+    csr->__PVT__mscratch = processor->get_csr(CSR_MSCRATCH);
+    csr->__PVT__mepc = processor->get_csr(CSR_MEPC);
+    csr->__PVT__mcause = processor->get_csr(CSR_MCAUSE);
+    csr->__PVT__mtval = processor->get_csr(CSR_MTVAL);
+    csr->__PVT__menvcfg = processor->get_csr(CSR_MENVCFG);
+    csr->__PVT__scounteren = processor->get_csr(CSR_SCOUNTEREN);
+    csr->__PVT__sepc = processor->get_csr(CSR_SEPC);
+    csr->__PVT__sscratch = processor->get_csr(CSR_SSCRATCH);
+    csr->__PVT__stval = processor->get_csr(CSR_STVAL);
+    csr->__PVT__stvec = processor->get_csr(CSR_STVEC);
+    csr->__PVT__satp = processor->get_csr(CSR_SATP);
+    csr->__PVT__senvcfg = processor->get_csr(CSR_SENVCFG);
+    csr->__PVT__scause = processor->get_csr(CSR_SCAUSE);
+
+    csr->__PVT__priv = state->prv;
+
+    auto aclint = wrap.top->Top->soc->mmio->aclint;
+    aclint->mtime = mtime;
+    aclint->mtimecmp = mtimecmp;
+
+    // IFetch is still in its post-reset wait, so it will start fetching at this PC.
+    wrap.core->ifetch->bp->__PVT__pcReg = (uint32_t)state->pc >> 1;
+}
+// CSRs that make up ArchState, in order
+static const int ARCH_CSRS[ArchState::NUM_CSRS] = {
+    CSR_MSTATUS, CSR_MCOUNTEREN, CSR_MCOUNTINHIBIT, CSR_MTVEC, CSR_MEDELEG, CSR_MIDELEG,  CSR_MIP,
+    CSR_MIE,     CSR_MSCRATCH,   CSR_MEPC,          CSR_MCAUSE, CSR_MTVAL,  CSR_MENVCFG,  CSR_SCOUNTEREN,
+    CSR_SEPC,    CSR_SSCRATCH,   CSR_STVAL,         CSR_STVEC,  CSR_SATP,   CSR_SENVCFG,  CSR_SCAUSE,
+};
+ArchState SpikeSimif::save_arch()
+{
+    auto state = processor->get_state();
+
+    ArchState arch;
+    arch.pc = state->pc;
+    arch.priv = state->prv;
+    for (size_t i = 0; i < 32; i++)
+        arch.xpr[i] = state->XPR[i];
+    for (size_t i = 0; i < ArchState::NUM_CSRS; i++)
+        arch.csrs[i] = processor->get_csr(ARCH_CSRS[i]);
+    arch.minstret = state->minstret->read();
+    arch.mcycle = state->mcycle->read();
+    arch.mtime = mtime;
+    arch.mtimecmp = mtimecmp;
+    return arch;
+}
+void SpikeSimif::restore_arch(const ArchState& arch)
+{
+    processor->get_state()->pc = arch.pc;
+    for (size_t i = 0; i < 32; i++)
+        write_reg(i, arch.xpr[i]);
+    for (size_t i = 0; i < ArchState::NUM_CSRS; i++)
+        processor->put_csr(ARCH_CSRS[i], arch.csrs[i]);
+
+    // Same off-by-one as in restore_from_top, Spike decrements instret on write.
+    processor->put_csr(CSR_INSTRET, (arch.minstret + 1) & 0xFFFFFFFF);
+    processor->put_csr(CSR_INSTRETH, (arch.minstret + 1) >> 32);
+    processor->put_csr(CSR_MCYCLE, arch.mcycle & 0xFFFFFFFF);
+    processor->put_csr(CSR_MCYCLEH, arch.mcycle >> 32);
+
+    processor->set_privilege(arch.priv, false);
+    mtime = arch.mtime;
+    mtimecmp = arch.mtimecmp;
+}
@@ -2,6 +2,7 @@
 
 #include "Inst.hpp"
 #include "Registers.hpp"
+#include "SparseMemory.hpp"
 #include "TopWrapper.hpp"
 #include "models/Model.hpp"
 
@@ -16,15 +17,66 @@
 #include "riscv/processor.h"
 #include "riscv/simif.h"
 #include "riscv/trap.h"
+#include <functional>
+
+// Architectural state, enough to resume from a functional checkpoint
+struct ArchState
+{
+    static constexpr size_t NUM_CSRS = 21;
+
+    uint32_t pc;
+    uint32_t priv;
+    uint32_t xpr[32];
+    uint32_t csrs[NUM_CSRS];
+    uint64_t minstret;
+    uint64_t mcycle;
+    uint64_t mtime;
+    uint64_t mtimecmp;
+};
+
+// What cosim compares for an instruction. Spike steps every instruction regardless.
+enum CosimCheck : uint8_t
+{
+    // Nothing, Spike only follows the RTL
+    CHECK_NONE,
+    // PC and instruction
+    CHECK_PC,
+    // Also destination register, instret and models
+    CHECK_DEST,
+    // Also all other registers
+    CHECK_FULL,
+};
+
+// Everything cosim needs to check a committed instruction, captured when it commits,
+// so that the check itself can run later on another thread.
+struct CosimRecord
+{
+    Inst inst;
+    uint64_t time;
+    CosimCheck check;
+    // Architectural registers of the RTL after the instruction. With CHECK_FULL, all are valid,
+    // otherwise only regs[inst.rd] (for CHECK_DEST and store conditionals).
+    uint32_t regs[32];
+};
 
 class SpikeSimif : public simif_t
 {
   public:
     bool doRestore = false;
     bool riscvTestMode = false;
+    // In functional mode (fast-forward), Spike runs on its own and models
+    // the UART, ACLINT and SysCon instead of deferring to the RTL.
+    bool functional = false;
+    bool functionalHalt = false;
+    uint64_t mtime = 0;
+    uint64_t mtimecmp = 0;
     int riscvTestReturn = 0;
+    // Models follow every instruction, so they are either always or never checked
+    bool checkModels = true;
+    // Set by mmio_load, RTL values of MMIO loads are passed through
+    bool mmioLoad = false;
     std::vector<Model*> models;
-    std::vector<uint32_t>& pram;
+    SparseMemory& pmem;
     uint64_t& main_time;
     Registers& registers;
 
@@ -36,15 +88,19 @@ class SpikeSimif : public simif_t
     cfg_t* cfg;
     std::map<size_t, processor_t*> harts;
 
-    bool compare_state();
+    bool compare_state(const CosimRecord& rec);
 
     static bool is_pass_thru_inst(const Inst& i);
+    static bool is_store_conditional(uint32_t instr)
+    {
+        return (instr & 0b11111'00'00000'00000'111'00000'1111111) == 0b00011'00'00000'00000'010'00000'0101111;
+    }
 
     std::shared_ptr<basic_csr_t> timeCSR;
     std::shared_ptr<basic_csr_t> timehCSR;
 
   public:
-    SpikeSimif(std::vector<uint32_t>& pram, Registers& registers, uint64_t& main_time);
+    SpikeSimif(SparseMemory& pmem, Registers& registers, uint64_t& main_time);
 
     virtual char* addr_to_mem(reg_t addr) override;
     virtual bool reservable(reg_t addr) override
@@ -69,7 +125,7 @@ class SpikeSimif : public simif_t
 
     void write_reg(int i, uint32_t data);
 
-    virtual int cosim_instr(const Inst& inst);
+    virtual int cosim_instr(const CosimRecord& rec);
 
     const std::map<size_t, processor_t*>& get_harts() const override
     {
@@ -91,4 +147,14 @@ class SpikeSimif : public simif_t
     }
 
     void restore_from_top(TopWrapper& wrap, Inst& inst);
+
+    uint64_t fast_forward(uint64_t instret, uint32_t stopPC, std::function<void(uint32_t)> onCommit = nullptr);
+    void restore_to_top(TopWrapper& wrap);
+
+    ArchState save_arch();
+    void restore_arch(const ArchState& arch);
+
+    void functional_tick(uint64_t cycles);
+    void functional_mmio_load(reg_t addr, size_t len, uint8_t* bytes);
+    void functional_mmio_store(reg_t addr, size_t len, const uint8_t* bytes);
 };
@@ -0,0 +1,220 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Sparse physical memory with page granularity. Pages are only allocated once written,
+// so memory footprint and setup time scale with the memory the program actually touches.
+// Reads from untouched pages return zero.
+// Pages that are handed out for writing are marked dirty, which allows incremental checkpoints.
+// Dirty bits are kept separately for checkpoints and for in-memory snapshots, which are
+// taken at different times.
+class SparseMemory
+{
+  public:
+    enum DirtySet : uint8_t
+    {
+        DIRTY_CHECKPOINT = 1,
+        DIRTY_SNAPSHOT = 2,
+        DIRTY_ALL = 3,
+    };
+
+    static constexpr size_t PAGE_BITS = 12;
+    static constexpr size_t PAGE_SIZE = 1 << PAGE_BITS;
+    using Page = std::array<uint8_t, PAGE_SIZE>;
+
+    const uint32_t base;
+    const size_t size;
+
+    SparseMemory(uint32_t base = 0x80000000, size_t size = 1 << 28) : base(base), size(size), pages(size / PAGE_SIZE), dirty(size / PAGE_SIZE)
+    {
+    }
+
+    SparseMemory(const SparseMemory& other) : base(other.base), size(other.size), pages(other.pages.size()), dirty(other.dirty.size())
+    {
+        *this = other;
+    }
+
+    SparseMemory& operator=(const SparseMemory& other)
+    {
+        if (this == &other)
+            return *this;
+        if (other.size != size || other.base != base)
+            abort();
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            if (!other.pages[i] && !pages[i])
+                continue;
+            dirty[i] = DIRTY_ALL;
+            if (!other.pages[i])
+                pages[i].reset();
+            else if (!pages[i])
+                pages[i] = std::make_unique<Page>(*other.pages[i]);
+            else
+                *pages[i] = *other.pages[i];
+        }
+        return *this;
+    }
+
+    bool contains(uint32_t addr, size_t len = 1) const
+    {
+        return addr >= base && (addr - base) + len <= size;
+    }
+
+    // Get the page containing addr, allocating it if necessary. The returned
+    // pointer is valid until the page is freed, i.e. clear() or restore().
+    uint8_t* get_page(uint32_t addr)
+    {
+        size_t idx = (addr - base) >> PAGE_BITS;
+        auto& page = pages[idx];
+        dirty[idx] = DIRTY_ALL;
+        if (!page)
+            page = std::make_unique<Page>(Page{});
+        return page->data();
+    }
+
+    // Get the page containing addr, without allocating. Returns nullptr for untouched pages.
+    const uint8_t* find_page(uint32_t addr) const
+    {
+        auto& page = pages[(addr - base) >> PAGE_BITS];
+        return page ? page->data() : nullptr;
+    }
+
+    uint8_t* get_ptr(uint32_t addr)
+    {
+        return get_page(addr) + (addr & (PAGE_SIZE - 1));
+    }
+
+    void read(uint32_t addr, void* dst, size_t len) const
+    {
+        uint8_t* dstBytes = (uint8_t*)dst;
+        while (len != 0)
+        {
+            size_t offs = addr & (PAGE_SIZE - 1);
+            size_t n = std::min(len, PAGE_SIZE - offs);
+            const uint8_t* page = find_page(addr);
+            if (page)
+                memcpy(dstBytes, page + offs, n);
+            else
+                memset(dstBytes, 0, n);
+            addr += n;
+            dstBytes += n;
+            len -= n;
+        }
+    }
+
+    void write(uint32_t addr, const void* src, size_t len)
+    {
+        const uint8_t* srcBytes = (const uint8_t*)src;
+        while (len != 0)
+        {
+            size_t offs = addr & (PAGE_SIZE - 1);
+            size_t n = std::min(len, PAGE_SIZE - offs);
+            memcpy(get_page(addr) + offs, srcBytes, n);
+            addr += n;
+            srcBytes += n;
+            len -= n;
+        }
+    }
+
+    // Write up to 32 bytes within a single page, only bytes with their mask bit set are written.
+    void write_masked(uint32_t addr, const void* src, uint32_t mask, size_t len)
+    {
+        const uint8_t* srcBytes = (const uint8_t*)src;
+        uint8_t* dst = get_ptr(addr);
+        for (size_t i = 0; i < len; i++)
+            if (mask & (1UL << i))
+                dst[i] = srcBytes[i];
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            if (pages[i])
+                dirty[i] = DIRTY_ALL;
+            pages[i].reset();
+        }
+    }
+
+    // Revert all pages written since the last snapshot to their contents in base (zero if not
+    // present in base). Pages are not freed, so pointers handed out before remain valid.
+    void revert_dirty(const SparseMemory& base)
+    {
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            if (!(dirty[i] & DIRTY_SNAPSHOT))
+                continue;
+            if (base.pages[i])
+            {
+                if (!pages[i])
+                    pages[i] = std::make_unique<Page>();
+                *pages[i] = *base.pages[i];
+            }
+            else if (pages[i])
+                pages[i]->fill(0);
+            dirty[i] = DIRTY_CHECKPOINT;
+        }
+    }
+
+    // Copy all pages written since the last snapshot into snap, making it a copy of this memory
+    // again (if it was one at the last snapshot).
+    void commit_dirty(SparseMemory& snap)
+    {
+        if (snap.size != size || snap.base != base)
+            abort();
+        for (size_t i = 0; i < pages.size(); i++)
+        {
+            if (!(dirty[i] & DIRTY_SNAPSHOT))
+                continue;
+            if (!pages[i])
+                snap.pages[i].reset();
+            else if (!snap.pages[i])
+                snap.pages[i] = std::make_unique<Page>(*pages[i]);
+            else
+                *snap.pages[i] = *pages[i];
+            dirty[i] &= ~DIRTY_SNAPSHOT;
+        }
+    }
+
+    // Page access by index, for checkpointing. Returns nullptr for untouched pages.
+    size_t page_slots() const
+    {
+        return pages.size();
+    }
+
+    const uint8_t* page_at(size_t idx) const
+    {
+        return pages[idx] ? pages[idx]->data() : nullptr;
+    }
+
+    bool is_dirty(size_t idx, DirtySet set = DIRTY_CHECKPOINT) const
+    {
+        return dirty[idx] & set;
+    }
+
+    void clear_dirty(DirtySet set = DIRTY_CHECKPOINT)
+    {
+        for (auto& d : dirty)
+            d &= ~set;
+    }
+
+    size_t num_pages() const
+    {
+        size_t n = 0;
+        for (auto& page : pages)
+            n += !!page;
+        return n;
+    }
+
+  private:
+    std::vector<std::unique_ptr<Page>> pages;
+    // DirtySet bits, set when a page is written (or freed) and cleared per set
+    std::vector<uint8_t> dirty;
+};
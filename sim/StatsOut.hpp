@@ -0,0 +1,139 @@
+#pragma once
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+
+// Time series of the performance counters (--stats-out). Every interval (in cycles or
+// instructions), one sample with the counter increments since the previous sample and
+// metrics derived from them is written, as CSV if the file name ends in .csv and as
+// JSON lines otherwise.
+class StatsOut
+{
+  public:
+    static constexpr size_t NUM_COUNTERS = 25;
+    using Counters = std::array<uint64_t, NUM_COUNTERS>;
+
+    // In the order of ReadPerfCounters: mcycle, minstret, mhpmcounter3 to mhpmcounter25
+    static constexpr const char* COUNTER_NAMES[NUM_COUNTERS] = {
+        "cycles",         "instret",        "branches",      "branch_mispredicts", "mispredicts", "flush_ordering",
+        "flush_branch_tk", "flush_branch_nt", "flush_return",  "flush_ibranch",      "flush_mem_order",
+        "stall_frontend", "stall_backend",  "stall_store",   "stall_load",         "stall_rob",
+        "td_retiring",    "td_mispredict",  "td_ordering",   "td_icache",          "td_itlb",
+        "td_btb",         "td_frontend",    "td_memory",     "td_core",
+    };
+    static constexpr size_t NUM_METRICS = 12;
+    static constexpr const char* METRIC_NAMES[NUM_METRICS] = {
+        "ipc",          "mpki",                "branch_mispredict_pct", "frontend_pct",
+        "backend_pct",  "store_pct",           "load_pct",              "rob_pct",
+        "retiring_pct", "bad_speculation_pct", "frontend_bound_pct",    "backend_bound_pct",
+    };
+
+    ~StatsOut()
+    {
+        close();
+    }
+
+    void open(const std::string& path, uint64_t interval, bool instret, const Counters& start)
+    {
+        file = fopen(path.c_str(), "w");
+        if (!file)
+            abort();
+        csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+        this->interval = interval;
+        this->instret = instret;
+        last = start;
+        next = position(start) + interval;
+
+        if (csv)
+        {
+            fprintf(file, "sample,mcycle,minstret");
+            for (auto* name : COUNTER_NAMES)
+                fprintf(file, ",%s", name);
+            for (auto* name : METRIC_NAMES)
+                fprintf(file, ",%s", name);
+            fprintf(file, "\n");
+        }
+    }
+
+    bool is_open() const
+    {
+        return file != nullptr;
+    }
+
+    bool due(uint64_t mcycle, uint64_t minstret) const
+    {
+        return (instret ? minstret : mcycle) >= next;
+    }
+
+    void sample(const Counters& counters)
+    {
+        Counters d;
+        for (size_t i = 0; i < NUM_COUNTERS; i++)
+            d[i] = counters[i] - last[i];
+        if (d[0] == 0)
+            return;
+
+        // Stall and top-down counters count slots, four per cycle
+        double slots = 4.0 * d[0];
+        double metrics[NUM_METRICS] = {
+            (double)d[1] / d[0],
+            d[1] ? 1000.0 * d[4] / d[1] : 0,
+            d[2] ? 100.0 * d[3] / d[2] : 0,
+            100.0 * d[11] / slots,
+            100.0 * d[12] / slots,
+            100.0 * d[13] / slots,
+            100.0 * d[14] / slots,
+            100.0 * d[15] / slots,
+            100.0 * d[16] / slots,
+            100.0 * (d[17] + d[18]) / slots,
+            100.0 * (d[19] + d[20] + d[21] + d[22]) / slots,
+            100.0 * (d[23] + d[24]) / slots,
+        };
+
+        if (csv)
+        {
+            fprintf(file, "%lu,%lu,%lu", count, counters[0], counters[1]);
+            for (size_t i = 0; i < NUM_COUNTERS; i++)
+                fprintf(file, ",%lu", d[i]);
+            for (size_t i = 0; i < NUM_METRICS; i++)
+                fprintf(file, ",%.6g", metrics[i]);
+        }
+        else
+        {
+            fprintf(file, "{\"sample\": %lu, \"mcycle\": %lu, \"minstret\": %lu", count, counters[0], counters[1]);
+            for (size_t i = 0; i < NUM_COUNTERS; i++)
+                fprintf(file, ", \"%s\": %lu", COUNTER_NAMES[i], d[i]);
+            for (size_t i = 0; i < NUM_METRICS; i++)
+                fprintf(file, ", \"%s\": %.6g", METRIC_NAMES[i], metrics[i]);
+            fprintf(file, "}");
+        }
+        fprintf(file, "\n");
+
+        count++;
+        last = counters;
+        next = position(counters) + interval;
+    }
+
+    void close()
+    {
+        if (file)
+            fclose(file);
+        file = nullptr;
+    }
+
+  private:
+    FILE* file = nullptr;
+    bool csv = false;
+    bool instret = false;
+    uint64_t interval = 0;
+    uint64_t next = 0;
+    uint64_t count = 0;
+    Counters last{};
+
+    uint64_t position(const Counters& c) const
+    {
+        return instret ? c[1] : c[0];
+    }
+};
@@ -7,6 +7,11 @@
 #include "VTop_Top.h"
 #include "Debug.hpp"
 #include <memory>
+#include <vector>
+
+#ifdef SAVEABLE
+#include "VerilatedMemSave.hpp"
+#endif
 
 #ifdef TRACE
 #include "verilated_fst_c.h"
@@ -28,7 +33,7 @@ class TopWrapper
         top->clk = !top->clk;
         top->eval();
 #ifdef TRACE
-        if (main_time > DEBUG_TIME)
+        if (TRACING)
             tfp->dump(main_time);
 #endif
         main_time++;
@@ -45,21 +50,20 @@ class TopWrapper
         }
     }
 
-    void save_model(std::string fileName)
+    void save_model(std::vector<uint8_t>& buf)
     {
 #ifdef SAVEABLE
-        VerilatedSave os;
-        os.open(fileName.c_str());
+        VerilatedMemSave os(buf);
         os << main_time; // user code must save the timestamp
         os << *top;
+        os.close();
 #endif
     }
 
-    void restore_model(std::string fileName)
+    void restore_model(const std::vector<uint8_t>& buf)
     {
 #ifdef SAVEABLE
-        VerilatedRestore os;
-        os.open(fileName.c_str());
+        VerilatedMemRestore os(buf.data(), buf.size());
         os >> main_time;
         os >> *top;
 #else
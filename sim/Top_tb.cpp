@@ -5,32 +5,85 @@
 #include "models/BranchHistory.hpp"
 #include "models/ReturnStack.hpp"
 #include "sc_stub.hpp"
+#include <chrono>
 #include <csignal>
+#include <deque>
 #include <memory>
-#include <regex>
+#include <set>
 #define TOOLCHAIN "riscv32-unknown-elf-"
 
 #include "model_headers.h"
 #include <array>
 #include <cstdio>
 #include <cstring>
+#include <fcntl.h>
+#include <dirent.h>
 #include <getopt.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include "AsyncCosim.hpp"
+#include "BitView.hpp"
+#include "Checkpoint.hpp"
+#include "CommitProfile.hpp"
+#include "ElfLoader.hpp"
+#include "FlightRecorder.hpp"
 #include "Fuzzer.hpp"
+#include "GoldenLog.hpp"
 #include "Inst.hpp"
+#include "Markers.hpp"
+#include "Occupancy.hpp"
+#include "KonataTrace.hpp"
 #include "Registers.hpp"
+#include "Sampling.hpp"
 #include "Simif.hpp"
+#include "SparseMemory.hpp"
+#include "StatsOut.hpp"
+#include "TraceWindows.hpp"
 #include "Debug.hpp"
 #include "slang/slang.hpp"
-#define GET(type, raw) type{sc_bv<type::_size>{(char*)raw}}
+#ifdef COVERAGE
+#include "VTop__Syms.h"
+#endif
 
 uint64_t DEBUG_TIME;
+bool TRACING = false;
 
 #define LEN(x) (sizeof((x)) / sizeof((x[0])))
 std::unique_ptr<TopWrapper> wrap = std::make_unique<TopWrapper>();
-std::vector<uint32_t> pram(1 << 26);
+
+// Physical memory as seen by Spike and the ELF loader
+SparseMemory pmem;
+// With cosim, Spike commits stores before the RTL writes them back, so the RTL's
+// memory has to be kept separately. Without, the RTL works on pmem directly.
+SparseMemory rtlMemCopy;
+#ifdef COSIM
+SparseMemory* rtlMem = &rtlMemCopy;
+#else
+SparseMemory* rtlMem = &pmem;
+#endif
+// Symbols of the loaded program, empty when restoring a checkpoint
+SymbolTable symbols;
+
+// bytes is the AXI beat size (AXI_WIDTH / 8), which is also the size of data
+static uint32_t ExtMemAddr(int addr, int bytes)
+{
+    // The AXI memory model only decodes the lower 256 MiB
+    return 0x80000000 | ((uint32_t)addr & 0x0fffffff & ~(bytes - 1));
+}
+
+void ExtMem_Read(int addr, int bytes, svBitVecVal* data)
+{
+    rtlMem->read(ExtMemAddr(addr, bytes), data, bytes);
+}
+
+void ExtMem_Write(int addr, int bytes, const svBitVecVal* data, int wstrb)
+{
+    rtlMem->write_masked(ExtMemAddr(addr, bytes), data, wstrb, bytes);
+}
 
 constexpr size_t SqN_Bits = R_UOp::sqN_w;
 constexpr size_t SqN_Mask = (1 << SqN_Bits) - 1;
@@ -63,7 +116,7 @@ double sc_time_stamp()
 }
 
 Registers registers(wrap->top.get());
-SpikeSimif simif(pram, registers, wrap->main_time);
+SpikeSimif simif(pmem, registers, wrap->main_time);
 
 void WriteRegister(uint32_t rid, uint32_t val)
 {
@@ -106,12 +159,138 @@ void DumpState(FILE* stream, Inst inst)
     fprintf(stream, "\n");
 }
 
-FILE* konataFile;
+// Same as DumpState, but for an instruction that committed earlier
+void DumpState(FILE* stream, const CosimRecord& rec)
+{
+    fprintf(stream, "time=%lu\n", rec.time);
+    fprintf(stream, "ir=%.8lx ppc=%.8x inst=%.8x sqn=%.2x\n", rec.inst.minstret, rec.inst.pc, rec.inst.inst,
+            rec.inst.sqn);
+    for (size_t j = 0; j < 4; j++)
+    {
+        for (size_t k = 0; k < 8; k++)
+            fprintf(stream, "x%.2zu=%.8x ", j * 8 + k, rec.regs[j * 8 + k]);
+        fprintf(stream, "\n");
+    }
+    fprintf(stream, "\n");
+}
+
+#ifdef KONATA
+static KonataWriter konata;
+#endif
+
+// With --cosim-thread, Spike checks committed instructions on its own thread
+static std::unique_ptr<AsyncCosim> asyncCosim;
+
+// Cosim checks each instruction at cosimTier (by default only the destination register),
+// and all registers every cosimSweepInterval instructions and around traps.
+static CosimCheck cosimTier = CHECK_DEST;
+static uint64_t cosimSweepInterval = 1024;
+static uint64_t cosimSinceSweep = 0;
+static bool cosimSweepNext = true;
+
+// With --cosim-rollback, RTL and Spike are snapshotted every cosimRollbackInterval
+// instructions, after checking all registers. The first mismatch rolls back to the
+// last snapshot and re-runs from there with full checks, to find the first bad instruction.
+struct CosimSnapshot
+{
+    std::vector<uint8_t> model;
+    ArchState spike;
+    decltype(state) harness;
+    std::array<uint16_t, 32> regTagOverride;
+    std::vector<char> models;
+    int riscvTestReturn;
+    uint64_t minstret;
+    SparseMemory pmem;
+    SparseMemory rtlMem;
+};
+struct CosimRollback
+{
+};
+static uint64_t cosimRollbackInterval = 0;
+static uint64_t cosimNextSnapshot = 0;
+static std::unique_ptr<CosimSnapshot> cosimSnap;
+// Only set while it is safe to unwind back into MainLoop
+static bool cosimCanRollback = false;
+static bool cosimRolledBack = false;
+
+// The last cycles of pipeline events, dumped when the simulation fails
+static FlightRecorder flight;
+
+// mcycle, minstret, mhpmcounter3 to mhpmcounter25
+using PerfCounters = StatsOut::Counters;
+
+// With --roi, perf counters (and checkpoints) only cover the regions between ROI markers.
+// Counters are summed over all regions.
+struct RegionOfInterest
+{
+    bool enabled = false;
+    bool active = false;
+    uint64_t regions = 0;
+    // Take a checkpoint at the next batch boundary
+    bool save = false;
+    PerfCounters start{};
+    PerfCounters counters{};
+};
+static RegionOfInterest roi;
+
+// --stats-out, sampled between batches
+static StatsOut stats;
+
+// --profile/--profile-folded, charged in LogInstructions
+static CommitProfile profile;
+
+// --occupancy, sampled in MainLoop
+static OccupancySampler occupancy;
+
+// --stop-at-pc/--stop-at-symbol, checked on commit
+static uint32_t stopPC = 0;
+static bool stopHit = false;
+
+// FST and Konata tracing, from --trace and --debug-time
+static TraceWindows traceWindows;
+
+// With --golden, commits are checked against a recorded golden log instead of Spike
+static std::unique_ptr<GoldenReplay> golden;
+
+// Coverage counters of the last fuzzer run. Built with coverage, these are Verilator's
+// line/toggle counters, otherwise hashed edges between the PCs of committed instructions.
+static std::vector<uint32_t> fuzzCounts;
+static bool fuzzEdges = false;
+static uint32_t fuzzLastPC = 0;
+
+void WaitCheckpoints();
+
+// In batch mode, Exit unwinds back into the batch worker loop instead of terminating.
+struct SimExit
+{
+    int code;
+};
+static bool throwOnExit = false;
+
+// What made the simulation fail (cosim error code or HANG_ERROR, and the PC), to tell
+// errors apart when minimizing fuzzer test cases
+constexpr int HANG_ERROR = -256;
+static int lastErrorCode = 0;
+static uint32_t lastErrorPC = 0;
 
 void Exit(int code)
 {
+    if (asyncCosim)
+        asyncCosim->reset();
+    if (throwOnExit)
+        throw SimExit{code};
+    WaitCheckpoints();
+    stats.close();
+    profile.close(symbols);
+    occupancy.close();
+    // Named by pid, as concurrent runs (e.g. --ladder workers) share the working directory
+    std::string flightPath = "flight_konata-" + std::to_string(getpid()) + ".bin";
+    if (code == -1 && flight.dump(flightPath))
+        fprintf(stderr, "flight recorder: pipeline trace of the last cycles in %s\n", flightPath.c_str());
+    else if (code == -1 && flight.enabled())
+        fprintf(stderr, "flight recorder: no pipeline events were recorded\n");
 #ifdef KONATA
-    fflush(konataFile);
+    konata.close();
 #endif
     wrap->Final();
     fflush(stdout);
@@ -121,17 +300,127 @@ void Exit(int code)
 
 void LogFlush(Inst& inst);
 
+static void CosimError(int err, const CosimRecord& rec, uint32_t startPC, bool async)
+{
+    const Inst& inst = rec.inst;
+    if (err == 1)
+    {
+        int testReturn = golden ? golden->riscvTestReturn : simif.riscvTestReturn;
+        fprintf(stdout, "%s test with return code %.8x\n", testReturn == 1 ? "PASSED" : "FAILED", testReturn);
+        Exit(0);
+    }
+
+    if (cosimCanRollback && cosimSnap && !cosimRolledBack)
+    {
+        fprintf(stdout, "cosim mismatch (error %u) at instret %lu, re-running from instret %lu with full checks\n",
+                -err, inst.minstret, cosimSnap->minstret);
+        throw CosimRollback{};
+    }
+
+    fprintf(stdout, "ERROR %u (fetchID=%.2x, sqN=%.2x)\n", -err, inst.fetchID, inst.sqn);
+    if (async)
+        DumpState(stdout, rec);
+    else
+        DumpState(stdout, inst);
+
+    fprintf(stdout, "\nSHOULD BE\n");
+    if (golden)
+        golden->dump_expected(stdout);
+    else
+        simif.dump_state(stdout, startPC);
+    flight.mark_error(inst.id);
+    lastErrorCode = err;
+    lastErrorPC = inst.pc;
+#ifdef KONATA
+    konata.label(inst.id, 0, " COSIM ERROR ");
+    konata.flush();
+#endif
+    Exit(-1);
+}
+
+// Wait for the cosim thread to check all committed instructions, so that Spike can be
+// accessed again. Reports the first error, if any.
+static void SyncCosim()
+{
+    if (!asyncCosim)
+        return;
+    asyncCosim->drain();
+    if (asyncCosim->failed())
+    {
+        auto failure = asyncCosim->failure();
+        CosimError(failure.err, failure.rec, failure.startPC, true);
+    }
+}
+
+#ifdef COSIM
+static void CosimCommit(Inst& inst)
+{
+    CosimRecord rec;
+    rec.time = wrap->main_time;
+    bool trap = inst.interrupt != Inst::IR_NONE || inst.flags >= Flags::FLAGS_ILLEGAL_INSTR;
+    // Without any per-instruction checks, there are no sweeps either
+    bool sweep = cosimTier != CHECK_NONE && ++cosimSinceSweep >= cosimSweepInterval;
+    rec.check = (cosimSweepNext || trap || sweep) ? CHECK_FULL : cosimTier;
+    if (rec.check == CHECK_FULL)
+    {
+        for (size_t i = 0; i < 32; i++)
+            rec.regs[i] = registers.ReadRegister(i);
+        cosimSinceSweep = 0;
+        cosimSweepNext = false;
+    }
+    // Spike needs the result of sc.w to follow the RTL
+    else if (rec.check == CHECK_DEST || SpikeSimif::is_store_conditional(inst.inst))
+        rec.regs[inst.rd] = registers.ReadRegister(inst.rd);
+    if (simif.checkModels)
+        for (auto* model : simif.models)
+            model->Sample(inst);
+    rec.inst = inst;
+
+    if (asyncCosim)
+    {
+        asyncCosim->push(rec);
+        if (asyncCosim->failed())
+            SyncCosim();
+    }
+    else
+    {
+        uint32_t startPC = simif.get_pc();
+        if (int err = simif.cosim_instr(rec))
+            CosimError(err, rec, startPC, false);
+    }
+}
+#endif
+
+static void RoiStart(uint64_t minstret);
+static void RoiStop(uint64_t minstret);
+
 void LogCommit(Inst& inst)
 {
 #ifdef COSIM
     if (simif.doRestore)
+    {
+        SyncCosim();
         simif.restore_from_top(*wrap, inst);
+        cosimSweepNext = true;
+    }
 #endif
     if (inst.interrupt == Inst::IR_SQUASH)
     {
-#ifdef COSIM
         // printf("INTERRUPT %.8x\n", inst.pc);
-        simif.take_trap(true, inst.interruptCause, inst.pc, inst.interruptDelegate);
+        if (golden)
+        {
+            if (int err = golden->check_interrupt(inst))
+                CosimError(err, CosimRecord{inst, wrap->main_time, CHECK_NONE, {}}, 0, false);
+        }
+#ifdef COSIM
+        else
+        {
+            cosimSweepNext = true;
+            if (asyncCosim)
+                asyncCosim->push(CosimRecord{inst, wrap->main_time, CHECK_NONE, {}});
+            else
+                simif.take_trap(true, inst.interruptCause, inst.pc, inst.interruptDelegate);
+        }
 #endif
 #ifdef KONATA
         // This is a fake interrupt instruction,
@@ -148,33 +437,44 @@ void LogCommit(Inst& inst)
         if (inst.rd != 0 && inst.flags < 6)
             registers.regTagOverride[inst.rd] = inst.tag;
 
-#ifdef COSIM
-        uint32_t startPC = simif.get_pc();
-        if (int err = simif.cosim_instr(inst))
+        if (traceWindows.needs_commits())
+            traceWindows.commit(inst.pc, inst.inst, wrap->main_time, inst.minstret);
+        if (roi.enabled)
         {
-            if (err == 1)
-            {
-                fprintf(stdout, "%s test with return code %.8x\n",
-                    simif.riscvTestReturn == 1 ? "PASSED" : "FAILED", simif.riscvTestReturn);
-                Exit(0);
-            }
+            int marker = DecodeMarker(inst.inst);
+            if (marker == MARKER_ROI_START && !roi.active)
+                RoiStart(inst.minstret);
+            else if (marker == MARKER_ROI_STOP && roi.active)
+                RoiStop(inst.minstret);
+        }
+        if (inst.pc == stopPC && stopPC != 0)
+            stopHit = true;
 
-            fprintf(stdout, "ERROR %u (fetchID=%.2x, sqN=%.2x)\n", -err, inst.fetchID, inst.sqn);
-            DumpState(stdout, inst);
+        if (fuzzEdges)
+        {
+            uint32_t cur = (inst.pc >> 1) & (fuzzCounts.size() - 1);
+            fuzzCounts[cur ^ fuzzLastPC]++;
+            fuzzLastPC = cur >> 1;
+        }
 
-            fprintf(stdout, "\nSHOULD BE\n");
-            simif.dump_state(stdout, startPC);
-#ifdef KONATA
-            fprintf(konataFile, "L\t%u\t%u\t COSIM ERROR \n", inst.id, 0);
-            fflush(konataFile);
-#endif
-            Exit(-1);
+        if (golden)
+        {
+            if (int err = golden->check(inst, registers.ReadRegister(inst.rd)))
+                CosimError(err, CosimRecord{inst, wrap->main_time, CHECK_NONE, {}}, 0, false);
         }
+#ifdef COSIM
+        else
+            CosimCommit(inst);
 #endif
 
+        flight.stage(inst.id, KST_COM);
+        flight.retire(inst.id, inst.sqn);
 #ifdef KONATA
-        fprintf(konataFile, "S\t%u\t0\t%s\n", inst.id, "COM");
-        fprintf(konataFile, "R\t%u\t%u\t0\n", inst.id, inst.sqn);
+        if (TRACING)
+        {
+            konata.stage(inst.id, KST_COM);
+            konata.retire(inst.id, inst.sqn);
+        }
 #else
             // DumpState(inst.pc);
 #endif
@@ -184,79 +484,85 @@ void LogCommit(Inst& inst)
 static uint64_t hpm4offset = 0;
 void LogPredec(Inst& inst)
 {
+    flight.insert(inst.id, inst.fetchID);
+    flight.inst(inst.id, inst.pc, inst.inst);
+    flight.stage(inst.id, KST_DEC);
 #ifdef KONATA
-    fprintf(konataFile, "I\t%u\t%u\t%u\n", inst.id, inst.fetchID, 0);
-    // For return stack debugging
-    /*fprintf(konataFile, "L\t%u\t%u\t (%.5ld) %d %.3x %.3x %.3x %.3x| \n", inst.id, 0, main_time, inst.retIdx,
-        state.fetches[inst.fetchID].returnAddr[0] * 2 & 0xfff,
-        state.fetches[inst.fetchID].returnAddr[1] * 2 & 0xfff,
-        state.fetches[inst.fetchID].returnAddr[2] * 2 & 0xfff,
-        state.fetches[inst.fetchID].returnAddr[3] * 2 & 0xfff);*/
-    if (wrap->main_time > DEBUG_TIME)
+    if (TRACING)
     {
-        fprintf(konataFile, "L\t%u\t%u\t[%.5lu]%.8x (%.8x): %s\n", inst.id, 0, wrap->main_time, inst.pc, inst.inst,
-                simif.disasm(inst.inst).c_str());
-        fprintf(konataFile, "S\t%u\t0\t%s\n", inst.id, "DEC");
+        konata.insert(inst.id, inst.fetchID);
+        // Disassembled by the converter
+        konata.inst(inst.id, wrap->main_time, inst.pc, inst.inst);
+        konata.stage(inst.id, KST_DEC);
     }
 #endif
 }
 
 void LogDecode(Inst& inst)
 {
+    flight.stage(inst.id, KST_RN);
 #ifdef KONATA
-    fprintf(konataFile, "S\t%u\t0\t%s\n", inst.id, "RN");
+    if (TRACING)
+        konata.stage(inst.id, KST_RN);
 #endif
 }
 
 void LogFlush(Inst& inst)
 {
+    flight.flush_inst(inst.id);
 #ifdef KONATA
-    fprintf(konataFile, "R\t%u\t0\t1\n", inst.id);
+    if (TRACING)
+        konata.flush_inst(inst.id);
 #endif
 }
 
 void LogRename(Inst& inst)
 {
+    flight.stage(inst.id, (inst.fu == 9 || inst.fu == 12) ? KST_WFC : KST_IS);
 #ifdef KONATA
-    if (wrap->main_time > DEBUG_TIME)
+    if (TRACING)
     {
         if (inst.fu == 9 || inst.fu == 12)
-            fprintf(konataFile, "S\t%u\t0\t%s\n", inst.id, "WFC");
+            konata.stage(inst.id, KST_WFC);
         else
-            fprintf(konataFile, "S\t%u\t0\t%s\n", inst.id, "IS");
+            konata.stage(inst.id, KST_IS);
     }
 #endif
 }
 
 void LogResult(Inst& inst)
 {
+    flight.stage(inst.id, KST_WFC);
+    if (!(inst.tag & (1 << Tag_Bits)))
+        flight.result(inst.id, inst.result);
 #ifdef KONATA
-    if (wrap->main_time > DEBUG_TIME)
+    if (TRACING)
     {
-        fprintf(konataFile, "S\t%u\t0\t%s\n", inst.id, "WFC");
+        konata.stage(inst.id, KST_WFC);
         if (!(inst.tag & (1 << Tag_Bits)))
-            fprintf(konataFile, "L\t%u\t%u\tres=%.8x\n", inst.id, 1, inst.result);
+            konata.result(inst.id, inst.result);
     }
 #endif
 }
 
 void LogExec(Inst& inst)
 {
+    flight.stage(inst.id, KST_EX);
 #ifdef KONATA
-    if (wrap->main_time > DEBUG_TIME)
+    if (TRACING)
     {
-        fprintf(konataFile, "S\t%u\t0\t%s\n", inst.id, "EX");
-        fprintf(konataFile, "L\t%u\t%u\topA=%.8x \n", inst.id, 1, inst.srcA);
-        fprintf(konataFile, "L\t%u\t%u\topB=%.8x \n", inst.id, 1, inst.srcB);
-        fprintf(konataFile, "L\t%u\t%u\timm=%.8x \n", inst.id, 1, inst.imm);
+        konata.stage(inst.id, KST_EX);
+        konata.operands(inst.id, inst.srcA, inst.srcB, inst.imm);
     }
 #endif
 }
 
 void LogIssue(Inst& inst)
 {
+    flight.stage(inst.id, KST_LD);
 #ifdef KONATA
-    fprintf(konataFile, "S\t%u\t0\t%s\n", inst.id, "LD");
+    if (TRACING)
+        konata.stage(inst.id, KST_LD);
 #endif
 }
 
@@ -265,7 +571,8 @@ void LogCycle()
     state.curCycInstRet = 0;
     registers.Cycle();
 #ifdef KONATA
-    fprintf(konataFile, "C\t1\n");
+    if (TRACING)
+        konata.cycle();
 #endif
 }
 
@@ -277,16 +584,31 @@ void LogInstructions()
 #endif
 
     auto core = wrap->top->Top->soc->core;
+    flight.cycle(wrap->main_time);
 
     bool brTaken = core->branch[0] & 1;
+    bool profiling = profile.is_open() && (!roi.enabled || roi.active);
+    if (profiling)
+        profile.cycle();
+
+    // Load nacks (cache misses and conflicts), the load is re-issued later
+    if (profile.is_open())
+    {
+        for (size_t i = 0; i < LEN(core->LSU_ldAck); i++)
+        {
+            auto ldAck = VIEW(LD_Ack, &core->LSU_ldAck[i]);
+            if (FIELD(ldAck, valid) && FIELD(ldAck, fail))
+                profile.nack(FIELD(ldAck, loadSqN));
+        }
+    }
 
     // Issue
     for (size_t i = 0; i < LEN(core->LD_uop); i++)
     {
         if (!core->stall[i] && core->IS_uop[i][0] & 1)
         {
-            auto isUOp = GET(IS_UOp, core->IS_uop[i].data());
-            LogIssue(state.insts[isUOp.sqN]);
+            auto isUOp = VIEW(IS_UOp, core->IS_uop[i].data());
+            LogIssue(state.insts[FIELD(isUOp, sqN)]);
         }
     }
 
@@ -296,12 +618,12 @@ void LogInstructions()
         // EX valid
         if ((core->LD_uop[i][0] & 1) && !core->stall[i])
         {
-            auto exUOp = GET(EX_UOp, core->LD_uop[i].data());
+            auto exUOp = VIEW(EX_UOp, core->LD_uop[i].data());
 
-            uint32_t sqn = exUOp.sqN;
-            state.insts[sqn].srcA = exUOp.srcA;
-            state.insts[sqn].srcB = exUOp.srcB;
-            state.insts[sqn].imm = exUOp.imm;
+            uint32_t sqn = FIELD(exUOp, sqN);
+            state.insts[sqn].srcA = FIELD(exUOp, srcA);
+            state.insts[sqn].srcB = FIELD(exUOp, srcB);
+            state.insts[sqn].imm = FIELD(exUOp, imm);
             LogExec(state.insts[sqn]);
         }
     }
@@ -313,9 +635,9 @@ void LogInstructions()
         // WB valid
         if ((core->flagUOps[i] & 1) && !(core->flagUOps[i] & 2))
         {
-            auto flagsUOp = GET(FlagsUOp, &core->flagUOps[i]);
-            uint32_t sqn = flagsUOp.sqN;
-            state.insts[sqn].flags = flagsUOp.flags;
+            auto flagsUOp = VIEW(FlagsUOp, &core->flagUOps[i]);
+            uint32_t sqn = FIELD(flagsUOp, sqN);
+            state.insts[sqn].flags = FIELD(flagsUOp, flags);
 
             // FP ops use a different flag encoding. These are not traps, so ignore them.
             const auto fp = {FuncUnit::FU_FPU, FuncUnit::FU_FMUL, FuncUnit::FU_FDIV};
@@ -335,10 +657,10 @@ void LogInstructions()
         // WB valid
         if ((core->resultUOps[i] & 1))
         {
-            auto resultUOp = GET(ResultUOp, &core->resultUOps[i]);
+            auto resultUOp = VIEW(ResultUOp, &core->resultUOps[i]);
 
-            uint32_t tag = resultUOp.tagDst;
-            uint32_t result = resultUOp.result;
+            uint32_t tag = FIELD(resultUOp, tagDst);
+            uint32_t result = FIELD(resultUOp, result);
             if (tag < LEN(state.phyRF))
                 state.phyRF[tag] = result;
         }
@@ -351,18 +673,18 @@ void LogInstructions()
         {
             if ((core->comUOps[i] & 1) && !core->mispredFlush)
             {
-                auto comuOp = GET(CommitUOp, &core->comUOps[i]);
+                auto comuOp = VIEW(CommitUOp, &core->comUOps[i]);
 
-                int sqn = comuOp.sqN;
+                int sqn = FIELD(comuOp, sqN);
 
                 bool isInterrupt = false;
                 bool isXRETinterrupt = false;
                 if (core->ROB_trapUOp & 1)
                 {
-                    auto trapUOp = GET(Trap_UOp, &core->ROB_trapUOp);
-                    int trapSQN = trapUOp.sqN;
-                    int flags = trapUOp.flags;
-                    int rd = trapUOp.rd;
+                    auto trapUOp = VIEW(Trap_UOp, &core->ROB_trapUOp);
+                    int trapSQN = FIELD(trapUOp, sqN);
+                    int flags = FIELD(trapUOp, flags);
+                    int rd = FIELD(trapUOp, rd);
                     isInterrupt = (trapSQN == sqn) && flags == 7 && rd == 16;
                     isXRETinterrupt =
                         (trapSQN == sqn) && ((flags == 5 || flags == 14) && core->rob->IN_interruptPending);
@@ -378,18 +700,36 @@ void LogInstructions()
                 if (state.insts[sqn].tag < LEN(state.phyRF))
                     state.insts[sqn].result = state.phyRF[state.insts[sqn].tag];
                 LogCommit(state.insts[sqn]);
+                if (profiling && state.insts[sqn].interrupt != Inst::IR_SQUASH)
+                    profile.commit(state.insts[sqn].pc, state.insts[sqn].inst);
                 mostRecentPC = state.insts[sqn].pc;
                 state.insts[sqn].valid = false;
             }
         }
+
+        if (profiling)
+        {
+            const Inst& head = state.insts[curComSqN & SqN_Mask];
+            profile.stall(head.valid, head.pc, curComSqN & SqN_Mask);
+        }
     }
 
     // Branch Taken
     if (brTaken)
     {
-        auto branch = GET(BranchProv, core->branch.data());
+        auto branch = VIEW(BranchProv, core->branch.data());
+
+        if (profiling)
+        {
+            uint32_t cause = FIELD(branch, cause);
+            const Inst& inst = state.insts[FIELD(branch, sqN)];
+            if (cause == FlushCause::FLUSH_MEM_ORDER)
+                profile.mem_order(inst.pc);
+            else if (cause != FlushCause::FLUSH_ORDERING)
+                profile.mispredict(inst.pc);
+        }
 
-        uint32_t i = (branch.sqN + 1) & SqN_Mask;
+        uint32_t i = (FIELD(branch, sqN) + 1) & SqN_Mask;
         while (i != state.nextSqN)
         {
             if (state.insts[i].valid)
@@ -411,10 +751,10 @@ void LogInstructions()
         for (size_t i = 0; i < LEN(core->RN_uop); i++)
             if (core->RN_uop[i][0] & 1)
             {
-                auto rnUOp = GET(R_UOp, core->RN_uop[i].data());
-                int sqn = rnUOp.sqN;
-                int fu = rnUOp.fu;
-                auto tagDst = rnUOp.tagDst;
+                auto rnUOp = VIEW(R_UOp, core->RN_uop[i].data());
+                int sqn = FIELD(rnUOp, sqN);
+                int fu = FIELD(rnUOp, fu);
+                uint32_t tagDst = FIELD(rnUOp, tagDst);
 
                 state.insts[sqn].valid = 1;
                 state.insts[sqn] = state.de[i];
@@ -423,6 +763,13 @@ void LogInstructions()
                 state.insts[sqn].tag = tagDst;
                 state.nextSqN = (sqn + 1) & SqN_Mask;
 
+                if (profile.is_open())
+                {
+                    // As in Rename, LSU opcodes below LSU_SC_W are loads
+                    bool isLoad = fu == FuncUnit::FU_ATOMIC || (fu == FuncUnit::FU_AGU && FIELD(rnUOp, opcode) < 6);
+                    profile.rename(sqn, isLoad ? (int)FIELD(rnUOp, loadSqN) : -1);
+                }
+
                 LogRename(state.insts[sqn]);
             }
 
@@ -432,9 +779,9 @@ void LogInstructions()
             for (size_t i = 0; i < LEN(core->DE_uop); i++)
                 if (core->DE_uop[i][0] & (1 << 0))
                 {
-                    auto deUOp = GET(D_UOp, core->DE_uop[i].data());
+                    auto deUOp = VIEW(D_UOp, core->DE_uop[i].data());
                     state.de[i] = state.pd[i];
-                    state.de[i].rd = deUOp.rd;
+                    state.de[i].rd = FIELD(deUOp, rd);
                     LogDecode(state.de[i]);
                 }
                 else
@@ -450,14 +797,14 @@ void LogInstructions()
             for (size_t i = 0; i < LEN(core->PD_instrs); i++)
                 if ((core->PD_instrs[i][0] & 1))
                 {
-                    auto pdInstr = GET(PD_Instr, core->PD_instrs[i].data());
+                    auto pdInstr = VIEW(PD_Instr, core->PD_instrs[i].data());
                     state.pd[i].valid = true;
                     state.pd[i].flags = 0;
                     state.pd[i].id = state.id++;
-                    state.pd[i].pc = pdInstr.pc << 1;
-                    state.pd[i].inst = pdInstr.instr;
-                    state.pd[i].fetchID = pdInstr.fetchID;
-                    state.pd[i].predTarget = pdInstr.predTarget << 1;
+                    state.pd[i].pc = FIELD(pdInstr, pc) << 1;
+                    state.pd[i].inst = FIELD(pdInstr, instr);
+                    state.pd[i].fetchID = FIELD(pdInstr, fetchID);
+                    state.pd[i].predTarget = FIELD(pdInstr, predTarget) << 1;
                     if ((state.pd[i].inst & 3) != 3)
                         state.pd[i].inst &= 0xffff;
 
@@ -470,11 +817,30 @@ void LogInstructions()
     LogCycle();
 }
 
+struct SampleConfig
+{
+    size_t clusters = 0;
+    uint64_t interval = 10000000;
+    uint64_t warmup = 1000000;
+    uint64_t window = 1000000;
+    uint64_t limit = -1;
+    uint64_t iterations = 0;
+};
+
+struct LadderConfig
+{
+    uint64_t interval = 0;
+    uint32_t jobs = 0;
+    uint64_t warmup = 0;
+    uint64_t limit = -1;
+};
+
 struct Args
 {
     std::string progFile;
     std::string deviceTreeFile;
     std::string backupFile;
+    uint32_t backupJobs = 0;
     std::string memDumpFile;
     bool restoreSave = 0;
     uint32_t deviceTreeAddr = 0;
@@ -483,22 +849,162 @@ struct Args
     bool fuzz = 0;
     bool testMode = 0;
     uint64_t debugTime = -1;
+    uint64_t fastForwardInstret = 0;
+    uint32_t fastForwardPC = 0;
+    std::string fastForwardSymbol;
+    SampleConfig sample;
+    LadderConfig ladder;
+    std::string batchList;
+    std::string batchOut = "batch.json";
+    uint32_t batchJobs = 0;
+    bool batchWorker = false;
+    std::string fuzzDir = "fuzz";
+    uint32_t fuzzJobs = 1;
+    uint64_t fuzzIters = 0;
+    uint32_t fuzzSeed = 42;
+    int fuzzWorker = -1;
+    std::string fuzzReplay;
+    bool cosimThread = false;
+    uint64_t cosimSweep = 1024;
+    CosimCheck cosimTier = CHECK_DEST;
+    uint64_t cosimRollback = 0;
+    std::string golden;
+    std::string goldenRecord;
+    bool idleSkip = false;
+    bool konataGzip = false;
+    std::vector<std::string> traceWindows;
+#if defined(COSIM) | defined(KONATA)
+    uint64_t flightCycles = 1024;
+#else
+    // Recording follows every instruction, which performance builds otherwise skip
+    uint64_t flightCycles = 0;
+#endif
+    bool roi = false;
+    uint64_t maxInstret = 0;
+    uint32_t stopPC = 0;
+    std::string stopSymbol;
+    std::string statsOut;
+    uint64_t statsInterval = 1000000;
+    bool statsInstret = false;
+    std::string profile;
+    std::string profileFolded;
+    std::string occupancy;
+    uint64_t occupancyInterval = 1;
+    std::vector<std::string> cmdLine;
+};
+
+enum LongOnlyOptions
+{
+    OPT_SAMPLE_INTERVAL = 256,
+    OPT_SAMPLE_WARMUP,
+    OPT_SAMPLE_WINDOW,
+    OPT_SAMPLE_LIMIT,
+    OPT_SAMPLE_ITERATIONS,
+    OPT_BACKUP_JOBS,
+    OPT_LADDER,
+    OPT_LADDER_JOBS,
+    OPT_LADDER_WARMUP,
+    OPT_LADDER_LIMIT,
+    OPT_BATCH,
+    OPT_BATCH_JOBS,
+    OPT_BATCH_OUT,
+    OPT_BATCH_WORKER,
+    OPT_FUZZ_DIR,
+    OPT_FUZZ_JOBS,
+    OPT_FUZZ_ITERS,
+    OPT_FUZZ_SEED,
+    OPT_FUZZ_WORKER,
+    OPT_FUZZ_REPLAY,
+    OPT_COSIM_THREAD,
+    OPT_COSIM_SWEEP,
+    OPT_GOLDEN,
+    OPT_GOLDEN_RECORD,
+    OPT_COSIM_TIER,
+    OPT_COSIM_ROLLBACK,
+    OPT_IDLE_SKIP,
+    OPT_KONATA_GZIP,
+    OPT_TRACE,
+    OPT_FLIGHT_RECORDER,
+    OPT_ROI,
+    OPT_MAX_INSTRET,
+    OPT_STOP_AT_PC,
+    OPT_STOP_AT_SYMBOL,
+    OPT_STATS_OUT,
+    OPT_STATS_INTERVAL,
+    OPT_PROFILE,
+    OPT_PROFILE_FOLDED,
+    OPT_OCCUPANCY,
+    OPT_OCCUPANCY_INTERVAL,
+};
+
+// Not sampling, checkpoint ladder, fuzzing or batch mode, which run the program in pieces
+// or run several programs
+static bool IsSingleRun(const Args& args)
+{
+    return args.sample.clusters == 0 && args.ladder.interval == 0 && !args.fuzz && args.batchList.empty();
+}
+
+static const struct option long_options[] = {
+    {"device-tree", required_argument, 0, 'd'},
+    {"backup-file", required_argument, 0, 'b'},
+    {"dump-mem", required_argument, 0, 'o'},
+    {"perfc", no_argument, 0, 'p'},
+    {"test-mode", no_argument, 0, 't'},
+    {"fuzz", no_argument, 0, 'f'},
+    {"debug-time", required_argument, 0, 'x'},
+    {"fast-forward", required_argument, 0, 'F'},
+    {"sample", required_argument, 0, 'S'},
+    {"sample-interval", required_argument, 0, OPT_SAMPLE_INTERVAL},
+    {"sample-warmup", required_argument, 0, OPT_SAMPLE_WARMUP},
+    {"sample-window", required_argument, 0, OPT_SAMPLE_WINDOW},
+    {"sample-limit", required_argument, 0, OPT_SAMPLE_LIMIT},
+    {"sample-iterations", required_argument, 0, OPT_SAMPLE_ITERATIONS},
+    {"backup-jobs", required_argument, 0, OPT_BACKUP_JOBS},
+    {"ladder", required_argument, 0, OPT_LADDER},
+    {"ladder-jobs", required_argument, 0, OPT_LADDER_JOBS},
+    {"ladder-warmup", required_argument, 0, OPT_LADDER_WARMUP},
+    {"ladder-limit", required_argument, 0, OPT_LADDER_LIMIT},
+    {"batch", required_argument, 0, OPT_BATCH},
+    {"batch-jobs", required_argument, 0, OPT_BATCH_JOBS},
+    {"batch-out", required_argument, 0, OPT_BATCH_OUT},
+    {"batch-worker", required_argument, 0, OPT_BATCH_WORKER},
+    {"fuzz-dir", required_argument, 0, OPT_FUZZ_DIR},
+    {"fuzz-jobs", required_argument, 0, OPT_FUZZ_JOBS},
+    {"fuzz-iters", required_argument, 0, OPT_FUZZ_ITERS},
+    {"fuzz-seed", required_argument, 0, OPT_FUZZ_SEED},
+    {"fuzz-worker", required_argument, 0, OPT_FUZZ_WORKER},
+    {"fuzz-replay", required_argument, 0, OPT_FUZZ_REPLAY},
+    {"cosim-thread", no_argument, 0, OPT_COSIM_THREAD},
+    {"cosim-sweep", required_argument, 0, OPT_COSIM_SWEEP},
+    {"golden", required_argument, 0, OPT_GOLDEN},
+    {"golden-record", required_argument, 0, OPT_GOLDEN_RECORD},
+    {"cosim-tier", required_argument, 0, OPT_COSIM_TIER},
+    {"cosim-rollback", required_argument, 0, OPT_COSIM_ROLLBACK},
+    {"idle-skip", no_argument, 0, OPT_IDLE_SKIP},
+    {"konata-gzip", no_argument, 0, OPT_KONATA_GZIP},
+    {"trace", required_argument, 0, OPT_TRACE},
+    {"flight-recorder", required_argument, 0, OPT_FLIGHT_RECORDER},
+    {"roi", no_argument, 0, OPT_ROI},
+    {"max-instret", required_argument, 0, OPT_MAX_INSTRET},
+    {"stop-at-pc", required_argument, 0, OPT_STOP_AT_PC},
+    {"stop-at-symbol", required_argument, 0, OPT_STOP_AT_SYMBOL},
+    {"stats-out", required_argument, 0, OPT_STATS_OUT},
+    {"stats-interval", required_argument, 0, OPT_STATS_INTERVAL},
+    {"profile", required_argument, 0, OPT_PROFILE},
+    {"profile-folded", required_argument, 0, OPT_PROFILE_FOLDED},
+    {"occupancy", required_argument, 0, OPT_OCCUPANCY},
+    {"occupancy-interval", required_argument, 0, OPT_OCCUPANCY_INTERVAL},
+    {0, 0, 0, 0},
 };
+static const char* SHORT_OPTIONS = "d:b:o:pftx:F:S:";
 
 static void ParseArgs(int argc, char** argv, Args& args)
 {
-    static struct option long_options[] = {
-        {"device-tree", required_argument, 0, 'd'},
-        {"backup-file", required_argument, 0, 'b'},
-        {"dump-mem", required_argument, 0, 'o'},
-        {"perfc", no_argument, 0, 'p'},
-        {"test-mode", no_argument, 0, 't'},
-        {"fuzz", no_argument, 0, 'f'},
-        {"debug-time", required_argument, 0, 'x'},
-    };
+    args.cmdLine.assign(argv + 1, argv + argc);
+
     int idx;
     int c;
-    while ((c = getopt_long(argc, argv, "d:b:o:pftx:", long_options, &idx)) != -1)
+    while ((c = getopt_long(argc, argv, SHORT_OPTIONS, long_options, &idx)) != -1)
     {
         switch (c)
         {
@@ -509,6 +1015,84 @@ static void ParseArgs(int argc, char** argv, Args& args)
             case 'f': args.fuzz = 1; break;
             case 't': args.testMode = 1; break;
             case 'x': args.debugTime = std::stoull(optarg); break;
+            case 'F':
+                if (isdigit(optarg[0]))
+                    args.fastForwardInstret = std::stoull(optarg, nullptr, 0);
+                else
+                {
+                    args.fastForwardInstret = -1;
+                    args.fastForwardSymbol = std::string(optarg);
+                }
+                break;
+            case 'S': args.sample.clusters = std::stoull(optarg); break;
+            case OPT_SAMPLE_INTERVAL: args.sample.interval = std::stoull(optarg, nullptr, 0); break;
+            case OPT_SAMPLE_WARMUP: args.sample.warmup = std::stoull(optarg, nullptr, 0); break;
+            case OPT_SAMPLE_WINDOW: args.sample.window = std::stoull(optarg, nullptr, 0); break;
+            case OPT_SAMPLE_LIMIT: args.sample.limit = std::stoull(optarg, nullptr, 0); break;
+            case OPT_SAMPLE_ITERATIONS: args.sample.iterations = std::stoull(optarg, nullptr, 0); break;
+            case OPT_BACKUP_JOBS: args.backupJobs = std::stoul(optarg); break;
+            case OPT_LADDER: args.ladder.interval = std::stoull(optarg, nullptr, 0); break;
+            case OPT_LADDER_JOBS: args.ladder.jobs = std::stoul(optarg); break;
+            case OPT_LADDER_WARMUP: args.ladder.warmup = std::stoull(optarg, nullptr, 0); break;
+            case OPT_LADDER_LIMIT: args.ladder.limit = std::stoull(optarg, nullptr, 0); break;
+            case OPT_BATCH: args.batchList = std::string(optarg); break;
+            case OPT_BATCH_JOBS: args.batchJobs = std::stoul(optarg); break;
+            case OPT_BATCH_OUT: args.batchOut = std::string(optarg); break;
+            case OPT_BATCH_WORKER:
+                args.batchList = std::string(optarg);
+                args.batchWorker = true;
+                break;
+            case OPT_FUZZ_DIR: args.fuzzDir = std::string(optarg); break;
+            case OPT_FUZZ_JOBS: args.fuzzJobs = std::stoul(optarg); break;
+            case OPT_FUZZ_ITERS: args.fuzzIters = std::stoull(optarg, nullptr, 0); break;
+            case OPT_FUZZ_SEED: args.fuzzSeed = std::stoul(optarg, nullptr, 0); break;
+            case OPT_FUZZ_WORKER: args.fuzzWorker = std::stoi(optarg); break;
+            case OPT_FUZZ_REPLAY: args.fuzzReplay = std::string(optarg); break;
+            case OPT_COSIM_THREAD: args.cosimThread = true; break;
+            case OPT_COSIM_SWEEP: args.cosimSweep = std::max(1ULL, std::stoull(optarg, nullptr, 0)); break;
+            case OPT_GOLDEN: args.golden = std::string(optarg); break;
+            case OPT_GOLDEN_RECORD: args.goldenRecord = std::string(optarg); break;
+            case OPT_COSIM_TIER:
+            {
+                std::string tier(optarg);
+                if (tier == "full")
+                    args.cosimTier = CHECK_FULL;
+                else if (tier == "dest")
+                    args.cosimTier = CHECK_DEST;
+                else if (tier == "pc")
+                    args.cosimTier = CHECK_PC;
+                else if (tier == "trap")
+                    args.cosimTier = CHECK_NONE;
+                else
+                {
+                    fprintf(stderr, "unknown cosim tier %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            }
+            case OPT_COSIM_ROLLBACK: args.cosimRollback = std::stoull(optarg, nullptr, 0); break;
+            case OPT_IDLE_SKIP: args.idleSkip = true; break;
+            case OPT_KONATA_GZIP: args.konataGzip = true; break;
+            case OPT_TRACE: args.traceWindows.push_back(std::string(optarg)); break;
+            case OPT_FLIGHT_RECORDER: args.flightCycles = std::stoull(optarg, nullptr, 0); break;
+            case OPT_ROI: args.roi = true; break;
+            case OPT_MAX_INSTRET: args.maxInstret = std::stoull(optarg, nullptr, 0); break;
+            case OPT_STOP_AT_PC: args.stopPC = std::stoul(optarg, nullptr, 16); break;
+            case OPT_STOP_AT_SYMBOL: args.stopSymbol = std::string(optarg); break;
+            case OPT_STATS_OUT: args.statsOut = std::string(optarg); break;
+            case OPT_STATS_INTERVAL:
+            {
+                size_t end;
+                args.statsInterval = std::max(1ULL, std::stoull(optarg, &end, 0));
+                args.statsInstret = optarg[end] == 'i';
+                break;
+            }
+            case OPT_PROFILE: args.profile = std::string(optarg); break;
+            case OPT_PROFILE_FOLDED: args.profileFolded = std::string(optarg); break;
+            case OPT_OCCUPANCY: args.occupancy = std::string(optarg); break;
+            case OPT_OCCUPANCY_INTERVAL:
+                args.occupancyInterval = std::max(1ULL, std::stoull(optarg, nullptr, 0));
+                break;
             default: break;
         }
     }
@@ -516,10 +1100,11 @@ static void ParseArgs(int argc, char** argv, Args& args)
     if (optind < argc && argv[optind][0] != '+')
         args.progFile = std::string(argv[optind]);
 
-    if (args.progFile.empty())
+    if (args.progFile.empty() && args.batchList.empty())
     {
         fprintf(stderr,
                 "usage: %s [options] <ELF BINARY>.elf|<BACKUP FILE>.backup|<ASSEMBLY FILE>\n"
+                "       %s [options] --batch <LIST FILE>\n"
                 "Options:\n"
                 "\t"
                 "--device-tree, -d: Load device tree binary, store address in a1 at boot.\n"
@@ -527,17 +1112,195 @@ static void ParseArgs(int argc, char** argv, Args& args)
                 "--backup-file, -b: Periodically save state in specified file. Reload by specifying backup file as "
                 "program.\n"
                 "\t"
+                "--backup-jobs:     Write backups in up to this many forked background processes (default 0, blocking).\n"
+                "\t"
                 "--dump-mem, -o:    Dump memory into output file after loading binary.\n"
                 "\t"
                 "--perfc, -p:       Periodically dump performance counter stats.\n"
                 "\t"
+                "--roi:             Only count performance (and take checkpoints) between the ROI markers\n"
+                "\t                   slti x0, x0, 3 (start) and slti x0, x0, 4 (end).\n"
+                "\t"
+                "--stats-out:       Write performance counters and derived metrics every --stats-interval cycles\n"
+                "\t                   (default 1000000, or instructions with an i suffix) to the given file,\n"
+                "\t                   as CSV if it ends in .csv, otherwise as JSON lines.\n"
+                "\t"
+                "--profile:         Write a per-function and per-PC profile of cycles, stalls, D-cache stalls,\n"
+                "\t                   mispredicts and memory ordering flushes to the given file.\n"
+                "\t"
+                "--profile-folded:  Write the profiled cycles as folded call stacks (for flamegraph.pl).\n"
+                "\t"
+                "--occupancy:       Write occupancy histograms of the ROB, issue queues, load/store buffers,\n"
+                "\t                   TLB miss queues and outstanding D-cache misses to the given file.\n"
+                "\t"
+                "--occupancy-interval: Sample occupancy every this many cycles (default 1).\n"
+                "\t"
+                "--max-instret:     Stop once the given number of instructions have been retired.\n"
+                "\t"
+                "--stop-at-pc, --stop-at-symbol: Stop when the given PC (hex) or symbol commits.\n"
+                "\t"
+                "--trace:           Trace (FST and Konata) in the window <start>[:<end>], may be given multiple times.\n"
+                "\t                   Start and end are an instret, t<time>, @<pc>, a symbol or \"marker\" (slti x0, x0, 1\n"
+                "\t                   starts, slti x0, x0, 2 stops). The end may also be +<instructions>.\n"
+                "\t                   --debug-time, -x <time> is the same as --trace=t<time>.\n"
+                "\t"
+                "--flight-recorder: Keep pipeline events of the last given number of cycles (0 disables) and write\n"
+                "\t                   them to flight_konata-<pid>.bin when the simulation fails. On by default (1024) in\n"
+                "\t                   COSIM and KONATA builds; performance builds are slowed down by enabling it.\n"
+                "\t"
+                "--konata-gzip:     Compress the pipeline trace of KONATA builds (trace_konata.bin.gz).\n"
+                "\t"
+                "--idle-skip:       Don't evaluate cycles in which the core only waits for an interrupt, advance\n"
+                "\t                   time and counters instead. Cycle counts stay the same, internal timing may differ.\n"
+                "\t"
                 "--test-mode, -t:   Enable RISC-V test mode.\n"
                 "\t"
-                "--fuzz, -f:        Enable fuzzing mode.\n",
-                argv[0]);
+                "--fuzz, -f:        Coverage-guided fuzzing, mutating the given program. Corpus and errors are\n"
+                "\t                   kept in --fuzz-dir (default fuzz/), shared by --fuzz-jobs processes (default 1).\n"
+                "\t                   --fuzz-iters limits test cases per process (default 0, unlimited),\n"
+                "\t                   --fuzz-seed sets the random seed. --fuzz-replay runs a single saved test case.\n"
+                "\t"
+                "--cosim-thread:    Run cosim (Spike) on a separate thread. Errors are reported with a small delay.\n"
+                "\t"
+                "--cosim-sweep:     Compare all registers every given number of instructions (default 1024), otherwise\n"
+                "\t                   only the destination register. 1 compares all registers after every instruction.\n"
+                "\t"
+                "--cosim-tier:      What cosim checks per instruction: full (all registers), dest (default, destination\n"
+                "\t                   register), pc (PC and instruction, no models) or trap (only at traps, no sweeps).\n"
+                "\t"
+                "--cosim-rollback:  Snapshot every given number of instructions (SAVEABLE builds). On a mismatch, re-run\n"
+                "\t                   from the last snapshot with full checks to find the first bad instruction.\n"
+                "\t"
+                "--golden-record:   Run the program functionally in Spike and record its commits into the given file.\n"
+                "\t"
+                "--golden:          Check commits against a recorded golden log instead of running Spike alongside.\n"
+                "\t"
+                "--fast-forward, -F: Run functionally in Spike until the given instret or symbol is reached,\n"
+                "\t                   then continue with the RTL.\n"
+                "\t"
+                "--sample, -S:      Sampled simulation with the given number of SimPoint clusters.\n"
+                "\t                   Tune with --sample-interval, --sample-warmup, --sample-window (in instructions),\n"
+                "\t                   --sample-limit (max profiled instructions), --sample-iterations (benchmark\n"
+                "\t                   iterations, for score/MHz).\n"
+                "\t"
+                "--ladder:          Functionally create checkpoints every given number of instructions, then simulate\n"
+                "\t                   all intervals in parallel. Tune with --ladder-jobs (default: number of CPUs),\n"
+                "\t                   --ladder-warmup (detailed warm-up instructions), --ladder-limit (max instret).\n"
+                "\t"
+                "--batch:           Run all ELF binaries listed in the given file (one per line) in a pool of\n"
+                "\t                   --batch-jobs (default: CPUs / 4) processes. Other options apply to each program.\n"
+                "\t                   Writes a summary to --batch-out (default batch.json, JUnit if it ends in .xml)\n"
+                "\t                   and program output to <batch-out>.logs/.\n",
+                argv[0], argv[0]);
         // clang-format on
         exit(-1);
     }
+
+    if (args.sample.clusters != 0 && args.sample.warmup + args.sample.window > args.sample.interval)
+    {
+        fprintf(stderr, "sample warm-up and window must not be longer than the sample interval\n");
+        exit(-1);
+    }
+
+    if (args.ladder.interval != 0 && args.ladder.warmup > args.ladder.interval)
+    {
+        fprintf(stderr, "ladder warm-up must not be longer than the ladder interval\n");
+        exit(-1);
+    }
+
+    // Rollback snapshots only cover a single continuous run
+    if (args.cosimRollback != 0 && (args.sample.clusters != 0 || args.fuzz || !args.batchList.empty()))
+    {
+        fprintf(stderr, "cosim rollback does not work with sampling, fuzzing or batch mode\n");
+        exit(-1);
+    }
+
+    // Outputs covering a single continuous run of the program
+    const char* singleRunOpt = nullptr;
+    if (!args.statsOut.empty())
+        singleRunOpt = "--stats-out";
+    else if (!args.profile.empty())
+        singleRunOpt = "--profile";
+    else if (!args.profileFolded.empty())
+        singleRunOpt = "--profile-folded";
+    else if (!args.occupancy.empty())
+        singleRunOpt = "--occupancy";
+    if (singleRunOpt && !IsSingleRun(args))
+    {
+        fprintf(stderr, "%s only works for single runs\n", singleRunOpt);
+        exit(-1);
+    }
+
+    // The golden log starts at the first instruction of the program
+    if (!args.golden.empty() &&
+        (args.fastForwardInstret != 0 || !args.fastForwardSymbol.empty() || args.sample.clusters != 0 ||
+         args.ladder.interval != 0 || args.fuzz || !args.batchList.empty()))
+    {
+        fprintf(stderr, "golden log replay only works for plain runs from the start of the program\n");
+        exit(-1);
+    }
+}
+
+// Load the ELF program (and device tree) into memory. Errors go through Exit, so a batch
+// worker only fails the current program.
+static void LoadProgram(Args& args)
+{
+    // Segments are loaded at their physical address, like objcopy -O binary would.
+    uint32_t progEnd = pmem.base;
+    try
+    {
+        ElfFile elf(args.progFile);
+        symbols = elf.symbols();
+        for (auto& seg : elf.segments())
+        {
+            uint32_t dstAddr = 0x80000000 | seg.addr;
+            if (!pmem.contains(dstAddr, seg.memSize))
+            {
+                fprintf(stderr, "segment at %.8x does not fit into memory\n", seg.addr);
+                Exit(-1);
+            }
+            pmem.write(dstAddr, seg.data, seg.fileSize);
+            progEnd = std::max(progEnd, dstAddr + seg.fileSize);
+        }
+    }
+    catch (ElfError& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        Exit(-1);
+    }
+    size_t numProgBytes = progEnd - pmem.base;
+    args.programBytes = numProgBytes;
+
+    if (!args.memDumpFile.empty())
+    {
+        std::vector<uint8_t> buf(numProgBytes);
+        FILE* f = fopen(args.memDumpFile.c_str(), "w");
+        pmem.read(pmem.base, buf.data(), numProgBytes);
+        fwrite(buf.data(), sizeof(uint8_t), numProgBytes, f);
+        fclose(f);
+    }
+
+    // Device Tree
+    args.deviceTreeAddr = 0;
+    if (!args.deviceTreeFile.empty())
+    {
+        args.deviceTreeAddr = 0x80000000 + 0x4000000 - 1024 * 1024;
+        FILE* dtbFile = fopen(args.deviceTreeFile.c_str(), "rb");
+        if (!dtbFile)
+        {
+            fprintf(stderr, "could not open device tree %s\n", args.deviceTreeFile.c_str());
+            Exit(-1);
+        }
+        // Only as much as fits between the device tree address and the end of memory
+        struct stat st;
+        if (fstat(fileno(dtbFile), &st) != 0)
+            abort();
+        size_t maxSize = pmem.size - (args.deviceTreeAddr - pmem.base);
+        std::vector<uint8_t> buf(std::min<size_t>(st.st_size, maxSize));
+        size_t n = fread(buf.data(), sizeof(uint8_t), buf.size(), dtbFile);
+        pmem.write(args.deviceTreeAddr, buf.data(), n);
+        fclose(dtbFile);
+    }
 }
 
 void Initialize(int argc, char** argv, Args& args)
@@ -560,90 +1323,33 @@ void Initialize(int argc, char** argv, Args& args)
         args.progFile = "a.out";
     }
 
-    if (!args.restoreSave)
-    {
-        struct ELFSection
-        {
-            std::string name;
-            size_t addr;
-            size_t size;
-        };
-        std::vector<ELFSection> sections;
-        {
-            std::string cmd = std::string("readelf -S ") + args.progFile;
-            auto readelf = popen(cmd.c_str(), "r");
-            char* line = nullptr;
-            size_t line_size = 0;
-            while (getline(&line, &line_size, readelf) != -1)
-            {
-                auto regex =
-                    std::regex("\\s*\\[\\s*[0-9]+\\]\\s+([a-zA-Z\\.]+)\\s+([a-zA-Z]+)\\s+([0-9a-fA-F]+)\\s+([0-9a-"
-                               "fA-F]+)\\s+([0-9a-fA-F]+)");
-                std::string line_str(line);
-                free(line);
-                line = nullptr;
-
-                std::smatch smatch;
-                auto begin = std::sregex_iterator(line_str.begin(), line_str.end(), regex);
-                auto end = std::sregex_iterator();
-
-                if (begin != end)
-                {
-                    std::smatch match = *begin;
-                    if (match[2] == "PROGBITS")
-                        sections.push_back(
-                            ELFSection{match[1], std::stoul(match[3], nullptr, 16), std::stoul(match[5], nullptr, 16)});
-                }
-            }
-        }
-
-        size_t numProgBytes = 0;
-
-
-        for (auto& section : sections)
-        {
-            uint8_t* dstBytes = (uint8_t*)pram.data() + (section.addr & ~0x80000000);
-            size_t maxSize = pram.size() * sizeof(uint32_t) - (dstBytes - (uint8_t*)pram.data());
-
-            auto filename = section.name + ".bin";
-            auto cmd = (TOOLCHAIN "objcopy -I elf32-little -j ") + section.name +
-                       (" -O binary " + args.progFile + " " + filename);
-            if (system(cmd.c_str()) == -1)
-                abort();
+    if (!args.restoreSave && !args.progFile.empty())
+        LoadProgram(args);
 
-            FILE* f = fopen(filename.c_str(), "rb");
-            if (!f)
-                abort();
-            numProgBytes += fread(dstBytes, sizeof(uint8_t), maxSize, f);
-            fclose(f);
-        }
-        args.programBytes = numProgBytes;
-
-        if (!args.memDumpFile.empty())
+    if (!args.fastForwardSymbol.empty() && !args.progFile.empty())
+    {
+        args.fastForwardPC = symbols.lookup(args.fastForwardSymbol);
+        if (args.fastForwardPC == 0)
         {
-            FILE* f = fopen(args.memDumpFile.c_str(), "w");
-            fwrite(&pram[0], sizeof(uint32_t), numProgBytes, f);
-            fclose(f);
+            fprintf(stderr, "could not find symbol %s\n", args.fastForwardSymbol.c_str());
+            exit(-1);
         }
+    }
 
-        // Device Tree
-        args.deviceTreeAddr = 0;
-        if (!args.deviceTreeFile.empty())
+    if (!args.stopSymbol.empty() && !args.progFile.empty())
+    {
+        args.stopPC = symbols.lookup(args.stopSymbol);
+        if (args.stopPC == 0)
         {
-            args.deviceTreeAddr = 0x80000000 + 0x4000000 - 1024 * 1024;
-            FILE* dtbFile = fopen(args.deviceTreeFile.c_str(), "rb");
-            if (!dtbFile)
-                abort();
-            fread((char*)pram.data() + args.deviceTreeAddr - 0x80000000, sizeof(uint8_t),
-                  (pram.size() * sizeof(uint32_t)) - (args.deviceTreeAddr - 0x80000000), dtbFile);
-            fclose(dtbFile);
+            fprintf(stderr, "could not find symbol %s\n", args.stopSymbol.c_str());
+            exit(-1);
         }
     }
 }
 
-void LogPerf(VTop_Core* core)
+static PerfCounters ReadPerfCounters()
 {
-    std::array<uint64_t, 16> counters = {
+    return {
         wrap->csr->mcycle,          wrap->csr->minstret,        wrap->csr->mhpmcounter[3],
         wrap->csr->mhpmcounter[4],  wrap->csr->mhpmcounter[5],
 
@@ -653,13 +1359,15 @@ void LogPerf(VTop_Core* core)
         wrap->csr->mhpmcounter[12], wrap->csr->mhpmcounter[13], wrap->csr->mhpmcounter[14],
         wrap->csr->mhpmcounter[15], wrap->csr->mhpmcounter[16],
 
+        wrap->csr->mhpmcounter[17], wrap->csr->mhpmcounter[18], wrap->csr->mhpmcounter[19],
+        wrap->csr->mhpmcounter[20], wrap->csr->mhpmcounter[21], wrap->csr->mhpmcounter[22],
+        wrap->csr->mhpmcounter[23], wrap->csr->mhpmcounter[24], wrap->csr->mhpmcounter[25],
     };
-    static std::array<uint64_t, 16> lastCounters;
-
-    std::array<uint64_t, 16> current;
-    for (size_t i = 0; i < counters.size(); i++)
-        current[i] = counters[i] - lastCounters[i];
+}
 
+static PerfCounters lastPerfCounters;
+static void PrintPerf(const PerfCounters& current)
+{
     double ipc = (double)current[1] / current[0];
     double mpki = (double)current[4] / (current[1] / 1000.0);
     double bmrate = ((double)current[3] / current[2]) * 100.0;
@@ -682,38 +1390,309 @@ void LogPerf(VTop_Core* core)
             100. * current[7] / current[4], current[8], 100. * current[8] / current[4], current[9],
             100. * current[9] / current[4], current[10], 100. * current[10] / current[4]);
 
-    lastCounters = counters;
+    // Top-down tree, in slots (mhpmcounter17 to mhpmcounter25)
+    auto td = [&](const char* name, uint64_t slots) {
+        fprintf(stderr, "%-20s%lu # %f%%\n", name, slots, 100. * slots / (4 * current[0]));
+    };
+    td("retiring:", current[16]);
+    td("bad speculation:", current[17] + current[18]);
+    td("  mispredict:", current[17]);
+    td("  ordering flush:", current[18]);
+    td("frontend bound:", current[19] + current[20] + current[21] + current[22]);
+    td("  icache miss:", current[19]);
+    td("  itlb miss:", current[20]);
+    td("  btb bubble:", current[21]);
+    td("  other:", current[22]);
+    td("backend bound:", current[23] + current[24]);
+    td("  memory:", current[23]);
+    td("  core:", current[24]);
 }
 
-void Save(std::string fileName)
+void LogPerf(VTop_Core* core)
 {
-    wrap->save_model(fileName);
-#if defined(COSIM) | defined(KONATA)
-    FILE* f = fopen((fileName + "_cosim").c_str(), "wb");
-    if (fwrite(pram.data(), sizeof(uint32_t), pram.size(), f) != pram.size())
-        abort();
-    if (fwrite(&state, sizeof(state), 1, f) != 1)
-        abort();
+    PerfCounters counters = ReadPerfCounters();
 
-    for (auto* model : simif.models)
-        model->Save(f);
+    PerfCounters current;
+    for (size_t i = 0; i < counters.size(); i++)
+        current[i] = counters[i] - lastPerfCounters[i];
 
-    fclose(f);
-#endif
+    PrintPerf(current);
+    lastPerfCounters = counters;
 }
 
-void Restore(std::string fileName)
+static void RoiStart(uint64_t minstret)
 {
-    wrap->restore_model(fileName);
-#if defined(COSIM) | defined(KONATA)
-    FILE* f = fopen((fileName + "_cosim").c_str(), "rb");
-    if (fread(pram.data(), sizeof(uint32_t), pram.size(), f) != pram.size())
-        abort();
-    if (fread(&state, sizeof(state), 1, f) != 1)
-        abort();
-
-    for (auto* model : simif.models)
-        model->Restore(f);
+    fprintf(stderr, "ROI %lu start at instret %lu\n", roi.regions, minstret);
+    roi.active = true;
+    roi.start = ReadPerfCounters();
+    // Checkpoints (with --backup-file) restart right at the beginning of the ROI
+    roi.save = true;
+}
+
+static void RoiStop(uint64_t minstret)
+{
+    fprintf(stderr, "ROI %lu end at instret %lu\n", roi.regions, minstret);
+    auto counters = ReadPerfCounters();
+    for (size_t i = 0; i < counters.size(); i++)
+        roi.counters[i] += counters[i] - roi.start[i];
+    roi.active = false;
+    roi.regions++;
+}
+
+// Checkpoints are written as chains <stem>-<seq>.backup, each storing only memory pages
+// modified since the previous one. Every CKPT_CHAIN_LEN checkpoints a full one is written,
+// and chains older than the previously linked one are deleted. <stem>.backup links to the newest.
+constexpr uint32_t CKPT_CHAIN_LEN = 16;
+// The first checkpoint of a run is always a full one
+static uint32_t ckptSeq = 0;
+
+static std::string CheckpointName(std::string stem, uint32_t seq)
+{
+    return stem + "-" + std::to_string(seq) + ".backup";
+}
+
+static std::string BaseName(std::string path)
+{
+    size_t slash = path.rfind('/');
+    return (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+static std::string CheckpointStem(std::string fileName)
+{
+    if (fileName.size() >= 7 && fileName.compare(fileName.size() - 7, 7, ".backup") == 0)
+        fileName.resize(fileName.size() - 7);
+    return fileName;
+}
+
+// Chains that <stem>.backup has pointed into, oldest first
+static std::string ckptLinkedStem;
+static std::deque<uint32_t> ckptLinkedChains;
+
+// Delete chains older than the one linked before the current one. Chains do not follow
+// each other directly after restores and failures, so only chains that were linked count.
+static void PruneCheckpoints(std::string stem, uint32_t seq)
+{
+    if (stem != ckptLinkedStem)
+    {
+        ckptLinkedStem = stem;
+        ckptLinkedChains.clear();
+    }
+    uint32_t chain = seq / CKPT_CHAIN_LEN;
+    if (ckptLinkedChains.empty() || ckptLinkedChains.back() != chain)
+        ckptLinkedChains.push_back(chain);
+
+    while (ckptLinkedChains.size() > 2)
+    {
+        uint32_t old = ckptLinkedChains.front();
+        ckptLinkedChains.pop_front();
+        for (uint32_t i = old * CKPT_CHAIN_LEN; i < (old + 1) * CKPT_CHAIN_LEN; i++)
+            unlink(CheckpointName(stem, i).c_str());
+    }
+}
+
+// Point <stem>.backup at the newest completed checkpoint. Pruning only happens once the
+// link has moved on, so it never resolves into a deleted chain.
+static void LinkCheckpoint(std::string fileName, uint32_t seq)
+{
+    std::string stem = CheckpointStem(fileName);
+    unlink(fileName.c_str());
+    if (symlink(BaseName(CheckpointName(stem, seq)).c_str(), fileName.c_str()) != 0)
+    {
+        perror("could not link checkpoint");
+        return;
+    }
+    PruneCheckpoints(stem, seq);
+}
+
+static void LogCheckpoint(std::string fileName, std::string name, uint64_t mainTime, uint64_t minstret,
+                          double seconds, bool ok)
+{
+    FILE* f = fopen((fileName + ".log").c_str(), "a");
+    if (!f)
+        return;
+    fprintf(f, "%s main_time=%lu minstret=%lu time=%.3fs %s\n", BaseName(name).c_str(), mainTime, minstret, seconds,
+            ok ? "ok" : "FAILED");
+    fclose(f);
+}
+
+// Serialize the current state into checkpoint seq. The file is written under a temporary
+// name and renamed when complete, so a crash never leaves a truncated checkpoint behind.
+static void WriteCheckpoint(std::string stem, uint32_t seq)
+{
+    bool full = (seq % CKPT_CHAIN_LEN) == 0;
+    std::string name = CheckpointName(stem, seq);
+    CheckpointWriter ckpt(name + ".tmp", seq, full ? "" : BaseName(CheckpointName(stem, seq - 1)));
+
+    std::vector<uint8_t> modelState;
+    wrap->save_model(modelState);
+    ckpt.add_blob(CKPT_MODEL, modelState);
+    ckpt.add_pages(CKPT_MEM, *rtlMem, full);
+
+#if defined(COSIM) | defined(KONATA)
+    if (rtlMem != &pmem)
+        ckpt.add_pages(CKPT_COSIM_MEM, pmem, full);
+
+    char* cosimBuf;
+    size_t cosimLen;
+    FILE* f = open_memstream(&cosimBuf, &cosimLen);
+    if (fwrite(&state, sizeof(state), 1, f) != 1)
+        abort();
+
+    for (auto* model : simif.models)
+        model->Save(f);
+
+    fclose(f);
+    ckpt.add_blob(CKPT_COSIM, (uint8_t*)cosimBuf, cosimLen);
+    free(cosimBuf);
+#endif
+    ckpt.close();
+
+    if (rename((name + ".tmp").c_str(), name.c_str()) != 0)
+        abort();
+}
+
+// Checkpoints being written by forked children, oldest first
+struct PendingCheckpoint
+{
+    pid_t pid;
+    uint32_t seq;
+    std::string fileName;
+    std::string name;
+    uint64_t mainTime;
+    uint64_t minstret;
+    std::chrono::steady_clock::time_point start;
+};
+static std::deque<PendingCheckpoint> pendingCheckpoints;
+// Newest checkpoint that failed, or -1. Incremental checkpoints later in its chain may
+// already have been forked; they are unusable and must never be linked.
+static int64_t ckptFailedSeq = -1;
+
+static bool CheckpointBroken(uint32_t seq)
+{
+    return ckptFailedSeq >= 0 && seq > ckptFailedSeq && seq / CKPT_CHAIN_LEN == ckptFailedSeq / CKPT_CHAIN_LEN;
+}
+
+// Reap finished checkpoint processes in order. With block, wait for at least the oldest one.
+static void ReapCheckpoints(bool block)
+{
+    while (!pendingCheckpoints.empty())
+    {
+        auto& p = pendingCheckpoints.front();
+        int status;
+        pid_t r = waitpid(p.pid, &status, block ? 0 : WNOHANG);
+        if (r == 0)
+            break;
+        block = false;
+
+        bool ok = r == p.pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - p.start).count();
+        if (ok && CheckpointBroken(p.seq))
+        {
+            fprintf(stderr, "checkpoint %s depends on failed checkpoint %ld\n", p.name.c_str(), ckptFailedSeq);
+            unlink(p.name.c_str());
+            ok = false;
+        }
+        else if (!ok)
+        {
+            fprintf(stderr, "checkpoint %s failed\n", p.name.c_str());
+            unlink((p.name + ".tmp").c_str());
+            ckptFailedSeq = p.seq;
+            // Later checkpoints in this chain are useless, start a new one.
+            if (ckptSeq / CKPT_CHAIN_LEN == p.seq / CKPT_CHAIN_LEN)
+                ckptSeq = (ckptSeq / CKPT_CHAIN_LEN + 1) * CKPT_CHAIN_LEN;
+        }
+        LogCheckpoint(p.fileName, p.name, p.mainTime, p.minstret, seconds, ok);
+        if (ok)
+            LinkCheckpoint(p.fileName, p.seq);
+        pendingCheckpoints.pop_front();
+    }
+}
+
+void WaitCheckpoints()
+{
+    while (!pendingCheckpoints.empty())
+        ReapCheckpoints(true);
+}
+
+// Save a checkpoint. With jobs != 0, the checkpoint is written by a forked child from its
+// copy-on-write snapshot while simulation continues, with at most jobs children at a time.
+// The child must not eval the model (Verilator's worker threads do not exist after fork).
+void Save(std::string fileName, uint32_t jobs = 0)
+{
+    SyncCosim();
+    uint32_t seq = ckptSeq++;
+    std::string stem = CheckpointStem(fileName);
+    std::string name = CheckpointName(stem, seq);
+    auto start = std::chrono::steady_clock::now();
+
+    pid_t pid = -1;
+    if (jobs != 0)
+    {
+        ReapCheckpoints(false);
+        while (pendingCheckpoints.size() >= jobs)
+            ReapCheckpoints(true);
+
+        fflush(stdout);
+        fflush(stderr);
+        pid = fork();
+        if (pid == 0)
+        {
+            WriteCheckpoint(stem, seq);
+            _exit(0);
+        }
+        if (pid < 0)
+            perror("fork failed, checkpointing synchronously");
+    }
+
+    if (pid > 0)
+    {
+        // The child has its own copy of the dirty bits
+        rtlMem->clear_dirty();
+        pmem.clear_dirty();
+        pendingCheckpoints.push_back(
+            PendingCheckpoint{pid, seq, fileName, name, wrap->main_time, wrap->csr->minstret, start});
+    }
+    else
+    {
+        // If fork failed, the parent of this checkpoint may still be pending
+        WaitCheckpoints();
+        bool ok = !CheckpointBroken(seq);
+        if (ok)
+            WriteCheckpoint(stem, seq);
+        else
+            fprintf(stderr, "checkpoint %s depends on failed checkpoint %ld\n", name.c_str(), ckptFailedSeq);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        LogCheckpoint(fileName, name, wrap->main_time, wrap->csr->minstret, seconds, ok);
+        if (ok)
+            LinkCheckpoint(fileName, seq);
+    }
+
+#if defined(COSIM) | defined(KONATA)
+    // Spike caches host pointers into pmem in its TLB, so pages are only marked dirty
+    // on TLB refill. Flush to catch all writes until the next checkpoint.
+    if (rtlMem != &pmem)
+        simif.processor->get_mmu()->flush_tlb();
+#endif
+}
+
+void Restore(const Checkpoint& ckpt)
+{
+    // Continue numbering after the restored checkpoint, starting a new chain
+    ckptSeq = (ckpt.seq / CKPT_CHAIN_LEN + 1) * CKPT_CHAIN_LEN;
+    wrap->restore_model(ckpt.blob(CKPT_MODEL));
+    ckpt.restore_pages(CKPT_MEM, *rtlMem);
+
+#if defined(COSIM) | defined(KONATA)
+    if (rtlMem != &pmem)
+        ckpt.restore_pages(CKPT_COSIM_MEM, pmem);
+
+    auto& cosim = ckpt.blob(CKPT_COSIM);
+    FILE* f = fmemopen((void*)cosim.data(), cosim.size(), "rb");
+    if (fread(&state, sizeof(state), 1, f) != 1)
+        abort();
+
+    for (auto* model : simif.models)
+        model->Restore(f);
 
     fclose(f);
 
@@ -730,68 +1709,469 @@ void Restore(std::string fileName)
 #endif
 }
 
-void run_sim(Args& args, uint64_t timeout = 0)
+static void FastForward(Args& args)
 {
-    wrap->top->clk = 0;
+    if (args.deviceTreeAddr != 0)
+        simif.write_reg(11, args.deviceTreeAddr);
+
+    uint64_t instret = simif.fast_forward(args.fastForwardInstret, args.fastForwardPC);
+    fprintf(stderr, "fast-forwarded %lu instructions to pc=%.8x\n", instret, simif.get_pc());
+
+    if (simif.functionalHalt)
+    {
+        fprintf(stderr, "halted while fast-forwarding\n");
+        Exit(0);
+    }
+}
+
+// Run the program functionally in Spike and record each step into a golden log.
+static void run_golden_record(Args& args)
+{
+    simif.riscvTestMode = args.testMode;
+    if (args.deviceTreeAddr != 0)
+        simif.write_reg(11, args.deviceTreeAddr);
+
+    GoldenLogWriter log(args.goldenRecord);
+    auto state = simif.processor->get_state();
+    GoldenEntry e = {};
+    uint64_t instret = 0;
+    bool pending = false;
+    bool done = false;
+    bool asyncInterrupts = false;
+
+    // Spike's commit log still holds the previous step when the next one starts
+    auto finish = [&]() {
+        pending = false;
+        if (state->minstret->read() == instret)
+        {
+            e.flags |= GOLD_TRAP;
+            e.cause = state->prv == PRV_M ? state->mcause->read() : state->scause->read();
+            // Interrupts are taken instead of executing an instruction
+            if ((e.cause >> 31) & 1)
+                e.flags = (e.flags & ~GOLD_RVC) | GOLD_INTERRUPT;
+        }
+
+        if (!(e.flags & GOLD_INTERRUPT))
+            for (auto& write : state->log_reg_write)
+            {
+                size_t reg = write.first >> 4;
+                if ((write.first & 0xf) == 0 && reg != 0)
+                {
+                    e.flags |= GOLD_RD;
+                    e.rd = reg;
+                    e.value = state->XPR[reg];
+                }
+            }
+
+        Inst inst = {};
+        inst.inst = e.inst;
+        // Counter reads and failed sc.w are timing-dependent
+        if (SpikeSimif::is_pass_thru_inst(inst) || SpikeSimif::is_store_conditional(e.inst))
+            e.flags |= GOLD_NONDET;
+
+        for (auto& read : state->log_mem_read)
+        {
+            uint32_t phy = simif.get_phy_addr(std::get<0>(read), LOAD);
+            if (phy >= 0x10000000 && phy < 0x12000000)
+                e.flags |= GOLD_NONDET;
+            if (e.numLoads < GoldenEntry::MAX_ACCESSES)
+                e.loads[e.numLoads++] = {phy, 0, (uint8_t)std::get<2>(read)};
+        }
+        for (auto& write : state->log_mem_write)
+        {
+            uint32_t phy = simif.get_phy_addr(std::get<0>(write), STORE);
+            uint32_t data = std::get<1>(write);
+            if (e.numStores < GoldenEntry::MAX_ACCESSES)
+                e.stores[e.numStores++] = {phy, data, (uint8_t)std::get<2>(write)};
+            if (simif.riscvTestMode && GoldenTestStore(phy, data, simif.riscvTestReturn))
+                done = true;
+        }
+
+        log.add(e);
+
+        // Spike's timer advances per instruction and devices are not modeled cycle-accurately,
+        // so these interrupts would be taken at different instructions in the RTL.
+        if (simif.processor->get_csr(CSR_MIE) & (MIP_MTIP | MIP_STIP | MIP_MEIP | MIP_SEIP))
+            asyncInterrupts = done = true;
+        if (done)
+            simif.functionalHalt = true;
+    };
+
+    simif.fast_forward(-1, 0, [&](uint32_t pc) {
+        if (pending)
+            finish();
+        if (done)
+            return;
+        e = {};
+        e.pc = pc;
+        try
+        {
+            e.inst = simif.processor->get_mmu()->load_insn(pc).insn.bits();
+            if ((e.inst & 3) != 3)
+            {
+                e.inst &= 0xffff;
+                e.flags |= GOLD_RVC;
+            }
+        }
+        catch (mem_trap_t)
+        {
+            e.inst = 0;
+        }
+        instret = state->minstret->read();
+        pending = true;
+    });
+    if (pending)
+        finish();
+    log.close();
+
+    if (asyncInterrupts)
+    {
+        unlink(args.goldenRecord.c_str());
+        fprintf(stderr,
+                "program enabled timer or external interrupts at instret %lu, golden logs only support programs "
+                "without them (use live cosim)\n",
+                state->minstret->read());
+        exit(-1);
+    }
+
+    fprintf(stderr, "recorded %lu steps (%lu instructions) into %s\n", log.count, state->minstret->read(),
+            args.goldenRecord.c_str());
+    if (args.testMode)
+        fprintf(stderr, "%s test with return code %.8x\n", simif.riscvTestReturn == 1 ? "PASSED" : "FAILED",
+                simif.riscvTestReturn);
+}
+
+static void ResetModels()
+{
+    for (auto* model : simif.models)
+        delete model;
     simif.models = {
         new ReturnStack(wrap->top.get(), simif.processor.get()),
         new BranchHistory(wrap->top.get(), simif.processor.get()),
     };
+}
 
-#ifdef KONATA
-    konataFile = fopen("trace_konata.txt", "w");
-    fprintf(konataFile, "Kanata	0004\n");
-#endif
-
-    auto core = wrap->core;
+static void LoadMemory()
+{
+    // Only touched pages are copied
+    if (rtlMem != &pmem)
+        *rtlMem = pmem;
+}
 
-    simif.riscvTestMode = args.testMode;
-    DEBUG_TIME = args.debugTime;
+// Take a rollback snapshot at the end of a cycle, once Spike has checked all committed
+// instructions. The snapshot is only useful if the state agrees, so compare all registers.
+static void TakeCosimSnapshot()
+{
+    SyncCosim();
+    CosimRecord rec;
+    rec.inst = state.insts[state.lastComSqN];
+    rec.time = wrap->main_time;
+    rec.check = CHECK_FULL;
+    for (size_t i = 0; i < 32; i++)
+        rec.regs[i] = registers.ReadRegister(i);
+    if (!simif.compare_state(rec))
+        CosimError(-4, rec, simif.get_pc(), true);
+
+    bool first = !cosimSnap;
+    if (first)
+        cosimSnap = std::make_unique<CosimSnapshot>();
+    auto& snap = *cosimSnap;
+    wrap->save_model(snap.model);
+    if (snap.model.empty())
+    {
+        fprintf(stderr, "cosim rollback requires a SAVEABLE build, disabled\n");
+        cosimSnap.reset();
+        cosimRollbackInterval = 0;
+        return;
+    }
 
-    if (args.restoreSave)
+    // Only pages written since the last snapshot are copied
+    if (first)
     {
-        Restore(args.progFile);
-        simif.doRestore = true;
+        snap.pmem = pmem;
+        snap.rtlMem = *rtlMem;
+        pmem.clear_dirty(SparseMemory::DIRTY_SNAPSHOT);
+        rtlMem->clear_dirty(SparseMemory::DIRTY_SNAPSHOT);
     }
     else
     {
-        for (size_t i = 0; i < (1 << 24); i++)
-            wrap->top->Top->extMem->mem[i >> 2][i & 3] = pram[i];
+        pmem.commit_dirty(snap.pmem);
+        rtlMem->commit_dirty(snap.rtlMem);
+    }
+    // Spike writes through host pointers cached in its TLB, which only marks pages dirty on refill
+    simif.processor->get_mmu()->flush_tlb();
+
+    snap.spike = simif.save_arch();
+    snap.harness = state;
+    snap.regTagOverride = registers.regTagOverride;
+    snap.riscvTestReturn = simif.riscvTestReturn;
+    snap.minstret = wrap->csr->minstret;
+
+    char* buf;
+    size_t len;
+    FILE* f = open_memstream(&buf, &len);
+    for (auto* model : simif.models)
+        model->Save(f);
+    fclose(f);
+    snap.models.assign(buf, buf + len);
+    free(buf);
 
-        wrap->Reset();
+    cosimNextSnapshot = snap.minstret + cosimRollbackInterval;
+}
+
+static void RollbackCosim()
+{
+    cosimCanRollback = false;
+    cosimRolledBack = true;
+    if (asyncCosim)
+        asyncCosim->reset();
+
+    auto& snap = *cosimSnap;
+    pmem.revert_dirty(snap.pmem);
+    rtlMem->revert_dirty(snap.rtlMem);
+    wrap->restore_model(snap.model);
+
+    simif.restore_arch(snap.spike);
+    simif.processor->get_mmu()->flush_tlb();
+    simif.processor->get_mmu()->flush_icache();
+    simif.riscvTestReturn = snap.riscvTestReturn;
+    simif.doRestore = false;
+
+    state = snap.harness;
+    registers.regTagOverride = snap.regTagOverride;
+    ResetModels();
+    FILE* f = fmemopen(snap.models.data(), snap.models.size(), "rb");
+    for (auto* model : simif.models)
+        model->Restore(f);
+    fclose(f);
+    lastPerfCounters = ReadPerfCounters();
+
+    // Models keep their setting, they only agree if they saw every instruction
+    cosimTier = CHECK_FULL;
+    cosimSweepNext = true;
+    flight.clear();
+}
+
+// LogInstructions follows every instruction through the pipeline. It is only needed if
+// something consumes commits or pipeline events, pure performance runs skip it.
+static bool NeedLogInstructions()
+{
+#if defined(COSIM) | defined(KONATA)
+    return true;
+#else
+    return golden || fuzzEdges || traceWindows.needs_commits() || roi.enabled || stopPC != 0 || profile.is_open() ||
+           flight.enabled();
+#endif
+}
+
+// Log the instructions of the cycle that just started. Returns false if cosim rolled back
+// to a snapshot, in which case main_time jumped back.
+static bool ObserveCycle()
+{
+    cosimCanRollback = true;
+    try
+    {
+        LogInstructions();
+        if (cosimRollbackInterval != 0 && !cosimRolledBack && wrap->csr->minstret >= cosimNextSnapshot)
+            TakeCosimSnapshot();
+    }
+    catch (const CosimRollback&)
+    {
+        RollbackCosim();
+        return false;
     }
+    cosimCanRollback = false;
+    return true;
+}
 
-    if (args.deviceTreeAddr != 0)
-        WriteRegister(11, args.deviceTreeAddr);
+// The RTL runs for this many half cycles back to back. Housekeeping (input, hang detection,
+// perf counters, backups) only happens between batches, at fixed multiples of main_time.
+static constexpr uint64_t BATCH_HALF_CYCLES = 0x800;
+static constexpr uint64_t HANG_CHECK_HALF_CYCLES = 0x20000;
+static constexpr uint64_t BACKUP_HALF_CYCLES = 0x1000000;
+
+// With --idle-skip, cycles in which the core only waits for an interrupt are not evaluated.
+// Once the core has been in WFI for a while and nothing but the counters changes from cycle
+// to cycle, the rest of the wait is skipped and mtime, mcycle and the perf counters are
+// advanced by what they would have counted. The wait ends when the frontend's WFI window
+// runs out or mtime reaches mtimecmp, a skip stops a few cycles short of either.
+struct IdleSkip
+{
+    // Cycles with the same counter increments before skipping, to let memory traffic drain
+    static constexpr uint64_t SETTLE_CYCLES = 64;
+    // Cycles evaluated again before the wait ends
+    static constexpr uint64_t MARGIN_CYCLES = 4;
+    // mtime, mcycle, minstret, mhpmcounter3 to mhpmcounter25
+    static constexpr size_t NUM_COUNTERS = 26;
+
+    uint64_t idleCycles = 0;
+    std::array<uint64_t, NUM_COUNTERS> last;
+    std::array<uint64_t, NUM_COUNTERS> delta;
+};
+static uint64_t idleSkipped = 0;
+
+static std::array<uint64_t, IdleSkip::NUM_COUNTERS> ReadIdleCounters()
+{
+    std::array<uint64_t, IdleSkip::NUM_COUNTERS> c;
+    c[0] = wrap->top->Top->soc->mmio->aclint->mtime;
+    c[1] = wrap->csr->mcycle;
+    c[2] = wrap->csr->minstret;
+    for (size_t i = 3; i < c.size(); i++)
+        c[i] = wrap->csr->mhpmcounter[i];
+    return c;
+}
+
+static void WriteIdleCounters(const std::array<uint64_t, IdleSkip::NUM_COUNTERS>& c)
+{
+    wrap->top->Top->soc->mmio->aclint->mtime = c[0];
+    wrap->csr->mcycle = c[1];
+    for (size_t i = 3; i < c.size(); i++)
+        wrap->csr->mhpmcounter[i] = c[i];
+}
+
+// Called on every rising edge. end is the end of the current batch, which is not skipped over.
+static void SkipIdle(IdleSkip& idle, uint64_t end)
+{
+    auto ifetch = wrap->core->ifetch;
+    if (!ifetch->waitForInterrupt)
+    {
+        idle.idleCycles = 0;
+        return;
+    }
+
+    auto counters = ReadIdleCounters();
+    std::array<uint64_t, IdleSkip::NUM_COUNTERS> delta;
+    for (size_t i = 0; i < delta.size(); i++)
+        delta[i] = counters[i] - idle.last[i];
+    idle.last = counters;
+
+    if (idle.idleCycles == 0 || delta != idle.delta || delta[2] != 0)
+    {
+        idle.delta = delta;
+        idle.idleCycles = 1;
+        return;
+    }
+    if (++idle.idleCycles < IdleSkip::SETTLE_CYCLES)
+        return;
+
+    uint64_t cycles = ifetch->wfiCount;
+    auto aclint = wrap->top->Top->soc->mmio->aclint;
+    if (aclint->mtimecmp > aclint->mtime)
+        cycles = std::min(cycles, aclint->mtimecmp - aclint->mtime);
+    cycles = std::min(cycles, (end - wrap->main_time) / 2);
+    if (cycles <= IdleSkip::MARGIN_CYCLES)
+        return;
+    cycles -= IdleSkip::MARGIN_CYCLES;
+
+    // Leave console input to the program, it polls the UART after waking up
+    if (wrap->top->Top->extMem->inputAvail || kbhit())
+    {
+        idle.idleCycles = 0;
+        return;
+    }
+
+    for (size_t i = 0; i < counters.size(); i++)
+        counters[i] += cycles * delta[i];
+    WriteIdleCounters(counters);
+    ifetch->wfiCount -= cycles;
+    wrap->main_time += 2 * cycles;
+
+    idle.last = counters;
+    idle.idleCycles = 0;
+    idleSkipped += cycles;
+}
+
+// Sample the occupancy of the core's queues and buffers
+static void SampleOccupancy()
+{
+    auto core = wrap->core;
+    size_t idx = 0;
+    auto add = [&](const char* name, int instance, const void* raw) {
+        auto occ = VIEW(Occupancy, raw);
+        occupancy.sample(idx++, name, instance, FIELD(occ, count), FIELD(occ, size));
+    };
+
+    add("rob", -1, &core->ROB_occupancy);
+    for (size_t i = 0; i < LEN(core->IQ_occupancy); i++)
+        add("iq", i, &core->IQ_occupancy[i]);
+    for (size_t i = 0; i < LEN(core->IQ_stDataOccupancy); i++)
+        add("store_data_iq", i, &core->IQ_stDataOccupancy[i]);
+    add("load_buffer", -1, &core->LB_occupancy);
+    add("store_queue", -1, &core->SQ_occupancy);
+    for (size_t i = 0; i < LEN(core->LSU_lrbOccupancy); i++)
+        add("load_result_buf", i, &core->LSU_lrbOccupancy[i]);
+    for (size_t i = 0; i < LEN(core->AGU_tmqOccupancy); i++)
+        add("tlb_miss_queue", i, &core->AGU_tmqOccupancy[i]);
+    add("dcache_misses", -1, &core->CLM_missOccupancy);
+}
+
+// Run the RTL until it halts, times out or minstret reaches stopInstret.
+static void MainLoop(Args& args, uint64_t timeout, uint64_t stopInstret = -1)
+{
+    auto core = wrap->core;
+    bool observe = NeedLogInstructions();
+    IdleSkip idle;
 
     const uint64_t perfInterval = 1024 * 1024 * 8;
     uint64_t lastMInstret = wrap->csr->minstret;
     uint64_t nextMinstretPerf = wrap->csr->minstret + perfInterval;
 
-    // Run
-    wrap->top->en = 1;
-    while (!Verilated::gotFinish())
+    bool stop = wrap->top->OUT_halt;
+    wrap->top->en = !stop;
+    while (!stop && !Verilated::gotFinish())
     {
-        if (wrap->top->OUT_halt)
+        uint64_t end = (wrap->main_time & ~(BATCH_HALF_CYCLES - 1)) + BATCH_HALF_CYCLES;
+        if (timeout != 0)
+            end = std::min(end, std::max(timeout + 1, wrap->main_time + 1));
+
+        while (wrap->main_time < end)
         {
-            wrap->top->en = 0;
-            break;
+            wrap->HalfCycle();
+            if (wrap->top->clk != 1)
+                continue;
+
+            if (observe && !ObserveCycle())
+                break;
+            if (occupancy.is_open() && (!roi.enabled || roi.active) && occupancy.due())
+                SampleOccupancy();
+            if (traceWindows.armed())
+                traceWindows.cycle(wrap->main_time, wrap->csr->minstret);
+            if (Verilated::gotFinish())
+            {
+                stop = true;
+                break;
+            }
+            if (wrap->top->OUT_halt)
+            {
+                wrap->top->en = 0;
+                stop = true;
+                break;
+            }
+            if (stopInstret != (uint64_t)-1 && wrap->csr->minstret >= stopInstret)
+            {
+                stop = true;
+                break;
+            }
+            if (stopHit)
+            {
+                stop = true;
+                break;
+            }
+            if (args.idleSkip)
+                SkipIdle(idle, end);
         }
+        if (stop)
+            break;
 
-        wrap->HalfCycle();
-
-        if (wrap->top->clk == 1)
-            LogInstructions();
-
-        // Input
-        if ((wrap->main_time & 0xff) == 0)
-            HandleInput();
+        // Housekeeping
+        HandleInput();
 
-        if (wrap->top->clk == 1 && timeout != 0 && wrap->main_time > timeout)
+        if (timeout != 0 && wrap->main_time > timeout)
             break;
 
         // Hang Detection
-        if ((wrap->main_time & (0x1ffff)) == 0 && !args.restoreSave && !core->ifetch->waitForInterrupt)
+        if ((wrap->main_time & (HANG_CHECK_HALF_CYCLES - 1)) == 0 && !args.restoreSave &&
+            !core->ifetch->waitForInterrupt)
         {
             uint64_t minstret = wrap->csr->minstret;
             if (minstret == lastMInstret)
@@ -799,62 +2179,1189 @@ void run_sim(Args& args, uint64_t timeout = 0)
                 fprintf(stderr, "ERROR: Hang detected\n");
                 fprintf(stderr, "ROB_curSqN=%x\n", core->ROB_curSqN);
                 DumpState(stderr, (Inst){});
+                lastErrorCode = HANG_ERROR;
+                lastErrorPC = 0;
                 Exit(-1);
             }
             lastMInstret = minstret;
         }
         if (wrap->csr->minstret >= nextMinstretPerf)
         {
-            if (args.logPerformance)
+            if (args.logPerformance && (!roi.enabled || roi.active))
                 LogPerf(core);
             nextMinstretPerf = wrap->csr->minstret + perfInterval;
         }
-        if ((wrap->main_time & 0xffffff) == 0)
+        if (stats.is_open() && stats.due(wrap->csr->mcycle, wrap->csr->minstret))
+            stats.sample(ReadPerfCounters());
+        if ((wrap->main_time & (BACKUP_HALF_CYCLES - 1)) == 0 || roi.save)
         {
-            if (!args.backupFile.empty())
-                Save(args.backupFile);
+            if (!args.backupFile.empty() && (!roi.enabled || roi.active))
+                Save(args.backupFile, args.backupJobs);
+            roi.save = false;
         }
         args.restoreSave = 0;
     }
+    SyncCosim();
+}
 
-    // Run a few more cycles ...
-    for (int i = 0; i < 128; i = i + 1)
-    {
-        wrap->HalfCycle();
-    }
+// Instructions [start, end) of a ladder checkpoint are measured, the instructions before
+// start (from where the checkpoint was taken) are detailed warm-up.
+struct LadderInterval
+{
+    uint64_t start;
+    uint64_t end;
+};
 
-    LogPerf(core);
-    printf("%lu cycles\n", wrap->main_time / 2);
+// Resume from a functional checkpoint, with the same handoff as after fast-forwarding.
+static void RestoreArch(const Checkpoint& ckpt)
+{
+    auto& blob = ckpt.blob(CKPT_ARCH);
+    if (blob.size() != sizeof(ArchState))
+        abort();
+    ArchState arch;
+    memcpy(&arch, blob.data(), sizeof(arch));
+
+    ckpt.restore_pages(CKPT_MEM, pmem);
+    simif.restore_arch(arch);
+    LoadMemory();
+    wrap->Reset();
+    simif.restore_to_top(*wrap);
+    lastPerfCounters = ReadPerfCounters();
 }
 
-void run_fuzz(Args& args)
+static void WriteIntervalPerf(std::string fileName)
 {
-    TestCase testCase;
-    testCase.load((uint8_t*)pram.data(), args.programBytes);
+    PerfCounters counters = ReadPerfCounters();
+    FILE* f = fopen(fileName.c_str(), "w");
+    if (!f)
+        abort();
+    for (size_t i = 0; i < counters.size(); i++)
+        fprintf(f, "%lu ", counters[i] - lastPerfCounters[i]);
+    fprintf(f, "\n");
+    fclose(f);
+}
 
-    static Args argsC = args;
+// Trace windows need the program's symbols. Without any, KONATA builds trace the whole run
+// (or the ROI).
+static void SetupTraceWindows(Args& args)
+{
+    traceWindows.reset();
+    if (args.debugTime != (uint64_t)-1)
+        traceWindows.add(TraceWindow{{TraceTrigger::TIME, args.debugTime + 1}, {}});
+    for (auto& spec : args.traceWindows)
+        traceWindows.add(TraceWindows::parse(spec, symbols));
+#ifdef KONATA
+    if (!traceWindows.armed())
+        traceWindows.add(args.roi ? TraceWindows::parse("roi", symbols) : TraceWindow{{TraceTrigger::TIME, 0}, {}});
+#endif
+}
 
-    class FuzzerImpl : public Fuzzer
+// Simulate from the current state until halt, timeout or the end of the ladder interval.
+static void FinishSim(Args& args, uint64_t timeout, LadderInterval interval = {})
+{
+    auto core = wrap->core;
+    if (interval.end != 0)
     {
-        virtual RunResults run(TestCase const& test_case)
-        {
-            test_case.unpack((uint8_t*)pram.data(), pram.size());
-            wrap->main_time = 0;
-            new (&simif) SpikeSimif(pram, registers, wrap->main_time);
-            run_sim(argsC, 16384);
-            return RunResults{1, RunResultFlags::FINISHED};
-        }
-        virtual void report(TestCase const& test_case, RunResults const& results)
+        // Ladder checkpoint: detailed warm-up, then measure until the end of the interval
+        MainLoop(args, timeout, interval.start);
+        lastPerfCounters = ReadPerfCounters();
+        MainLoop(args, timeout, interval.end);
+        WriteIntervalPerf(args.progFile + ".perf");
+    }
+    else
+    {
+        // Checkpoints are only taken within the ROI, so restored runs start inside of it
+        if (roi.enabled && args.restoreSave)
         {
+            RoiStart(wrap->csr->minstret);
+            roi.save = false;
         }
-    };
-
-    FuzzerImpl fuzzer;
+        MainLoop(args, timeout, args.maxInstret != 0 ? args.maxInstret : -1);
+        if (stopHit)
+            fprintf(stderr, "stopped at pc %.8x\n", stopPC);
+        else if (args.maxInstret != 0 && wrap->csr->minstret >= args.maxInstret)
+            fprintf(stderr, "stopped at instret %lu\n", wrap->csr->minstret);
+    }
 
+    // Run a few more cycles ...
+    for (int i = 0; i < 128; i = i + 1)
+    {
+        wrap->HalfCycle();
+    }
+
+    if (stats.is_open())
+        stats.sample(ReadPerfCounters());
+    profile.close(symbols);
+    occupancy.close();
+    if (roi.active)
+        RoiStop(wrap->csr->minstret);
+    if (roi.regions != 0)
+    {
+        fprintf(stderr, "ROI (%lu regions):\n", roi.regions);
+        PrintPerf(roi.counters);
+    }
+    else
+        LogPerf(core);
+    printf("%lu cycles\n", wrap->main_time / 2);
+    if (idleSkipped != 0)
+        printf("%lu cycles skipped idle\n", idleSkipped);
+}
+
+void run_sim(Args& args, uint64_t timeout = 0)
+{
+    wrap->top->clk = 0;
+    ResetModels();
+
+#ifdef KONATA
+    konata.close();
+    konata.open(args.konataGzip ? "trace_konata.bin.gz" : "trace_konata.bin", args.konataGzip);
+#endif
+
+    simif.riscvTestMode = args.testMode;
+    DEBUG_TIME = args.debugTime;
+    SetupTraceWindows(args);
+    roi = RegionOfInterest{};
+    roi.enabled = args.roi;
+    stopPC = args.stopPC;
+    stopHit = false;
+
+    LadderInterval interval = {};
+    if (args.restoreSave)
+    {
+        Checkpoint ckpt = Checkpoint::load_chain(args.progFile);
+        if (ckpt.blobs.count(CKPT_ARCH))
+        {
+            RestoreArch(ckpt);
+            if (ckpt.blobs.count(CKPT_INTERVAL) && ckpt.blob(CKPT_INTERVAL).size() == sizeof(interval))
+                memcpy(&interval, ckpt.blob(CKPT_INTERVAL).data(), sizeof(interval));
+        }
+        else
+        {
+            Restore(ckpt);
+            simif.doRestore = true;
+        }
+    }
+    else
+    {
+        bool fastForward = args.fastForwardInstret != 0 || args.fastForwardPC != 0;
+        if (fastForward)
+            FastForward(args);
+
+        LoadMemory();
+        wrap->Reset();
+
+        if (fastForward)
+        {
+            simif.restore_to_top(*wrap);
+            lastPerfCounters = ReadPerfCounters();
+        }
+        else if (args.deviceTreeAddr != 0)
+            WriteRegister(11, args.deviceTreeAddr);
+    }
+
+    if (!args.statsOut.empty())
+        stats.open(args.statsOut, args.statsInterval, args.statsInstret, ReadPerfCounters());
+    if (!args.profile.empty() || !args.profileFolded.empty())
+        profile.open(args.profile, args.profileFolded, 1 << SqN_Bits);
+    if (!args.occupancy.empty())
+        occupancy.open(args.occupancy, args.occupancyInterval);
+    FinishSim(args, timeout, interval);
+}
+
+// Collect basic block vectors for the whole program in a forked child, running Spike only.
+static BBVProfile ProfileBBVs(Args& args)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        abort();
+
+    pid_t pid = fork();
+    if (pid < 0)
+        abort();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        // The program's console output is printed again during detailed simulation
+        if (!freopen("/dev/null", "w", stdout))
+            _exit(-1);
+
+        BBVProfiler profiler(args.sample.interval);
+        simif.fast_forward(args.sample.limit, 0, [&](uint32_t pc) { profiler.commit(pc); });
+
+        FILE* f = fdopen(fds[1], "wb");
+        size_t n = profiler.profile.intervals.size();
+        fwrite(&profiler.profile.totalInstret, sizeof(uint64_t), 1, f);
+        fwrite(&n, sizeof(size_t), 1, f);
+        fwrite(profiler.profile.intervals.data(), sizeof(BBVProfile::Vector), n, f);
+        fclose(f);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    BBVProfile profile;
+    FILE* f = fdopen(fds[0], "rb");
+    size_t n;
+    if (fread(&profile.totalInstret, sizeof(uint64_t), 1, f) != 1 || fread(&n, sizeof(size_t), 1, f) != 1)
+        abort();
+    profile.intervals.resize(n);
+    if (fread(profile.intervals.data(), sizeof(BBVProfile::Vector), n, f) != n)
+        abort();
+    fclose(f);
+    waitpid(pid, nullptr, 0);
+    return profile;
+}
+
+void run_sampled(Args& args)
+{
+    auto& cfg = args.sample;
+    const size_t SUB_WINDOWS = 10;
+
+    // Detailed windows are discarded, so the RTL must not modify Spike's memory.
+    rtlMem = &rtlMemCopy;
+
+    wrap->top->clk = 0;
+    simif.riscvTestMode = args.testMode;
+    DEBUG_TIME = args.debugTime;
+    SetupTraceWindows(args);
+    if (args.deviceTreeAddr != 0)
+        simif.write_reg(11, args.deviceTreeAddr);
+
+    auto profile = ProfileBBVs(args);
+    auto points = SelectSimPoints(profile.intervals, cfg.clusters);
+    fprintf(stderr, "profiled %lu instructions in %zu intervals, simulating %zu simpoints\n", profile.totalInstret,
+            profile.intervals.size(), points.size());
+
+    for (auto& point : points)
+    {
+        uint64_t start = point.interval * cfg.interval;
+        uint64_t warmStart = start - std::min(start, cfg.warmup);
+
+        // Functional fast-forward to the start of the warm-up window
+        simif.fast_forward(warmStart, 0);
+        if (simif.functionalHalt)
+            break;
+
+        LoadMemory();
+        wrap->Reset();
+        ResetModels();
+        for (auto& inst : state.insts)
+            inst.valid = false;
+        simif.restore_to_top(*wrap);
+
+        // Detailed warm-up
+        MainLoop(args, 0, start);
+
+        // Detailed measurement, split into sub-windows for variance estimation
+        for (size_t i = 0; i < SUB_WINDOWS && !wrap->top->OUT_halt; i++)
+        {
+            uint64_t cycles = wrap->csr->mcycle;
+            uint64_t instret = wrap->csr->minstret;
+            MainLoop(args, 0, start + (i + 1) * cfg.window / SUB_WINDOWS);
+            if (wrap->csr->minstret != instret)
+                point.cpi.push_back((double)(wrap->csr->mcycle - cycles) / (wrap->csr->minstret - instret));
+        }
+        fprintf(stderr, "simpoint %zu (weight %.4f) done\n", point.interval, point.weight);
+        if (wrap->top->OUT_halt)
+            break;
+    }
+
+    ReportSimPoints(stderr, points, profile.totalInstret, cfg.iterations);
+}
+
+// The command line without the given options (by getopt value) and without non-option
+// arguments, for workers that run something else with otherwise the same settings.
+static std::vector<std::string> FilterCmdLine(const std::vector<std::string>& cmdLine, const std::set<int>& drop)
+{
+    std::vector<std::string> out;
+    for (size_t i = 0; i < cmdLine.size(); i++)
+    {
+        const std::string& arg = cmdLine[i];
+        if (arg == "--")
+            break;
+        if (arg.size() < 2 || arg[0] != '-')
+            continue;
+
+        if (arg[1] == '-')
+        {
+            // --name, --name=value or --name value; names may be abbreviated
+            size_t eq = arg.find('=');
+            std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+            const struct option* opt = nullptr;
+            for (auto* o = long_options; o->name; o++)
+            {
+                if (name == o->name)
+                {
+                    opt = o;
+                    break;
+                }
+                if (!opt && strncmp(o->name, name.c_str(), name.size()) == 0)
+                    opt = o;
+            }
+            bool keep = !opt || !drop.count(opt->val);
+            if (keep)
+                out.push_back(arg);
+            if (opt && opt->has_arg == required_argument && eq == std::string::npos && i + 1 < cmdLine.size())
+            {
+                if (keep)
+                    out.push_back(cmdLine[i + 1]);
+                i++;
+            }
+            continue;
+        }
+
+        // Grouped short options, an option with an argument takes the rest of the word or the next one
+        std::string flags = "-";
+        for (size_t j = 1; j < arg.size(); j++)
+        {
+            const char* spec = strchr(SHORT_OPTIONS, arg[j]);
+            bool keep = !drop.count(arg[j]);
+            if (!spec || spec[1] != ':')
+            {
+                if (keep)
+                    flags += arg[j];
+                continue;
+            }
+            std::string value = arg.substr(j + 1);
+            if (value.empty() && i + 1 < cmdLine.size())
+                value = cmdLine[++i];
+            if (keep)
+                out.push_back(std::string("-") + arg[j] + value);
+            break;
+        }
+        if (flags.size() > 1)
+            out.push_back(flags);
+    }
+    return out;
+}
+
+// Simulate a checkpoint in a separate process, output goes to <ckpt>.log. Forked children
+// cannot run the Verilator model (its worker threads are gone), so we exec a fresh instance.
+// Workers get the parent's options, except those of the ladder itself, which instead
+// come from the checkpoint.
+static pid_t LaunchLadderWorker(std::string ckpt, Args& args)
+{
+    std::string logFile = ckpt + ".log";
+    std::vector<std::string> workerArgs =
+        FilterCmdLine(args.cmdLine, {OPT_LADDER, OPT_LADDER_JOBS, OPT_LADDER_WARMUP, OPT_LADDER_LIMIT, 'b',
+                                     OPT_BACKUP_JOBS, 'F', OPT_MAX_INSTRET, OPT_STOP_AT_SYMBOL});
+    workerArgs.push_back(ckpt);
+    std::vector<const char*> argv = {"/proc/self/exe"};
+    for (auto& arg : workerArgs)
+        argv.push_back(arg.c_str());
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int log = open(logFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int null = open("/dev/null", O_RDONLY);
+        if (log < 0 || null < 0)
+            _exit(-1);
+        dup2(null, 0);
+        dup2(log, 1);
+        dup2(log, 2);
+        execv(argv[0], (char* const*)argv.data());
+        _exit(-1);
+    }
+    if (pid < 0)
+        abort();
+    return pid;
+}
+
+// Run one long simulation as many parallel intervals. A functional pass in Spike writes
+// a checkpoint ladder (architectural state and incremental memory) at fixed instret
+// intervals. As soon as a checkpoint is written, a detailed simulation of its interval
+// is launched. Finally, the per-interval perf counters are stitched together.
+void run_ladder(Args& args)
+{
+    auto& cfg = args.ladder;
+    uint32_t jobs = cfg.jobs ? cfg.jobs : sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Without --backup-file, the ladder lives in a directory of its own and is deleted
+    // unless an interval failed.
+    std::string tmpDir;
+    if (args.backupFile.empty())
+    {
+        char dir[] = "ladder-XXXXXX";
+        if (!mkdtemp(dir))
+            abort();
+        tmpDir = dir;
+    }
+    std::string stem = tmpDir.empty() ? CheckpointStem(args.backupFile) : tmpDir + "/ladder";
+
+    struct IntervalResult
+    {
+        LadderInterval interval;
+        std::string ckpt;
+        bool ok = false;
+        PerfCounters counters = {};
+    };
+    std::vector<IntervalResult> results;
+    std::map<pid_t, size_t> running;
+
+    auto reap = [&]() {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        auto it = running.find(pid);
+        if (it == running.end())
+            return;
+        auto& result = results[it->second];
+        running.erase(it);
+
+        FILE* f = fopen((result.ckpt + ".perf").c_str(), "r");
+        result.ok = f && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        for (size_t i = 0; result.ok && i < result.counters.size(); i++)
+            result.ok = fscanf(f, "%lu", &result.counters[i]) == 1;
+        if (f)
+            fclose(f);
+        unlink((result.ckpt + ".perf").c_str());
+        if (result.ok)
+            unlink((result.ckpt + ".log").c_str());
+        fprintf(stderr, "interval %lu-%lu %s\n", result.interval.start, result.interval.end,
+                result.ok ? "done" : "FAILED");
+    };
+
+    if (args.deviceTreeAddr != 0)
+        simif.write_reg(11, args.deviceTreeAddr);
+
+    for (uint32_t k = 0; (uint64_t)k * cfg.interval < cfg.limit; k++)
+    {
+        LadderInterval interval = {k * cfg.interval, std::min((k + 1) * cfg.interval, cfg.limit)};
+        simif.fast_forward(interval.start - std::min(interval.start, cfg.warmup), 0);
+        if (simif.functionalHalt)
+            break;
+
+        std::string name = CheckpointName(stem, k);
+        bool full = (k % CKPT_CHAIN_LEN) == 0;
+        {
+            CheckpointWriter ckpt(name, k, full ? "" : BaseName(CheckpointName(stem, k - 1)));
+            ArchState arch = simif.save_arch();
+            ckpt.add_pages(CKPT_MEM, pmem, full);
+            ckpt.add_blob(CKPT_ARCH, (uint8_t*)&arch, sizeof(arch));
+            ckpt.add_blob(CKPT_INTERVAL, (uint8_t*)&interval, sizeof(interval));
+        }
+        // Spike's TLB holds pointers into pmem, flush so writes mark pages dirty again.
+        simif.processor->get_mmu()->flush_tlb();
+
+        while (running.size() >= jobs)
+            reap();
+        results.push_back(IntervalResult{interval, name});
+        running[LaunchLadderWorker(name, args)] = results.size() - 1;
+    }
+    while (!running.empty())
+        reap();
+
+    PerfCounters total = {};
+    size_t failed = 0;
+    fprintf(stderr, "interval  start         cycles        instret       IPC\n");
+    for (size_t k = 0; k < results.size(); k++)
+    {
+        auto& r = results[k];
+        if (!r.ok)
+        {
+            fprintf(stderr, "%8zu  %-12lu  FAILED, see %s.log\n", k, r.interval.start, r.ckpt.c_str());
+            failed++;
+            continue;
+        }
+        fprintf(stderr, "%8zu  %-12lu  %-12lu  %-12lu  %f\n", k, r.interval.start, r.counters[0], r.counters[1],
+                (double)r.counters[1] / r.counters[0]);
+        for (size_t i = 0; i < total.size(); i++)
+            total[i] += r.counters[i];
+    }
+    fprintf(stderr, "%zu intervals, %zu failed\n", results.size(), failed);
+    PrintPerf(total);
+
+    if (!tmpDir.empty() && failed == 0)
+    {
+        for (auto& r : results)
+            unlink(r.ckpt.c_str());
+        rmdir(tmpDir.c_str());
+    }
+    else if (!tmpDir.empty())
+        fprintf(stderr, "checkpoints and logs of failed intervals kept in %s\n", tmpDir.c_str());
+}
+
+static std::vector<std::string> ReadBatchList(std::string fileName)
+{
+    FILE* f = fopen(fileName.c_str(), "r");
+    if (!f)
+    {
+        fprintf(stderr, "could not open batch list %s\n", fileName.c_str());
+        exit(-1);
+    }
+
+    std::vector<std::string> progs;
+    char* line = nullptr;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, f) != -1)
+    {
+        std::string prog(line);
+        prog.erase(0, prog.find_first_not_of(" \t"));
+        prog.erase(prog.find_last_not_of(" \t\r\n") + 1);
+        if (!prog.empty() && prog[0] != '#')
+            progs.push_back(prog);
+    }
+    free(line);
+    fclose(f);
+    return progs;
+}
+
+static std::string BatchLogName(const Args& args, size_t idx, std::string prog)
+{
+    return args.batchOut + ".logs/" + std::to_string(idx) + "-" + BaseName(prog) + ".log";
+}
+
+// Batch worker: the model is built once, then programs are run one after another as
+// directed by the parent. Program indices are read from fd 3, results are written to fd 4.
+// Before each program, the model is restored to its initial state from memory.
+void run_batch_worker(Args& args)
+{
+    // Upper bound on the run time of a single program, in half cycles
+    const uint64_t BATCH_TIMEOUT = 1UL << 30;
+
+    auto progs = ReadBatchList(args.batchList);
+    FILE* cmds = fdopen(3, "r");
+    FILE* results = fdopen(4, "w");
+    if (!cmds || !results)
+        abort();
+
+    std::vector<uint8_t> initState;
+    wrap->save_model(initState);
+
+    throwOnExit = true;
+    size_t idx;
+    while (fscanf(cmds, "%zu", &idx) == 1 && idx < progs.size())
+    {
+        fflush(stdout);
+        fflush(stderr);
+        int log = open(BatchLogName(args, idx, progs[idx]).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log < 0)
+            abort();
+        dup2(log, 1);
+        dup2(log, 2);
+        close(log);
+
+        if (!initState.empty())
+            wrap->restore_model(initState);
+        pmem.clear();
+        rtlMemCopy.clear();
+        state = decltype(state)();
+        cosimSweepNext = true;
+        memset(registers.regTagOverride.data(), 0xFF, sizeof(registers.regTagOverride));
+        for (auto* model : simif.models)
+            delete model;
+        simif.~SpikeSimif();
+        new (&simif) SpikeSimif(pmem, registers, wrap->main_time);
+
+        auto start = std::chrono::steady_clock::now();
+        int code = 0;
+        try
+        {
+            Args progArgs = args;
+            progArgs.progFile = progs[idx];
+            LoadProgram(progArgs);
+            if (!progArgs.fastForwardSymbol.empty())
+                progArgs.fastForwardPC = symbols.lookup(progArgs.fastForwardSymbol);
+            if (!progArgs.stopSymbol.empty())
+                progArgs.stopPC = symbols.lookup(progArgs.stopSymbol);
+            run_sim(progArgs, BATCH_TIMEOUT);
+        }
+        catch (SimExit& e)
+        {
+            code = e.code;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Test programs pass by cosim reporting success, others by powering off.
+        bool passed = code == 0 && (args.testMode ? simif.riscvTestReturn == 1 : wrap->top->OUT_halt);
+        fflush(stdout);
+        fflush(stderr);
+        fprintf(results, "%zu %d %lu %lu %f\n", idx, passed, (uint64_t)wrap->csr->mcycle,
+                (uint64_t)wrap->csr->minstret, seconds);
+        fflush(results);
+    }
+    throwOnExit = false;
+}
+
+struct BatchResult
+{
+    enum Status
+    {
+        NOT_RUN,
+        PASSED,
+        FAILED,
+        CRASHED,
+    };
+    Status status = NOT_RUN;
+    uint64_t cycles = 0;
+    uint64_t instret = 0;
+    double seconds = 0;
+};
+
+static const char* BatchStatusName(BatchResult::Status status)
+{
+    switch (status)
+    {
+        case BatchResult::PASSED: return "passed";
+        case BatchResult::FAILED: return "failed";
+        case BatchResult::CRASHED: return "crashed";
+        default: return "not run";
+    }
+}
+
+static std::string EscapeString(std::string str, bool xml)
+{
+    std::string out;
+    for (char c : str)
+    {
+        if (xml && c == '&')
+            out += "&amp;";
+        else if (xml && c == '<')
+            out += "&lt;";
+        else if (xml && c == '>')
+            out += "&gt;";
+        else if (xml && c == '"')
+            out += "&quot;";
+        else if (!xml && (c == '"' || c == '\\'))
+            out += std::string("\\") + c;
+        else
+            out += c;
+    }
+    return out;
+}
+
+static void WriteBatchSummary(const Args& args, const std::vector<std::string>& progs,
+                              const std::vector<BatchResult>& results, double seconds)
+{
+    size_t passed = 0;
+    size_t crashed = 0;
+    for (auto& r : results)
+    {
+        passed += r.status == BatchResult::PASSED;
+        crashed += r.status == BatchResult::CRASHED || r.status == BatchResult::NOT_RUN;
+    }
+    size_t failed = results.size() - passed - crashed;
+
+    FILE* f = fopen(args.batchOut.c_str(), "w");
+    if (!f)
+        abort();
+
+    bool junit = args.batchOut.size() >= 4 && args.batchOut.compare(args.batchOut.size() - 4, 4, ".xml") == 0;
+    if (junit)
+    {
+        fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+        fprintf(f, "<testsuite name=\"soomrv\" tests=\"%zu\" failures=\"%zu\" errors=\"%zu\" time=\"%f\">\n",
+                results.size(), failed, crashed, seconds);
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            auto& r = results[i];
+            std::string name = EscapeString(progs[i], true);
+            std::string log = EscapeString(BatchLogName(args, i, progs[i]), true);
+            fprintf(f, "  <testcase name=\"%s\" classname=\"soomrv\" time=\"%f\">", name.c_str(), r.seconds);
+            if (r.status == BatchResult::FAILED)
+                fprintf(f, "<failure message=\"failed, see %s\"/>", log.c_str());
+            else if (r.status != BatchResult::PASSED)
+                fprintf(f, "<error message=\"%s, see %s\"/>", BatchStatusName(r.status), log.c_str());
+            fprintf(f, "</testcase>\n");
+        }
+        fprintf(f, "</testsuite>\n");
+    }
+    else
+    {
+        fprintf(f, "{\n  \"tests\": %zu, \"passed\": %zu, \"failed\": %zu, \"errors\": %zu, \"seconds\": %f,\n",
+                results.size(), passed, failed, crashed, seconds);
+        fprintf(f, "  \"results\": [\n");
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            auto& r = results[i];
+            fprintf(f,
+                    "    {\"name\": \"%s\", \"status\": \"%s\", \"cycles\": %lu, \"instret\": %lu, \"seconds\": %f, "
+                    "\"log\": \"%s\"}%s\n",
+                    EscapeString(progs[i], false).c_str(), BatchStatusName(r.status), r.cycles, r.instret, r.seconds,
+                    EscapeString(BatchLogName(args, i, progs[i]), false).c_str(), (i + 1 < results.size()) ? "," : "");
+        }
+        fprintf(f, "  ]\n}\n");
+    }
+    fclose(f);
+
+    fprintf(stderr, "%zu passed, %zu failed, %zu errors in %.2fs, summary in %s\n", passed, failed, crashed, seconds,
+            args.batchOut.c_str());
+}
+
+// Run many programs in a pool of worker processes, each of which builds its model only once.
+// Workers are exec'd (not just forked), since the Verilator model's threads do not survive fork.
+void run_batch(Args& args)
+{
+    // Dead workers are detected by EOF on their result pipe
+    signal(SIGPIPE, SIG_IGN);
+
+    auto progs = ReadBatchList(args.batchList);
+    size_t jobs = args.batchJobs ? args.batchJobs : std::max(1L, sysconf(_SC_NPROCESSORS_ONLN) / 4);
+    jobs = std::min(jobs, progs.size());
+    mkdir((args.batchOut + ".logs").c_str(), 0755);
+
+    // Same command line, later options take precedence
+    std::vector<std::string> workerArgs = args.cmdLine;
+    workerArgs.push_back("--batch-worker");
+    workerArgs.push_back(args.batchList);
+    std::vector<const char*> workerArgv = {"/proc/self/exe"};
+    for (auto& arg : workerArgs)
+        workerArgv.push_back(arg.c_str());
+    workerArgv.push_back(nullptr);
+
+    struct Worker
+    {
+        pid_t pid;
+        FILE* cmds;
+        FILE* results;
+        long cur;
+    };
+    std::vector<Worker> workers;
+    std::vector<BatchResult> results(progs.size());
+    size_t next = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    auto dispatch = [&](Worker& w) {
+        w.cur = -1;
+        if (next < progs.size())
+        {
+            w.cur = next++;
+            fprintf(w.cmds, "%ld\n", w.cur);
+            fflush(w.cmds);
+        }
+        else if (w.cmds)
+        {
+            fclose(w.cmds);
+            w.cmds = nullptr;
+        }
+    };
+
+    auto spawn = [&](Worker& w) {
+        int cmdPipe[2];
+        int resPipe[2];
+        if (pipe2(cmdPipe, O_CLOEXEC) != 0 || pipe2(resPipe, O_CLOEXEC) != 0)
+            abort();
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            int null = open("/dev/null", O_RDONLY);
+            dup2(null, 0);
+            dup2(cmdPipe[0], 3);
+            dup2(resPipe[1], 4);
+            // dup2 onto the same fd keeps close-on-exec
+            fcntl(3, F_SETFD, 0);
+            fcntl(4, F_SETFD, 0);
+            execv(workerArgv[0], (char* const*)workerArgv.data());
+            _exit(-1);
+        }
+        if (pid < 0)
+            abort();
+        close(cmdPipe[0]);
+        close(resPipe[1]);
+        w = Worker{pid, fdopen(cmdPipe[1], "w"), fdopen(resPipe[0], "r"), -1};
+        dispatch(w);
+    };
+
+    workers.resize(jobs);
+    for (auto& w : workers)
+        spawn(w);
+
+    size_t alive = workers.size();
+    while (alive != 0)
+    {
+        std::vector<pollfd> fds;
+        for (auto& w : workers)
+            fds.push_back(pollfd{w.results ? fileno(w.results) : -1, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) < 0)
+            continue;
+
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            auto& w = workers[i];
+            if (!w.results || !(fds[i].revents & (POLLIN | POLLHUP)))
+                continue;
+
+            size_t idx;
+            int passed;
+            BatchResult r;
+            if (fscanf(w.results, "%zu %d %lu %lu %lf", &idx, &passed, &r.cycles, &r.instret, &r.seconds) == 5 &&
+                (long)idx == w.cur)
+            {
+                r.status = passed ? BatchResult::PASSED : BatchResult::FAILED;
+                results[idx] = r;
+                fprintf(stderr, "%s: %s\n", progs[idx].c_str(), BatchStatusName(r.status));
+                dispatch(w);
+                continue;
+            }
+
+            // Worker died, its current program is counted as crashed. Replace it while there
+            // is work left; every respawn takes a new program, so this always terminates.
+            bool crashed = w.cur >= 0;
+            if (crashed)
+            {
+                results[w.cur].status = BatchResult::CRASHED;
+                fprintf(stderr, "%s: crashed\n", progs[w.cur].c_str());
+            }
+            fclose(w.results);
+            w.results = nullptr;
+            if (w.cmds)
+                fclose(w.cmds);
+            w.cmds = nullptr;
+            waitpid(w.pid, nullptr, 0);
+            if (crashed && next < progs.size())
+                spawn(w);
+            else
+                alive--;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    WriteBatchSummary(args, progs, results, seconds);
+
+    for (auto& r : results)
+        if (r.status != BatchResult::PASSED)
+            Exit(-1);
+    Exit(0);
+}
+
+// State right before simulation starts, restored for every fuzz iteration instead of
+// re-creating Spike and resetting the model.
+struct FuzzSnapshot
+{
+    std::vector<uint8_t> model;
+    ArchState spike;
+    SparseMemory mem;
+    std::vector<uint8_t> prog;
+};
+
+static void TakeFuzzSnapshot(Args& args, FuzzSnapshot& snap)
+{
+    wrap->top->clk = 0;
+    simif.riscvTestMode = args.testMode;
+    DEBUG_TIME = args.debugTime;
+    SetupTraceWindows(args);
+
+    LoadMemory();
+    wrap->Reset();
+    if (args.deviceTreeAddr != 0)
+        WriteRegister(11, args.deviceTreeAddr);
+
+    wrap->save_model(snap.model);
+    snap.spike = simif.save_arch();
+    snap.mem = pmem;
+    snap.prog.resize(args.programBytes);
+    pmem.read(pmem.base, snap.prog.data(), snap.prog.size());
+
+    pmem.clear_dirty(SparseMemory::DIRTY_SNAPSHOT);
+    rtlMem->clear_dirty(SparseMemory::DIRTY_SNAPSHOT);
+    simif.processor->get_mmu()->flush_tlb();
+}
+
+static void RestoreFuzzSnapshot(Args& args, FuzzSnapshot& snap, const std::vector<uint8_t>& prog)
+{
+    // Revert pages written by the last run, then only write bytes that differ from the snapshot
+    pmem.revert_dirty(snap.mem);
+    if (rtlMem != &pmem)
+        rtlMem->revert_dirty(snap.mem);
+    for (size_t i = 0; i < prog.size();)
+    {
+        if (prog[i] == snap.prog[i])
+        {
+            i++;
+            continue;
+        }
+        size_t j = i;
+        while (j < prog.size() && prog[j] != snap.prog[j])
+            j++;
+        pmem.write(pmem.base + i, &prog[i], j - i);
+        if (rtlMem != &pmem)
+            rtlMem->write(pmem.base + i, &prog[i], j - i);
+        i = j;
+    }
+
+    if (!snap.model.empty())
+        wrap->restore_model(snap.model);
+    else
+    {
+        wrap->top->clk = 0;
+        wrap->main_time = 0;
+        wrap->Reset();
+        if (args.deviceTreeAddr != 0)
+            WriteRegister(11, args.deviceTreeAddr);
+    }
+
+    simif.restore_arch(snap.spike);
+    simif.doRestore = false;
+    simif.functionalHalt = false;
+    simif.riscvTestReturn = 0;
+    // Spike's TLB caches pointers into pmem (used for dirty tracking), its icache decoded instructions
+    simif.processor->get_mmu()->flush_tlb();
+    simif.processor->get_mmu()->flush_icache();
+
+    state = decltype(state)();
+    cosimSweepNext = true;
+    memset(registers.regTagOverride.data(), 0xFF, sizeof(registers.regTagOverride));
+    ResetModels();
+    lastPerfCounters = ReadPerfCounters();
+}
+
+static void ResetFuzzCoverage()
+{
+#ifdef COVERAGE
+    for (auto& count : wrap->top->vlSymsp->__Vcoverage)
+        count = 0;
+#else
+    std::fill(fuzzCounts.begin(), fuzzCounts.end(), 0);
+    fuzzLastPC = 0;
+#endif
+}
+
+static void ReadFuzzCoverage()
+{
+#ifdef COVERAGE
+    auto& counters = wrap->top->vlSymsp->__Vcoverage;
+    fuzzCounts.resize(LEN(counters));
+    for (size_t i = 0; i < fuzzCounts.size(); i++)
+        fuzzCounts[i] = counters[i];
+#endif
+}
+
+// Fuzzer running test cases on the RTL with cosim. Interesting test cases are written to
+// <dir>/queue, errors (minimized) to <dir>/crashes. Test cases found by other workers
+// are periodically imported from the queue.
+class HarnessFuzzer : public Fuzzer
+{
+  public:
+    // Upper bound on the run time of a single test case, in half cycles
+    static constexpr uint64_t TIMEOUT = 16384;
+
+    HarnessFuzzer(Args& args, FuzzSnapshot& snapshot, int worker)
+        : args(args), snapshot(snapshot), prefix("w" + std::to_string(worker) + "-")
+    {
+    }
+
+    virtual RunResults run(TestCase const& test_case)
+    {
+        std::vector<uint8_t> prog(args.programBytes);
+        test_case.unpack(prog.data(), prog.size());
+        RestoreFuzzSnapshot(args, snapshot, prog);
+        ResetFuzzCoverage();
+
+        RunResults results{RunResultFlags::FINISHED};
+        lastErrorCode = 0;
+        lastErrorPC = 0;
+        try
+        {
+            MainLoop(args, wrap->main_time + TIMEOUT);
+            if (!wrap->top->OUT_halt)
+                results.flags = RunResultFlags::TIMEOUT;
+        }
+        catch (SimExit& e)
+        {
+            if (e.code != 0)
+            {
+                results.flags = RunResultFlags::ERROR;
+                results.errorCode = lastErrorCode;
+                results.errorPC = lastErrorPC;
+            }
+        }
+
+        ReadFuzzCoverage();
+        results.counts = fuzzCounts.data();
+        results.numCounts = fuzzCounts.size();
+        return results;
+    }
+
+    virtual void report(TestCase const& test_case, RunResults const& results)
+    {
+        std::string path = args.fuzzDir + "/crashes/" + prefix + std::to_string(stats.crashes);
+        test_case.save_file(path.c_str());
+        fprintf(stderr, "error, saved to %s\n", path.c_str());
+    }
+
+    virtual void new_case(TestCase const& test_case)
+    {
+        // Written under a temporary name, so other workers never import partial files
+        std::string name = prefix + std::to_string(numSaved++);
+        std::string tmp = args.fuzzDir + "/." + name;
+        test_case.save_file(tmp.c_str());
+        if (rename(tmp.c_str(), (args.fuzzDir + "/queue/" + name).c_str()) != 0)
+            abort();
+    }
+
+    virtual void sync()
+    {
+        DIR* dir = opendir((args.fuzzDir + "/queue").c_str());
+        if (!dir)
+            abort();
+        std::vector<std::string> names;
+        while (dirent* ent = readdir(dir))
+        {
+            std::string name = ent->d_name;
+            if (name[0] != '.' && name.compare(0, prefix.size(), prefix) != 0 && !imported.count(name))
+                names.push_back(name);
+        }
+        closedir(dir);
+
+        for (auto& name : names)
+        {
+            imported.insert(name);
+            TestCase test_case;
+            if (test_case.load_file((args.fuzzDir + "/queue/" + name).c_str()))
+                evaluate(test_case, false);
+        }
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        FILE* f = fopen((args.fuzzDir + "/" + prefix + "stats").c_str(), "w");
+        if (!f)
+            abort();
+        fprintf(f, "%zu %zu %zu %zu %zu\n", stats.execs, strategy->testCaseStack.size(), coverage.covered,
+                stats.crashes, stats.timeouts);
+        fclose(f);
+        fprintf(stderr, "%zu execs (%.0f/min), corpus %zu, covered %zu, errors %zu (%zu unique), timeouts %zu\n",
+                stats.execs, stats.execs / seconds * 60, strategy->testCaseStack.size(), coverage.covered,
+                stats.errors, stats.crashes, stats.timeouts);
+    }
+
+  private:
+    Args& args;
+    FuzzSnapshot& snapshot;
+    std::string prefix;
+    size_t numSaved = 0;
+    std::set<std::string> imported;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+
+static void run_fuzz_worker(Args& args, int worker)
+{
+    // Output of the test programs is not of interest
+    if (!freopen("/dev/null", "w", stdout))
+        abort();
+
+#ifndef COVERAGE
+    fuzzCounts.resize(1 << 16);
+    fuzzEdges = true;
+#endif
+
+    TestCase testCase;
+    std::vector<uint8_t> prog(args.programBytes);
+    pmem.read(pmem.base, prog.data(), prog.size());
+    testCase.load(prog.data(), prog.size());
+
+    FuzzSnapshot snapshot;
+    TakeFuzzSnapshot(args, snapshot);
+
+    HarnessFuzzer fuzzer(args, snapshot, worker);
     auto tactics = std::vector<std::unique_ptr<Tactic>>();
     tactics.push_back(std::make_unique<RandomBitflipTactic>());
+    tactics.push_back(std::make_unique<ReplaceInstrTactic>());
+    tactics.push_back(std::make_unique<InsertInstrTactic>());
+    tactics.push_back(std::make_unique<DeleteInstrTactic>());
+    tactics.push_back(std::make_unique<RegisterTactic>());
+    tactics.push_back(std::make_unique<ImmediateTactic>());
+    tactics.push_back(std::make_unique<DuplicateTactic>());
+    tactics.push_back(std::make_unique<SwapTactic>());
     fuzzer.strategy = std::unique_ptr<Strategy>(new Strategy(std::move(tactics)));
-    fuzzer.fuzz(100, 42, testCase);
+
+    throwOnExit = true;
+    fuzzer.fuzz(args.fuzzIters, args.fuzzSeed + worker, testCase);
+    throwOnExit = false;
+    fuzzer.sync();
+}
+
+// Replace the loaded program by a saved test case and simulate it normally.
+static void ReplayFuzzCase(Args& args)
+{
+    TestCase testCase;
+    if (!testCase.load_file(args.fuzzReplay.c_str()))
+    {
+        fprintf(stderr, "could not load test case %s\n", args.fuzzReplay.c_str());
+        exit(-1);
+    }
+    std::vector<uint8_t> prog(args.programBytes);
+    testCase.unpack(prog.data(), prog.size());
+    pmem.write(pmem.base, prog.data(), prog.size());
+    run_sim(args, HarnessFuzzer::TIMEOUT);
+}
+
+// Fuzz in a pool of worker processes sharing their corpus through the file system. As in
+// batch mode, workers are exec'd, since the model's threads do not survive fork.
+void run_fuzz(Args& args)
+{
+    if (!args.fuzzReplay.empty())
+    {
+        ReplayFuzzCase(args);
+        return;
+    }
+
+    if (args.fuzzWorker < 0)
+    {
+        mkdir(args.fuzzDir.c_str(), 0755);
+        mkdir((args.fuzzDir + "/queue").c_str(), 0755);
+        mkdir((args.fuzzDir + "/crashes").c_str(), 0755);
+    }
+
+    if (args.fuzzWorker >= 0 || args.fuzzJobs <= 1)
+    {
+        run_fuzz_worker(args, std::max(args.fuzzWorker, 0));
+        return;
+    }
+
+    std::vector<pid_t> workers;
+    for (uint32_t i = 0; i < args.fuzzJobs; i++)
+    {
+        std::vector<std::string> workerArgs = args.cmdLine;
+        workerArgs.push_back("--fuzz-worker");
+        workerArgs.push_back(std::to_string(i));
+        std::vector<const char*> workerArgv = {"/proc/self/exe"};
+        for (auto& arg : workerArgs)
+            workerArgv.push_back(arg.c_str());
+        workerArgv.push_back(nullptr);
+        std::string logName = args.fuzzDir + "/w" + std::to_string(i) + ".log";
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            int null = open("/dev/null", O_RDONLY);
+            int log = open(logName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (null < 0 || log < 0)
+                _exit(-1);
+            dup2(null, 0);
+            dup2(log, 2);
+            execv(workerArgv[0], (char* const*)workerArgv.data());
+            _exit(-1);
+        }
+        if (pid < 0)
+            abort();
+        workers.push_back(pid);
+    }
+    fprintf(stderr, "fuzzing with %zu workers, logs in %s/w<N>.log\n", workers.size(), args.fuzzDir.c_str());
+
+    // Print combined stats of all workers until they are done
+    size_t alive = workers.size();
+    while (alive != 0)
+    {
+        sleep(10);
+        while (waitpid(-1, nullptr, WNOHANG) > 0)
+            alive--;
+
+        size_t total[5] = {};
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            FILE* f = fopen((args.fuzzDir + "/w" + std::to_string(i) + "-stats").c_str(), "r");
+            if (!f)
+                continue;
+            size_t vals[5];
+            if (fscanf(f, "%zu %zu %zu %zu %zu", &vals[0], &vals[1], &vals[2], &vals[3], &vals[4]) == 5)
+                for (size_t j = 0; j < 5; j++)
+                    total[j] += vals[j];
+            fclose(f);
+        }
+        fprintf(stderr, "%zu execs, corpus %zu, unique errors %zu, timeouts %zu\n", total[0], total[1], total[3],
+                total[4]);
+    }
 }
 
 int main(int argc, char** argv)
@@ -868,9 +3375,40 @@ int main(int argc, char** argv)
     Initialize(argc, argv, args);
 
     wrap->Initial();
-    if (args.fuzz)
+    flight.enable(args.flightCycles);
+    if (!args.golden.empty())
+    {
+        if (args.restoreSave)
+        {
+            fprintf(stderr, "golden log replay cannot start from a checkpoint\n");
+            exit(-1);
+        }
+        golden = std::make_unique<GoldenReplay>(args.golden);
+        golden->riscvTestMode = args.testMode;
+    }
+#ifdef COSIM
+    cosimSweepInterval = args.cosimSweep;
+    cosimTier = args.cosimTier;
+    simif.checkModels = cosimTier >= CHECK_DEST;
+    if (!golden)
+        cosimRollbackInterval = args.cosimRollback;
+    if (args.cosimThread && !golden)
+        asyncCosim = std::make_unique<AsyncCosim>(simif);
+#endif
+    if (!args.goldenRecord.empty())
+        run_golden_record(args);
+    else if (args.batchWorker)
+        run_batch_worker(args);
+    else if (!args.batchList.empty())
+        run_batch(args);
+    else if (args.fuzz)
         run_fuzz(args);
+    else if (args.sample.clusters != 0)
+        run_sampled(args);
+    else if (args.ladder.interval != 0)
+        run_ladder(args);
     else
         run_sim(args);
+    WaitCheckpoints();
     wrap->Final();
 }
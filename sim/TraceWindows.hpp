@@ -0,0 +1,163 @@
+#pragma once
+#include "Debug.hpp"
+#include "ElfLoader.hpp"
+#include "Markers.hpp"
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct TraceTrigger
+{
+    enum Type
+    {
+        // Never (start) or at the end of the run (end)
+        NONE,
+        INSTRET,
+        TIME,
+        PC,
+        MARKER,
+        // Instructions after the start of the window
+        AFTER,
+    };
+    Type type = NONE;
+    uint64_t value = 0;
+};
+
+struct TraceWindow
+{
+    TraceTrigger start;
+    TraceTrigger end;
+};
+
+// Trace windows turn FST and Konata tracing (TRACING) on and off. Windows are used one
+// after the other, each opens and closes once. Instret and time triggers are checked
+// once per cycle, PC and marker triggers for each committed instruction.
+class TraceWindows
+{
+  public:
+    // Parse <start>[:<end>]. A trigger is an instret, t<main_time>, @<pc>, a symbol (its
+    // first instruction) or "marker" (the start or stop marker instruction). The end may
+    // also be +<instructions>, counted from the start of the window. "roi" is the window
+    // between the ROI markers.
+    static TraceWindow parse(const std::string& spec, const SymbolTable& symbols)
+    {
+        if (spec == "roi")
+            return TraceWindow{{TraceTrigger::MARKER, MARKER_ROI_START}, {TraceTrigger::MARKER, MARKER_ROI_STOP}};
+
+        TraceWindow w;
+        size_t colon = spec.find(':');
+        w.start = parse_trigger(spec.substr(0, colon), spec, symbols, MARKER_TRACE_START);
+        if (w.start.type == TraceTrigger::NONE || w.start.type == TraceTrigger::AFTER)
+            bad(spec);
+        if (colon != std::string::npos)
+            w.end = parse_trigger(spec.substr(colon + 1), spec, symbols, MARKER_TRACE_STOP);
+        return w;
+    }
+
+    void add(TraceWindow w)
+    {
+        windows.push_back(w);
+        needsCommits |= w.start.type == TraceTrigger::PC || w.start.type == TraceTrigger::MARKER ||
+                        w.end.type == TraceTrigger::PC || w.end.type == TraceTrigger::MARKER;
+    }
+
+    void reset()
+    {
+        windows.clear();
+        cur = 0;
+        needsCommits = false;
+        TRACING = false;
+    }
+
+    // Any windows left
+    bool armed() const
+    {
+        return cur < windows.size();
+    }
+
+    bool needs_commits() const
+    {
+        return needsCommits;
+    }
+
+    void cycle(uint64_t time, uint64_t minstret)
+    {
+        if (!armed())
+            return;
+        const TraceTrigger& t = TRACING ? windows[cur].end : windows[cur].start;
+        if ((t.type == TraceTrigger::INSTRET && minstret >= t.value) || (t.type == TraceTrigger::TIME && time >= t.value))
+            toggle(time, minstret);
+    }
+
+    void commit(uint32_t pc, uint32_t inst, uint64_t time, uint64_t minstret)
+    {
+        if (!armed())
+            return;
+        const TraceTrigger& t = TRACING ? windows[cur].end : windows[cur].start;
+        if (t.type == TraceTrigger::PC && pc == t.value)
+            toggle(time, minstret);
+        else if (t.type == TraceTrigger::MARKER && DecodeMarker(inst) == (int)t.value)
+            toggle(time, minstret);
+    }
+
+  private:
+    std::vector<TraceWindow> windows;
+    size_t cur = 0;
+    bool needsCommits = false;
+
+    void toggle(uint64_t time, uint64_t minstret)
+    {
+        TRACING = !TRACING;
+        fprintf(stderr, "trace window %zu %s at instret %lu, time %lu\n", cur, TRACING ? "opened" : "closed", minstret,
+                time);
+        if (!TRACING)
+            cur++;
+        else if (windows[cur].end.type == TraceTrigger::AFTER)
+            windows[cur].end = TraceTrigger{TraceTrigger::INSTRET, minstret + windows[cur].end.value};
+    }
+
+    static TraceTrigger parse_trigger(const std::string& s, const std::string& spec, const SymbolTable& symbols,
+                                      Marker marker)
+    {
+        if (s.empty())
+            return TraceTrigger{};
+        if (isdigit(s[0]))
+            return TraceTrigger{TraceTrigger::INSTRET, parse_number(s, 0, spec)};
+        if (s[0] == 't' && s.size() > 1 && isdigit(s[1]))
+            return TraceTrigger{TraceTrigger::TIME, parse_number(s.substr(1), 0, spec)};
+        if (s[0] == '+' && s.size() > 1)
+            return TraceTrigger{TraceTrigger::AFTER, parse_number(s.substr(1), 0, spec)};
+        if (s[0] == '@' && s.size() > 1)
+            return TraceTrigger{TraceTrigger::PC, parse_number(s.substr(1), 16, spec)};
+        if (s == "marker")
+            return TraceTrigger{TraceTrigger::MARKER, marker};
+
+        uint32_t addr = symbols.lookup(s);
+        if (addr == 0)
+        {
+            fprintf(stderr, "could not find symbol %s\n", s.c_str());
+            exit(-1);
+        }
+        return TraceTrigger{TraceTrigger::PC, addr};
+    }
+
+    // The whole string must be a number (no sign, no trailing characters) that fits into 64 bits
+    static uint64_t parse_number(const std::string& s, int base, const std::string& spec)
+    {
+        char* end;
+        errno = 0;
+        uint64_t value = strtoull(s.c_str(), &end, base);
+        if (!isxdigit((unsigned char)s[0]) || *end != 0 || errno == ERANGE)
+            bad(spec);
+        return value;
+    }
+
+    [[noreturn]] static void bad(const std::string& spec)
+    {
+        fprintf(stderr, "invalid trace window %s\n", spec.c_str());
+        exit(-1);
+    }
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include "verilated_save.h"
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+// In-memory counterparts of VerilatedSave/VerilatedRestore. The Verilator file
+// header/trailer is omitted, the buffers are always wrapped in our own formats.
+
+class VerilatedMemSave : public VerilatedSerialize
+{
+  public:
+    std::vector<uint8_t>& buf;
+
+    VerilatedMemSave(std::vector<uint8_t>& buf) : buf(buf)
+    {
+        m_isOpen = true;
+    }
+
+    ~VerilatedMemSave() override
+    {
+        close();
+    }
+
+    void close() override
+    {
+        flush();
+        m_isOpen = false;
+    }
+
+    void flush() override
+    {
+        buf.insert(buf.end(), m_bufp, m_cp);
+        m_cp = m_bufp;
+    }
+};
+
+class VerilatedMemRestore : public VerilatedDeserialize
+{
+  public:
+    VerilatedMemRestore(const uint8_t* data, size_t len) : data(data), len(len)
+    {
+        m_isOpen = true;
+    }
+
+    ~VerilatedMemRestore() override
+    {
+        close();
+    }
+
+    void close() override
+    {
+        m_isOpen = false;
+    }
+
+    void fill() override
+    {
+        // Move remaining bytes to the start of the buffer, then refill from data
+        size_t rem = m_endp - m_cp;
+        memmove(m_bufp, m_cp, rem);
+        m_cp = m_bufp;
+        m_endp = m_bufp + rem;
+
+        size_t n = std::min(bufferSize() - rem, len - pos);
+        memcpy(m_endp, data + pos, n);
+        m_endp += n;
+        pos += n;
+    }
+
+  private:
+    const uint8_t* data;
+    size_t len;
+    size_t pos = 0;
+};
@@ -29,3 +29,5 @@
 #include "VTop__Syms.h"
 #include "VTop__pch.h"
 #include "VTop_IF_CTable.h"
+#include "VTop_MMIO.h"
+#include "VTop_ACLINT.h"
@@ -7,6 +7,7 @@
 
 #include "../model_headers.h"
 #include "riscv/processor.h"
+#include "../BitView.hpp"
 #include "../sc_stub.hpp"
 #include "../slang/slang.hpp"
 
@@ -22,24 +23,29 @@ class BranchHistory : public Model
         auto core = top->Top->soc->core;
         auto bpFile = core->ifetch->bp->bpFile->mem;
 
-        BPBackup backup{sc_bv<BPBackup::_size>{(char*)&bpFile[fetchID]}};
+        auto backup = VIEW(BPBackup, &bpFile[fetchID]);
 
-        if (backup.pred && backup.isRegularBranch && fetchOffs > backup.predOffs)
-            return (backup.history << 1) | backup.predTaken;
-        return backup.history;
+        uint64_t history = FIELD(backup, history);
+        if (FIELD(backup, pred) && FIELD(backup, isRegularBranch) && fetchOffs > FIELD(backup, predOffs))
+            return (history << 1) | FIELD(backup, predTaken);
+        return history;
 #else
         return 0;
 #endif
     }
 
-    bool compare_history (const Inst& i)
+    void Sample(Inst& i)
     {
-        constexpr uint64_t bhist_mask = BPBackup::history_w == 64 ? (-1) : ((1UL << BPBackup::history_w) - 1);
         constexpr uint64_t fetchoffs_mask = (1UL << BPBackup::predOffs_w) - 1;
 
         auto fetchOffset = (((i.pc) >> 1) + (((i.inst & 3) == 3) ? 1 : 0)) & fetchoffs_mask;
-        auto coreHist = ReadBrHistory(i.fetchID, fetchOffset);
-        return (coreHist & bhist_mask) == (bhist & bhist_mask);
+        i.brHistory = ReadBrHistory(i.fetchID, fetchOffset);
+    }
+
+    bool compare_history (const Inst& i)
+    {
+        constexpr uint64_t bhist_mask = BPBackup::history_w == 64 ? (-1) : ((1UL << BPBackup::history_w) - 1);
+        return (i.brHistory & bhist_mask) == (bhist & bhist_mask);
     }
 
     std::pair<bool, bool> is_branch_taken (uint32_t instSIM)
@@ -9,6 +9,9 @@ class Model
     VTop* top;
     processor_t* processor;
 
+    // Called when the instruction commits, to copy RTL state needed by PreInst/PostInst into
+    // the instruction. The checks may run later, on another thread, without RTL access.
+    virtual void Sample(Inst&) { }
     virtual bool PreInst(Inst const&) { return true; }
     virtual bool PostInst(Inst const&) { return true; }
     virtual void Save(FILE*) { }
@@ -2717,6 +2717,105 @@ namespace  {
         }
     };
 
+    struct LD_Ack {
+        bool valid;
+        bool external;
+        bool doNotReIssue;
+        bool fail;
+        uint32_t loadSqN;
+        uint32_t addr;
+
+        static constexpr size_t valid_s = 0;
+        static constexpr size_t valid_w = 1;
+        static constexpr size_t external_s = 1;
+        static constexpr size_t external_w = 1;
+        static constexpr size_t doNotReIssue_s = 2;
+        static constexpr size_t doNotReIssue_w = 1;
+        static constexpr size_t fail_s = 3;
+        static constexpr size_t fail_w = 1;
+        static constexpr size_t loadSqN_s = 4;
+        static constexpr size_t loadSqN_w = 7;
+        static constexpr size_t addr_s = 11;
+        static constexpr size_t addr_w = 32;
+        static constexpr size_t _size = 43;
+
+        LD_Ack() = default;
+
+        LD_Ack(const uint64_t& __data) {
+            valid = (__data >> valid_s) & (~0ULL >> (64 - 1));
+            external = (__data >> external_s) & (~0ULL >> (64 - 1));
+            doNotReIssue = (__data >> doNotReIssue_s) & (~0ULL >> (64 - 1));
+            fail = (__data >> fail_s) & (~0ULL >> (64 - 1));
+            loadSqN = (__data >> loadSqN_s) & (~0ULL >> (64 - 7));
+            addr = (__data >> addr_s) & (~0ULL >> (64 - 32));
+        }
+
+        LD_Ack(const sc_bv<43>& __data) {
+            valid = __data.get_bit(valid_s);
+            external = __data.get_bit(external_s);
+            doNotReIssue = __data.get_bit(doNotReIssue_s);
+            fail = __data.get_bit(fail_s);
+            loadSqN = __data.range(loadSqN_s + loadSqN_w - 1, loadSqN_s).to_uint64();
+            addr = __data.range(addr_s + addr_w - 1, addr_s).to_uint64();
+        }
+
+        operator uint64_t() const {
+            uint64_t ret = 0;
+            ret |= static_cast<uint64_t>(valid) << valid_s;
+            ret |= static_cast<uint64_t>(external) << external_s;
+            ret |= static_cast<uint64_t>(doNotReIssue) << doNotReIssue_s;
+            ret |= static_cast<uint64_t>(fail) << fail_s;
+            ret |= static_cast<uint64_t>(loadSqN) << loadSqN_s;
+            ret |= static_cast<uint64_t>(addr) << addr_s;
+            return ret;
+        }
+
+        operator sc_bv<43>() const {
+            auto ret = sc_bv<43>();
+            ret.set_bit(valid_s, valid);
+            ret.set_bit(external_s, external);
+            ret.set_bit(doNotReIssue_s, doNotReIssue);
+            ret.set_bit(fail_s, fail);
+            ret.range(loadSqN_s + loadSqN_w - 1, loadSqN_s) = loadSqN;
+            ret.range(addr_s + addr_w - 1, addr_s) = addr;
+            return ret;
+        }
+
+        std::string to_string() const {
+            std::stringstream ss;
+            ss << "valid" << " = " << valid;
+            ss << " external" << " = " << external;
+            ss << " doNotReIssue" << " = " << doNotReIssue;
+            ss << " fail" << " = " << fail;
+            ss << " loadSqN" << " = " << loadSqN;
+            ss << " addr" << " = " << addr;
+            return std::move(ss.str());
+        }
+
+        friend std::ostream& operator<<(std::ostream& os, const LD_Ack& __data) {
+            os << __data.to_string();
+            return os;
+        }
+        static bool get_valid (const uint64_t& __data) {
+            return (__data >> valid_s) & (~0ULL >> (64 - 1));
+        }
+        static bool get_external (const uint64_t& __data) {
+            return (__data >> external_s) & (~0ULL >> (64 - 1));
+        }
+        static bool get_doNotReIssue (const uint64_t& __data) {
+            return (__data >> doNotReIssue_s) & (~0ULL >> (64 - 1));
+        }
+        static bool get_fail (const uint64_t& __data) {
+            return (__data >> fail_s) & (~0ULL >> (64 - 1));
+        }
+        static uint32_t get_loadSqN (const uint64_t& __data) {
+            return (__data >> loadSqN_s) & (~0ULL >> (64 - 7));
+        }
+        static uint32_t get_addr (const uint64_t& __data) {
+            return (__data >> addr_s) & (~0ULL >> (64 - 32));
+        }
+    };
+
     struct ST_UOp {
         bool valid;
         uint32_t id;
@@ -3078,4 +3177,59 @@ namespace  {
         }
     };
 
+    struct Occupancy {
+        uint32_t size;
+        uint32_t count;
+
+        static constexpr size_t size_s = 0;
+        static constexpr size_t size_w = 16;
+        static constexpr size_t count_s = 16;
+        static constexpr size_t count_w = 16;
+        static constexpr size_t _size = 32;
+
+        Occupancy() = default;
+
+        Occupancy(const uint64_t& __data) {
+            size = (__data >> size_s) & (~0ULL >> (64 - 16));
+            count = (__data >> count_s) & (~0ULL >> (64 - 16));
+        }
+
+        Occupancy(const sc_bv<32>& __data) {
+            size = __data.range(size_s + size_w - 1, size_s).to_uint64();
+            count = __data.range(count_s + count_w - 1, count_s).to_uint64();
+        }
+
+        operator uint64_t() const {
+            uint64_t ret = 0;
+            ret |= static_cast<uint64_t>(size) << size_s;
+            ret |= static_cast<uint64_t>(count) << count_s;
+            return ret;
+        }
+
+        operator sc_bv<32>() const {
+            auto ret = sc_bv<32>();
+            ret.range(size_s + size_w - 1, size_s) = size;
+            ret.range(count_s + count_w - 1, count_s) = count;
+            return ret;
+        }
+
+        std::string to_string() const {
+            std::stringstream ss;
+            ss << "size" << " = " << size;
+            ss << " count" << " = " << count;
+            return std::move(ss.str());
+        }
+
+        friend std::ostream& operator<<(std::ostream& os, const Occupancy& __data) {
+            os << __data.to_string();
+            return os;
+        }
+        static uint32_t get_size (const uint64_t& __data) {
+            return (__data >> size_s) & (~0ULL >> (64 - 16));
+        }
+        static uint32_t get_count (const uint64_t& __data) {
+            return (__data >> count_s) & (~0ULL >> (64 - 16));
+        }
+    };
+
 }
@@ -7,6 +7,7 @@ module AGU
     output wire OUT_stall,
 
     output wire[$clog2(`DTLB_MISS_QUEUE_SIZE):0] OUT_TMQ_free,
+    output Occupancy OUT_TMQ_occupancy,
 
     input BranchProv IN_branch,
 
@@ -219,7 +220,9 @@ TLBMissQueue#(`DTLB_MISS_QUEUE_SIZE) tmq
     .IN_uop(issUOp_c),
 
     .IN_dequeue(TMQ_dequeue),
-    .OUT_uop(TMQ_uop)
+    .OUT_uop(TMQ_uop),
+
+    .OUT_occupancy(OUT_TMQ_occupancy)
 );
 
 // Select waiting op from TLB queue or incoming uop
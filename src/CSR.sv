@@ -28,7 +28,8 @@ module CSR#(parameter NUM_FLOAT_FLAG_UPD = 2)
     output RES_UOp OUT_uop
 );
 
-localparam NUM_PERFC = 17;
+localparam NUM_PERFC = 26;
+localparam TD_PERFC = 17;
 
 typedef logic[11:0] CSR_Id;
 
@@ -780,6 +781,14 @@ always_ff@(posedge clk /*or posedge rst*/) begin
             mhpmcounter[11 + IN_perfcInfo.stallCause] <=
                 mhpmcounter[11 + IN_perfcInfo.stallCause] + 64'(IN_perfcInfo.stallWeigth) + 1;
 
+        // Top-down Slot Counters
+        if (!mcountinhibit[TD_PERFC + TD_RETIRING])
+            mhpmcounter[TD_PERFC + TD_RETIRING] <= mhpmcounter[TD_PERFC + TD_RETIRING] + 64'(IN_perfcInfo.tdRetiring);
+
+        if (!mcountinhibit[TD_PERFC + IN_perfcInfo.tdLostCat])
+            mhpmcounter[TD_PERFC + IN_perfcInfo.tdLostCat] <=
+                mhpmcounter[TD_PERFC + IN_perfcInfo.tdLostCat] + 64'(IN_perfcInfo.tdLost);
+
 
         if (en && IN_uop.valid && (!IN_branch.taken || $signed(IN_uop.sqN - IN_branch.sqN) <= 0)) begin
             OUT_uop.valid <= 1;
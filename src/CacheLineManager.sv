@@ -24,7 +24,9 @@ module CacheLineManager
     output Prefetch_ACK OUT_prefetchAck,
 
     output MemController_Req OUT_memc,
-    input MemController_Res IN_memc
+    input MemController_Res IN_memc,
+
+    output Occupancy OUT_missOccupancy
 );
 
 localparam SIZE = (1<<(`CACHE_SIZE_E - `CLSIZE_E));
@@ -250,6 +252,14 @@ always_comb begin
         missEvictConflict = 1;
 end
 
+// Outstanding misses are the data cache's transfers in the memory controller
+always_comb begin
+    OUT_missOccupancy = Occupancy'{count: 0, size: 16'(`AXI_NUM_TRANS)};
+    for (integer i = 0; i < `AXI_NUM_TRANS; i=i+1)
+        if (IN_memc.transfers[i].valid && IN_memc.transfers[i].cacheID == 0)
+            OUT_missOccupancy.count = OUT_missOccupancy.count + 1;
+end
+
 wire canOutputMiss = (OUT_memc.cmd == MEMC_NONE || !IN_memc.stall[1]);
 assign OUT_missReady = canOutputMiss && !missEvictConflict;
 wire forwardMiss = OUT_missReady && miss.valid &&
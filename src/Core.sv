@@ -102,6 +102,7 @@ IFetch ifetch
 
     .IN_ready(!RN_stall && frontendEn),
     .OUT_instrs(PD_instrs),
+    .OUT_bubble(IF_bubble),
 
     .IN_vmem(CSR_vmem),
     .OUT_pw(PW_reqs[0]),
@@ -115,6 +116,7 @@ SqN RN_nextSqN;
 SqN ROB_curSqN /*verilator public*/;
 
 PD_Instr PD_instrs[`DEC_WIDTH-1:0] /*verilator public*/;
+FrontendBubble IF_bubble;
 
 D_UOp DE_uop[`DEC_WIDTH-1:0] /*verilator public*/;
 DecodeBranch decBranch;
@@ -174,6 +176,7 @@ IS_UOp IS_uop[NUM_PORTS-1:0] /*verilator public*/;
 wire stall[NUM_PORTS-1:0] /*verilator public*/;
 
 wire[NUM_PORTS_TOTAL-1:0][`DEC_WIDTH-1:0] IQ_stalls;
+Occupancy IQ_occupancy[NUM_PORTS-1:0] /*verilator public*/;
 wire DIV_doNotIssue[NUM_PORTS-1:0];
 wire FDIV_doNotIssue[NUM_PORTS-1:0];
 
@@ -211,13 +214,15 @@ generate for (genvar i = 0; i < NUM_PORTS; i=i+1)
         .IN_maxLoadSqN(LB_maxLoadSqN),
         .IN_commitSqN(ROB_curSqN),
 
-        .OUT_uop(IS_uop[i])
+        .OUT_uop(IS_uop[i]),
+        .OUT_occupancy(IQ_occupancy[i])
     );
 endgenerate
 
 StDataLookupUOp stLookupUOp[NUM_AGUS-1:0];
 wire stLookupUOp_ready[NUM_AGUS-1:0];
 ComLimit stCommitLimit[NUM_AGUS-1:0];
+Occupancy IQ_stDataOccupancy[NUM_AGUS-1:0] /*verilator public*/;
 
 generate for (genvar i = 0; i < NUM_AGUS; i=i+1) begin
     StoreDataIQ #(PORT_IQ_SIZE[i+NUM_AGUS], 2, i, `DEC_WIDTH, NUM_PORTS) iqStD
@@ -240,7 +245,8 @@ generate for (genvar i = 0; i < NUM_AGUS; i=i+1) begin
         .OUT_comLimit(stCommitLimit[i]),
 
         .IN_ready(stLookupUOp_ready[i]),
-        .OUT_uop(stLookupUOp[i])
+        .OUT_uop(stLookupUOp[i]),
+        .OUT_occupancy(IQ_stDataOccupancy[i])
     );
 end endgenerate
 
@@ -567,6 +573,7 @@ TLB#(NUM_AGUS, `DTLB_SIZE, `DTLB_ASSOC) dtlb
 
 AGU_UOp AGU_uop[NUM_AGUS-1:0];
 ELD_UOp AGU_eLdUOp[NUM_AGUS-1:0];
+Occupancy AGU_tmqOccupancy[NUM_AGUS-1:0] /*verilator public*/;
 generate for (genvar i = 0; i < NUM_AGUS; i=i+1) begin : aguPortsGen
     AGU#(.RQ_ID(1+i)) agu
     (
@@ -576,6 +583,7 @@ generate for (genvar i = 0; i < NUM_AGUS; i=i+1) begin : aguPortsGen
         .OUT_stall(stall[NUM_ALUS+i]),
 
         .OUT_TMQ_free(),
+        .OUT_TMQ_occupancy(AGU_tmqOccupancy[i]),
 
         .IN_branch(branch),
         .IN_vmem(CSR_vmem),
@@ -686,7 +694,7 @@ wire CC_loadStall[NUM_AGUS-1:0];
 wire CC_storeStall;
 wire LSU_AGUStall[NUM_AGUS-1:0];
 LD_UOp CC_SQ_uopLd[NUM_AGUS-1:0];
-LD_Ack LSU_ldAck[NUM_AGUS-1:0];
+LD_Ack LSU_ldAck[NUM_AGUS-1:0] /*verilator public*/;
 
 MemController_Req LSU_MC_if;
 MemController_Req BLSU_MC_if;
@@ -694,6 +702,7 @@ ST_Ack LSU_stAck;
 
 CacheLineSetDirty LSU_setDirty;
 CacheMiss LSU_cacheMiss;
+Occupancy LSU_lrbOccupancy[NUM_AGUS-1:0] /*verilator public*/;
 
 LoadStoreUnit lsu
 (
@@ -737,7 +746,9 @@ LoadStoreUnit lsu
 
     .IN_ready({NUM_AGUS{1'b1}}),
     .OUT_resultUOp(resultUOps[NUM_ALUS+:NUM_AGUS]),
-    .OUT_flagsUOp(flagUOps[NUM_ALUS+:NUM_AGUS])
+    .OUT_flagsUOp(flagUOps[NUM_ALUS+:NUM_AGUS]),
+
+    .OUT_lrbOccupancy(LSU_lrbOccupancy)
 );
 
 wire CLM_busy;
@@ -745,6 +756,7 @@ wire CLM_ctReadReady[NUM_CT_READS-1:0];
 CacheTableRead CLM_ctRead[NUM_CT_READS-1:0];
 CacheTableResult CLM_ctResult[NUM_CT_READS-1:0];
 wire CLM_missReady;
+Occupancy CLM_missOccupancy /*verilator public*/;
 CacheLineManager cacheLineManager
 (
     .clk(clk),
@@ -770,7 +782,9 @@ CacheLineManager cacheLineManager
     .OUT_prefetchAck(prefetchAck),
 
     .OUT_memc(LSU_MC_if),
-    .IN_memc(IN_memc)
+    .IN_memc(IN_memc),
+
+    .OUT_missOccupancy(CLM_missOccupancy)
 );
 
 Prefetch prefetch;
@@ -805,6 +819,8 @@ ROB rob
 
     .IN_interruptPending(CSR_trapControl.interruptPending),
     .OUT_perfcInfo(ROB_perfcInfo),
+    .IN_rnStall(RN_stall || sqNStall || SQ_flush),
+    .IN_feBubble(IF_bubble),
 
     .IN_branch(branch),
 
@@ -826,6 +842,26 @@ ROB rob
     .OUT_mispredFlush(mispredFlush)
 );
 
+generate
+    if ((1 << `ROB_SIZE_EXP) > OCCUPANCY_MAX || `LB_SIZE > OCCUPANCY_MAX || `SQ_SIZE > OCCUPANCY_MAX ||
+        `LRB_SIZE > OCCUPANCY_MAX || `DTLB_MISS_QUEUE_SIZE > OCCUPANCY_MAX || `AXI_NUM_TRANS > OCCUPANCY_MAX)
+        $error("structure too large for Occupancy");
+    for (genvar i = 0; i < NUM_PORTS; i=i+1)
+        if (PORT_IQ_SIZE[i] > OCCUPANCY_MAX)
+            $error("issue queue too large for Occupancy");
+endgenerate
+
+// ROB, load buffer and store queue entries are allocated at rename. They are freed at commit,
+// except for store queue entries, which are freed once the store is written to the cache.
+Occupancy ROB_occupancy /*verilator public*/;
+Occupancy LB_occupancy /*verilator public*/;
+Occupancy SQ_occupancy /*verilator public*/;
+always_comb begin
+    ROB_occupancy = Occupancy'{count: 16'(SqN'(RN_nextSqN - ROB_curSqN)), size: 16'(1 << `ROB_SIZE_EXP)};
+    LB_occupancy = Occupancy'{count: 16'(SqN'(RN_nextLoadSqN - ROB_comLoadSqN)), size: 16'(`LB_SIZE)};
+    SQ_occupancy = Occupancy'{count: 16'(SqN'(RN_nextStoreSqN - SQ_maxStoreSqN + SqN'(`SQ_SIZE - 1))), size: 16'(`SQ_SIZE)};
+end
+
 wire STORE_busy = !SQ_empty || SQB_busy;
 wire MEM_busy = STORE_busy || CLM_busy;
 
@@ -56,10 +56,22 @@ module ExternalAXISim
 
 localparam NUM_TFS = 1<<ID_LEN;
 localparam BWIDTH = WIDTH / 8;
-localparam MADDR_LEN = 28 - $clog2(WIDTH / 8);
-localparam MEM_LEN = (1 << MADDR_LEN);
 
-reg[WIDTH-1:0] mem[MEM_LEN-1:0] /*verilator public*/;
+// Memory contents are held by the simulator (sparse, shared with the ISA model if possible).
+// bytes is the beat size, i.e. the size of data; the write strobe is passed as an int.
+import "DPI-C" function void ExtMem_Read(input int addr, input int bytes, output bit[WIDTH-1:0] data);
+import "DPI-C" function void ExtMem_Write(input int addr, input int bytes, input bit[WIDTH-1:0] data, input int wstrb);
+generate
+    if (BWIDTH > 32)
+        $error("AXI write strobe does not fit into an int");
+endgenerate
+
+// Writes are applied at the next clock edge before that cycle's reads, like the nonblocking
+// writes into a memory array, so ordering does not depend on the order of the always blocks.
+logic memWriteValid = 0;
+logic[ADDR_LEN-1:0] memWriteAddr;
+logic[WIDTH-1:0] memWriteData;
+logic[BWIDTH-1:0] memWriteStrb;
 
 typedef enum logic[1:0]
 {
@@ -114,6 +126,9 @@ always_comb begin
 end
 
 always_ff@(posedge clk /*or posedge rst*/) begin
+    if (memWriteValid)
+        ExtMem_Write(memWriteAddr, BWIDTH, memWriteData, int'(memWriteStrb));
+
     if (rst) ;
     else if (!(s_axi_rvalid && !s_axi_rready)) begin
         s_axi_rid <= 'x;
@@ -130,8 +145,10 @@ always_ff@(posedge clk /*or posedge rst*/) begin
 
             if (addr[31]) begin
                 // Memory
+                bit[WIDTH-1:0] data;
                 assert((addr & ($clog2(BWIDTH) - 1)) == 0);
-                s_axi_rdata <= mem[addr[$clog2(BWIDTH) +: MADDR_LEN]];
+                ExtMem_Read(addr, BWIDTH, data);
+                s_axi_rdata <= data;
             end
             else begin
                 // MMIO
@@ -220,6 +237,7 @@ end
 assign buf_wready = writeIdxValid;
 always_ff@(posedge clk /*or posedge rst*/) begin
     reg[ID_LEN-1:0] idx = writeIdx;
+    memWriteValid <= 0;
     if (rst) ;
     else if (buf_wready && buf_wvalid) begin
         Transfer w = writes[idx];
@@ -232,10 +250,10 @@ always_ff@(posedge clk /*or posedge rst*/) begin
         if (addr[31]) begin
             // Memory
             assert((addr & ($clog2(BWIDTH) - 1)) == 0);
-            for (integer i = 0; i < BWIDTH; i=i+1) begin
-                if (buf_wstrb[i])
-                    mem[addr[$clog2(BWIDTH) +: MADDR_LEN]][8*i +: 8] <= buf_wdata[8*i +: 8];
-            end
+            memWriteValid <= 1;
+            memWriteAddr <= addr;
+            memWriteData <= buf_wdata;
+            memWriteStrb <= buf_wstrb;
         end
         else begin
             // MMIO
@@ -32,6 +32,7 @@ module IFetch
 
     input wire IN_ready,
     output PD_Instr OUT_instrs[`DEC_WIDTH-1:0],
+    output FrontendBubble OUT_bubble,
 
     input VirtMemState IN_vmem,
     output PageWalk_Req OUT_pw,
@@ -168,6 +169,8 @@ IFetchPipeline ifp
     .IN_ready(IN_ready),
     .OUT_instrs(OUT_instrs),
 
+    .OUT_bubble(OUT_bubble),
+
     .IN_clearICache(IN_clearICache),
     .IN_flushTLB(IN_flushTLB),
     .IN_vmem(IN_vmem),
@@ -217,7 +220,7 @@ always_comb begin
 end
 
 reg waitForInterrupt /* verilator public */;
-reg[$clog2(`RESET_DELAY)-1:0] wfiCount;
+reg[$clog2(`RESET_DELAY)-1:0] wfiCount /* verilator public */;
 reg issuedInterrupt;
 reg resetWait;
 
@@ -45,6 +45,9 @@ module IFetchPipeline#(parameter ASSOC=`CASSOC, parameter NUM_ICACHE_LINES=(1<<(
     input logic IN_ready,
     output PD_Instr OUT_instrs[`DEC_WIDTH-1:0],
 
+    // for perf counters
+    output FrontendBubble OUT_bubble,
+
     input wire IN_clearICache,
     input wire IN_flushTLB,
     input VirtMemState IN_vmem,
@@ -494,6 +497,30 @@ always_ff@(posedge clk /*or posedge rst*/) begin
     end
 end
 
+// Fetch event the current bubble is blamed on by the top-down perf counters, kept until
+// the next packet is fetched. Delayed by the FIFO, aligner and decode stages, so that it
+// lines up (roughly) with the empty rename slots the bubble causes.
+localparam BUBBLE_DELAY = 3;
+FrontendBubble bubble;
+FrontendBubble bubbleDelay[BUBBLE_DELAY-1:0];
+assign OUT_bubble = bubbleDelay[BUBBLE_DELAY-1];
+always_ff@(posedge clk /*or posedge rst*/) begin
+    if (rst || IN_mispr)
+        bubble <= FE_BUBBLE_NONE;
+    else if (tlbMiss || (IN_pw.busy && IN_pw.rqID == RQ_ID))
+        bubble <= FE_BUBBLE_ITLB;
+    else if (cacheMiss)
+        bubble <= FE_BUBBLE_ICACHE;
+    else if (BH_decBranch.taken)
+        bubble <= FE_BUBBLE_BTB;
+    else if (packetRePred.valid)
+        bubble <= FE_BUBBLE_NONE;
+
+    bubbleDelay[0] <= rst ? FE_BUBBLE_NONE : bubble;
+    for (integer i = 1; i < BUBBLE_DELAY; i=i+1)
+        bubbleDelay[i] <= rst ? FE_BUBBLE_NONE : bubbleDelay[i-1];
+end
+
 typedef enum logic[1:0]
 {
     FLUSH_IDLE,
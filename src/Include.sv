@@ -323,6 +323,29 @@ typedef enum logic[2:0]
     STALL_ROB
 } StallCause;
 
+// Top-down categories of rename slots, in the order of their counters (mhpmcounter17 to 25)
+typedef enum logic[3:0]
+{
+    TD_RETIRING,
+    TD_MISPREDICT,
+    TD_ORDERING, // memory ordering violations, fences, CSR writes and traps
+    TD_ICACHE,
+    TD_ITLB,
+    TD_BTB,
+    TD_FRONTEND, // other frontend bubbles (e.g. WFI)
+    TD_MEMORY,
+    TD_CORE
+} TopDownCat;
+
+// Fetch event a frontend bubble is blamed on
+typedef enum logic[1:0]
+{
+    FE_BUBBLE_NONE,
+    FE_BUBBLE_ICACHE,
+    FE_BUBBLE_ITLB,
+    FE_BUBBLE_BTB
+} FrontendBubble;
+
 typedef enum logic[3:0]
 {
     MEMC_NONE,
@@ -887,7 +910,7 @@ typedef struct packed
     logic doNotReIssue;
     logic external;
     logic valid;
-} LD_Ack;
+} LD_Ack /* public */;
 
 typedef struct packed
 {
@@ -1059,12 +1082,26 @@ typedef struct packed
 
 typedef struct packed
 {
+    // Top-down: committed ops, and rename slots lost this cycle
+    logic[2:0] tdRetiring;
+    TopDownCat tdLostCat;
+    logic[$bits(SqN)-1:0] tdLost;
+
     logic[1:0] stallWeigth;
     StallCause stallCause;
     logic[3:0] branchRetire;
     logic[3:0] validRetire;
 } ROB_PERFC_Info;
 
+// Entries in use and size of a queue or buffer, sampled by the simulator for occupancy histograms.
+// Core checks that the configured structures fit into OCCUPANCY_MAX.
+localparam OCCUPANCY_MAX = 16'hFFFF;
+typedef struct packed
+{
+    logic[15:0] count;
+    logic[15:0] size;
+} Occupancy /* public */;
+
 typedef enum logic[1:0] {STRIDE_M_TWO, STRIDE_M_ONE, STRIDE_ONE, STRIDE_TWO} PFStride_t;
 typedef logic[31-`CLSIZE_E:0] PFAddr_t;
 typedef struct packed
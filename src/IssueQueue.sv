@@ -36,7 +36,8 @@ module IssueQueue
     input SqN IN_maxLoadSqN,
     input SqN IN_commitSqN,
 
-    output IS_UOp OUT_uop
+    output IS_UOp OUT_uop,
+    output Occupancy OUT_occupancy
 );
 
 function automatic HasFU(FuncUnit fu);
@@ -76,6 +77,7 @@ R_ST_UOp queue[SIZE-1:0];
 
 reg[$clog2(SIZE):0] insertIndex;
 reg[32:0] reservedWBs;
+assign OUT_occupancy = Occupancy'{count: 16'(insertIndex), size: 16'(SIZE)};
 
 reg[NUM_OPERANDS-1:0] newAvail[SIZE-1:0];
 reg[NUM_OPERANDS-1:0] newAvail_dl[SIZE-1:0];
@@ -11,7 +11,9 @@ module LoadResultBuffer#(parameter SIZE=8)
 
     input wire IN_ready,
     output ResultUOp OUT_resultUOp,
-    output FlagsUOp OUT_flagsUOp
+    output FlagsUOp OUT_flagsUOp,
+
+    output Occupancy OUT_occupancy
 );
 
 typedef struct packed
@@ -60,6 +62,12 @@ always_comb
         entryFree[i] = !entries[i].valid;
 PriorityEncoder#(SIZE, 1) freeEnc(entryFree, '{enq.idx}, '{enq.valid});
 
+always_comb begin
+    OUT_occupancy = Occupancy'{count: 0, size: 16'(SIZE)};
+    for (integer i = 0; i < SIZE; i=i+1)
+        OUT_occupancy.count = OUT_occupancy.count + 16'(entries[i].valid);
+end
+
 always_ff@(posedge clk /*or posedge rst*/) begin
     if (rst) begin
         for (integer i = 0; i < SIZE; i=i+1) begin
@@ -72,7 +72,9 @@ module LoadStoreUnit
 
     input wire[NUM_AGUS-1:0] IN_ready,
     output ResultUOp OUT_resultUOp[NUM_AGUS-1:0],
-    output FlagsUOp OUT_flagsUOp[NUM_AGUS-1:0]
+    output FlagsUOp OUT_flagsUOp[NUM_AGUS-1:0],
+
+    output Occupancy OUT_lrbOccupancy[NUM_AGUS-1:0]
 );
 
 localparam PORT_IDX_BITS = NUM_AGUS == 1 ? 1 : $clog2(NUM_AGUS);
@@ -642,7 +644,9 @@ LoadResultBuffer#(`LRB_SIZE) loadResBuf[NUM_AGUS-1:0]
 
     .IN_ready(IN_ready),
     .OUT_resultUOp(OUT_resultUOp),
-    .OUT_flagsUOp(OUT_flagsUOp)
+    .OUT_flagsUOp(OUT_flagsUOp),
+
+    .OUT_occupancy(OUT_lrbOccupancy)
 );
 
 // Store Pipeline
@@ -11,6 +11,7 @@ module MMIO
 
     IF_CSR_MMIO.MMIO OUT_csrIf
 );
+/* verilator public_module */
 
 assign IF_mem.rbusy = 0;
 assign IF_mem.wbusy = aclintBusy || sysConBusy || (!IF_mem.we);
@@ -52,8 +52,8 @@ module ACLINT
 
 assign OUT_rbusy = 0;
 
-reg[63:0] mtime;
-reg[63:0] mtimecmp;
+reg[63:0] mtime /* verilator public */;
+reg[63:0] mtimecmp /* verilator public */;
 
 reg[19:0] divCnt;
 
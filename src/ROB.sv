@@ -18,6 +18,8 @@ module ROB
 
     // for perf counters
     output ROB_PERFC_Info OUT_perfcInfo,
+    input wire IN_rnStall,
+    input FrontendBubble IN_feBubble,
 
     input BranchProv IN_branch,
     input ComLimit IN_stComLimit[NUM_AGUS-1:0],
@@ -205,6 +207,26 @@ always_ff@(posedge clk /*or posedge rst*/)
 
 reg stop;
 
+// Top-down slot accounting. Every cycle, WIDTH_RN rename slots either deliver an op or stay
+// empty. Ops are counted when they commit (retiring) or are flushed (bad speculation). Empty
+// slots are blamed on the flush being recovered from, on the backend if rename was stalled,
+// or on the frontend otherwise.
+reg rnStall_r;
+FrontendBubble feBubble_r;
+reg recovering;
+TopDownCat recoveryCat;
+always_ff@(posedge clk) begin
+    rnStall_r <= IN_rnStall;
+    feBubble_r <= IN_feBubble;
+end
+
+function automatic TopDownCat FlushCat(FlushCause cause);
+    case (cause)
+        FLUSH_BRANCH_TK, FLUSH_BRANCH_NT, FLUSH_RETURN, FLUSH_IBRANCH: return TD_MISPREDICT;
+        default: return TD_ORDERING;
+    endcase
+endfunction
+
 reg didCommit;
 always_ff@(posedge clk /*or posedge rst*/) begin
 
@@ -215,6 +237,9 @@ always_ff@(posedge clk /*or posedge rst*/) begin
     // by default (if nothing is in the pipeline at all), blame the frontend
     OUT_perfcInfo.stallWeigth <= 3;
     OUT_perfcInfo.stallCause <= STALL_FRONTEND;
+    OUT_perfcInfo.tdRetiring <= 0;
+    OUT_perfcInfo.tdLost <= 0;
+    OUT_perfcInfo.tdLostCat <= TD_FRONTEND;
 
     OUT_trapUOp <= 'x;
     OUT_trapUOp.valid <= 0;
@@ -238,6 +263,8 @@ always_ff@(posedge clk /*or posedge rst*/) begin
         OUT_lastStoreSqN <= 0;
         loadSqN_r <= 0;
         storeSqN_r <= -1;
+        recovering <= 0;
+        recoveryCat <= TD_FRONTEND;
     end
     else begin
         stop <= 0;
@@ -407,6 +434,42 @@ always_ff@(posedge clk /*or posedge rst*/) begin
 
             end
             baseIndex <= baseIndex + cnt;
+            OUT_perfcInfo.tdRetiring <= 3'(cnt);
+        end
+
+        // Top-down: rename slots lost this cycle
+        if (IN_branch.taken) begin
+            // Ops younger than the flushing one are lost, as are all slots of this cycle
+            // (rename's output is dropped).
+            SqN flushed = lastIndex - IN_branch.sqN - 1;
+            if ($signed(flushed) < 0) flushed = 0;
+
+            OUT_perfcInfo.tdLost <= flushed + WIDTH_RN;
+            OUT_perfcInfo.tdLostCat <= FlushCat(IN_branch.cause);
+            recovering <= 1;
+            recoveryCat <= FlushCat(IN_branch.cause);
+        end
+        else begin
+            reg[$clog2(WIDTH_RN):0] renamed = 0;
+            for (integer i = 0; i < WIDTH_RN; i=i+1)
+                if (IN_uop[i].valid) renamed = renamed + 1;
+
+            OUT_perfcInfo.tdLost <= $bits(SqN)'(WIDTH_RN - renamed);
+            if (recovering)
+                OUT_perfcInfo.tdLostCat <= recoveryCat;
+            else if (rnStall_r)
+                OUT_perfcInfo.tdLostCat <=
+                    (OUT_perfcInfo.stallCause == STALL_LOAD || OUT_perfcInfo.stallCause == STALL_STORE) ?
+                    TD_MEMORY : TD_CORE;
+            else case (feBubble_r)
+                FE_BUBBLE_ICACHE: OUT_perfcInfo.tdLostCat <= TD_ICACHE;
+                FE_BUBBLE_ITLB: OUT_perfcInfo.tdLostCat <= TD_ITLB;
+                FE_BUBBLE_BTB: OUT_perfcInfo.tdLostCat <= TD_BTB;
+                default: OUT_perfcInfo.tdLostCat <= TD_FRONTEND;
+            endcase
+
+            if (renamed != 0)
+                recovering <= 0;
         end
 
         // Enqueue ops directly from Rename
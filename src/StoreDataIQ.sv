@@ -25,7 +25,8 @@ module StoreDataIQ
     output ComLimit OUT_comLimit,
 
     input wire IN_ready,
-    output StDataLookupUOp OUT_uop
+    output StDataLookupUOp OUT_uop,
+    output Occupancy OUT_occupancy
 );
 
 localparam ID_LEN = $clog2(SIZE);
@@ -45,6 +46,7 @@ typedef struct packed
 R_ST_UOp queue[SIZE-1:0];
 
 reg[$clog2(SIZE):0] insertIndex;
+assign OUT_occupancy = Occupancy'{count: 16'(insertIndex), size: 16'(SIZE)};
 
 reg[NUM_OPERANDS:0] newAvail[SIZE-1:0];
 reg[NUM_OPERANDS:0] newAvail_dl[SIZE-1:0];
@@ -16,7 +16,9 @@ module TLBMissQueue#(parameter SIZE=4)
     input AGU_UOp IN_uop,
 
     input wire IN_dequeue,
-    output AGU_UOp OUT_uop
+    output AGU_UOp OUT_uop,
+
+    output Occupancy OUT_occupancy
 );
 localparam ID_LEN = $clog2(SIZE);
 
@@ -49,6 +51,12 @@ always_comb begin
     if (OUT_free != 0) OUT_free = OUT_free - $clog2(SIZE)'(OUT_uop.valid);
 end
 
+always_comb begin
+    OUT_occupancy = Occupancy'{count: 0, size: 16'(SIZE)};
+    for (integer i = 0; i < SIZE; i=i+1)
+        OUT_occupancy.count = OUT_occupancy.count + 16'(queue[i].valid);
+end
+
 // Index out
 reg[ID_LEN-1:0] idxOut;
 reg idxOutValid;